@@ -1,16 +1,19 @@
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <spawn.h>
+#include <sys/file.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/sem.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -21,19 +24,29 @@
 
 #if __APPLE__
 #include <mach-o/dyld.h>
-const int SEM_FLAGS = IPC_CREAT | IPC_EXCL | SEM_R | SEM_A;
 #elif __linux__
 #define _GNU_SOURCE
-const int SEM_FLAGS = IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR;
 #endif
 
 
-int nanosleep(const struct timespec *req, struct timespec *rem);
+extern char **environ;
+
+// how long to wait for a newly spawned helper to be ready for commands
+#define HELPER_START_TIMEOUT_MS 30000
 
 #include "cJSON.h"
 
-int semid;
-const int SEMNUM = 0;
+/*
+ * Frames sent back from the helper over the command socket: a header of
+ * frame type & payload length (both uint32, network byte order) followed
+ * by the payload. Keep these in sync with kart/socket_utils.py
+ */
+#define FRAME_HEADER_LEN 8
+// payload: command exit code, int32 network byte order
+#define FRAME_TYPE_EXIT 1
+// payload: caller pid, argc, envc, then each argv and "KEY=VALUE" environ entry
+// as a length followed by that many bytes. All uint32 network byte order.
+#define FRAME_TYPE_COMMAND 2
 
 #ifndef DEBUG
 #define DEBUG 0
@@ -192,21 +205,428 @@ int is_helper_enabled()
 }
 
 /**
- * @brief Exit signal handler for SIGALRM
+ * @brief read exactly len bytes from a socket, retrying on signal interruptions
+ * @param[in] fd socket to read from
+ * @param[out] buf buffer to read into. len>=len
+ * @param[in] len number of bytes to read
+ * @return 0 success, 1 error or EOF
  */
-void exit_on_sigalrm(int sig)
+int read_exactly(int fd, void *buf, size_t len)
 {
-    int semval = semctl(semid, SEMNUM, GETVAL);
-    if (semval < 0)
+    size_t pos = 0;
+    while (pos < len)
     {
-        debug("sigalrm: error getting semval, semid=%d, errno=%d\n", semid, errno);
-        exit(5);
+        ssize_t r = recv(fd, (char *)buf + pos, len - pos, 0);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            debug("recv: r=%zd errno=%d\n", r, errno);
+            return 1;
+        }
+        pos += r;
     }
+    return 0;
+}
+
+/**
+ * @brief wait for the helper to send the command's exit code over the socket
+ * @param[in] socket_fd connected socket the command was sent on
+ * @param[out] exit_code command exit code
+ * @return 0 success, 1 the helper went away without sending an exit code
+ */
+int wait_for_exit_code(int socket_fd, int *exit_code)
+{
+    struct pollfd pfd = {.fd = socket_fd, .events = POLLIN};
+    for (;;)
+    {
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            debug("poll: errno=%d\n", errno);
+            return 1;
+        }
 
-    int exit_code = semval - 1000;
-    semctl(semid, SEMNUM, IPC_RMID);
-    debug("sigalrm: semid=%d semval=%d exit_code=%d\n", semid, semval, exit_code);
-    exit(exit_code);
+        unsigned char header[FRAME_HEADER_LEN];
+        if (read_exactly(socket_fd, header, sizeof(header)))
+        {
+            return 1;
+        }
+        uint32_t frame_type, frame_len;
+        memcpy(&frame_type, header, 4);
+        memcpy(&frame_len, header + 4, 4);
+        frame_type = ntohl(frame_type);
+        frame_len = ntohl(frame_len);
+        debug("frame: type=%u len=%u\n", frame_type, frame_len);
+
+        if (frame_type == FRAME_TYPE_EXIT && frame_len == 4)
+        {
+            uint32_t code;
+            if (read_exactly(socket_fd, &code, sizeof(code)))
+            {
+                return 1;
+            }
+            *exit_code = (int32_t)ntohl(code);
+            return 0;
+        }
+
+        // skip over frames we don't understand
+        char skip[256];
+        while (frame_len > 0)
+        {
+            size_t n = frame_len < sizeof(skip) ? frame_len : sizeof(skip);
+            if (read_exactly(socket_fd, skip, n))
+            {
+                return 1;
+            }
+            frame_len -= n;
+        }
+    }
+}
+
+/**
+ * @brief Check whether an environment entry is passed on to the helper.
+ * KART_USE_HELPER isn't passed to the spawned process so as not to get into a loop
+ * @param[in] entry environment entry, KEY=VALUE
+ * @return 0 no, 1 yes
+ */
+int is_forwarded_env(const char *entry)
+{
+    static const char name[] = "KART_USE_HELPER";
+    size_t name_len = sizeof(name) - 1;
+    return !(strncmp(entry, name, name_len) == 0 && (entry[name_len] == '=' || entry[name_len] == '\0'));
+}
+
+/**
+ * @brief Check whether the command should be sent to the helper as JSON instead of as a
+ * FRAME_TYPE_COMMAND frame, via KART_HELPER_PAYLOAD=json
+ * @return 0 no, 1 yes
+ */
+int use_json_payload()
+{
+    char *env = getenv("KART_HELPER_PAYLOAD");
+    return (env != NULL && strcmp(env, "json") == 0);
+}
+
+char *put_uint32(char *pos, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(pos, &value, sizeof(value));
+    return pos + sizeof(value);
+}
+
+/**
+ * @brief Build the command to send to the helper as a FRAME_TYPE_COMMAND frame,
+ * in a single allocation without parsing the environment
+ * @param[in] argv process argv
+ * @param[in] environ process environment
+ * @param[out] payload_len length of the returned payload
+ * @return payload, or NULL on error
+ */
+char *build_command_frame(char **argv, char **environ, size_t *payload_len)
+{
+    char **ptr;
+    uint32_t argc = 0, envc = 0;
+    size_t len = FRAME_HEADER_LEN + 3 * sizeof(uint32_t);
+    for (ptr = argv; *ptr != NULL; ptr++, argc++)
+    {
+        len += sizeof(uint32_t) + strlen(*ptr);
+    }
+    for (ptr = environ; *ptr != NULL; ptr++)
+    {
+        if (is_forwarded_env(*ptr))
+        {
+            len += sizeof(uint32_t) + strlen(*ptr);
+            envc++;
+        }
+    }
+    if (len - FRAME_HEADER_LEN > UINT32_MAX)
+    {
+        return NULL;
+    }
+
+    char *payload = malloc(len);
+    if (payload == NULL)
+    {
+        return NULL;
+    }
+
+    char *pos = payload;
+    pos = put_uint32(pos, FRAME_TYPE_COMMAND);
+    pos = put_uint32(pos, len - FRAME_HEADER_LEN);
+    pos = put_uint32(pos, getpid());
+    pos = put_uint32(pos, argc);
+    pos = put_uint32(pos, envc);
+    for (ptr = argv; *ptr != NULL; ptr++)
+    {
+        size_t entry_len = strlen(*ptr);
+        pos = put_uint32(pos, entry_len);
+        memcpy(pos, *ptr, entry_len);
+        pos += entry_len;
+    }
+    for (ptr = environ; *ptr != NULL; ptr++)
+    {
+        if (is_forwarded_env(*ptr))
+        {
+            size_t entry_len = strlen(*ptr);
+            pos = put_uint32(pos, entry_len);
+            memcpy(pos, *ptr, entry_len);
+            pos += entry_len;
+        }
+    }
+
+    *payload_len = len;
+    return payload;
+}
+
+/**
+ * @brief Build the command to send to the helper as JSON
+ * @param[in] argv process argv
+ * @param[in] environ process environment
+ * @param[out] payload_len length of the returned payload
+ * @return payload, or NULL on error
+ */
+char *build_json_payload(char **argv, char **environ, size_t *payload_len)
+{
+    cJSON *payload = cJSON_CreateObject();
+    cJSON_AddNumberToObject(payload, "pid", getpid());
+    cJSON *env = cJSON_AddObjectToObject(payload, "environ");
+
+    // cJSON copies the keys, so one buffer can be reused for all of them
+    char *key = NULL;
+    size_t key_sz = 0;
+    char **ptr;
+    for (ptr = environ; *ptr != NULL; ptr++)
+    {
+        if (!is_forwarded_env(*ptr))
+        {
+            continue;
+        }
+        char *eq = strchr(*ptr, '=');
+        size_t key_len = eq ? (size_t)(eq - *ptr) : strlen(*ptr);
+        if (key_len + 1 > key_sz)
+        {
+            key_sz = key_len + 1;
+            char *new_key = realloc(key, key_sz);
+            if (new_key == NULL)
+            {
+                free(key);
+                cJSON_Delete(payload);
+                return NULL;
+            }
+            key = new_key;
+        }
+        memcpy(key, *ptr, key_len);
+        key[key_len] = '\0';
+        cJSON_AddStringToObject(env, key, eq ? eq + 1 : "");
+    }
+    free(key);
+
+    cJSON *args = cJSON_AddArrayToObject(payload, "argv");
+    for (ptr = argv; *ptr != NULL; ptr++)
+    {
+        cJSON_AddItemToArray(args, cJSON_CreateString(*ptr));
+    }
+
+    char *payload_string = cJSON_PrintUnformatted(payload);
+    cJSON_Delete(payload);
+    if (payload_string == NULL)
+    {
+        return NULL;
+    }
+    debug("payload (%lub): %s\n", strlen(payload_string), payload_string);
+    *payload_len = strlen(payload_string);
+    return payload_string;
+}
+
+/**
+ * @brief the current time in microseconds since the epoch - the same clock as kart/tracing.py
+ * @return microseconds since the epoch
+ */
+long long trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief if KART_TRACE is set, append a span to that file as a Chrome trace event.
+ * Keep the file format in sync with kart/tracing.py - it's a JSON array that is never closed,
+ * that any number of processes can append to.
+ * @param[in] name name of the span
+ * @param[in] start when the span started, from trace_now()
+ * @param[in] end when the span ended, from trace_now()
+ * @param[in] args object of extra values to show alongside the span, or NULL. Takes ownership.
+ */
+void trace_span(const char *name, long long start, long long end, cJSON *args)
+{
+    char *trace_filename = getenv("KART_TRACE");
+    if (trace_filename == NULL || *trace_filename == '\0')
+    {
+        cJSON_Delete(args);
+        return;
+    }
+
+    cJSON *event = cJSON_CreateObject();
+    cJSON_AddStringToObject(event, "name", name);
+    cJSON_AddStringToObject(event, "cat", "launcher");
+    cJSON_AddStringToObject(event, "ph", "X");
+    cJSON_AddNumberToObject(event, "ts", (double)start);
+    cJSON_AddNumberToObject(event, "dur", (double)(end - start));
+    cJSON_AddNumberToObject(event, "pid", getpid());
+    cJSON_AddNumberToObject(event, "tid", getpid());
+    if (args != NULL)
+    {
+        cJSON_AddItemToObject(event, "args", args);
+    }
+    char *event_string = cJSON_PrintUnformatted(event);
+    cJSON_Delete(event);
+    if (event_string == NULL)
+    {
+        return;
+    }
+
+    int fd = open(trace_filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0)
+    {
+        debug("Error opening KART_TRACE=%s: %s\n", trace_filename, strerror(errno));
+        free(event_string);
+        return;
+    }
+    // other processes may be appending to the same file
+    flock(fd, LOCK_EX);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0)
+    {
+        if (write(fd, "[\n", 2) < 0)
+        {
+            debug("Error writing to KART_TRACE=%s: %s\n", trace_filename, strerror(errno));
+        }
+    }
+    size_t event_len = strlen(event_string);
+    // one write for the whole event, so that it isn't interleaved with any other writer
+    char *line = malloc(event_len + 2);
+    if (line != NULL)
+    {
+        memcpy(line, event_string, event_len);
+        memcpy(line + event_len, ",\n", 2);
+        if (write(fd, line, event_len + 2) < 0)
+        {
+            debug("Error writing to KART_TRACE=%s: %s\n", trace_filename, strerror(errno));
+        }
+        free(line);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    free(event_string);
+}
+
+/**
+ * @brief connect to the helper socket
+ * @param[in] addr helper socket address
+ * @return connected socket, or -1 if nothing is listening on the socket
+ */
+int connect_to_helper(struct sockaddr_un *addr)
+{
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_fd < 0)
+    {
+        return -1;
+    }
+    if (connect(socket_fd, (struct sockaddr *)addr, sizeof(*addr)) < 0)
+    {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+/**
+ * @brief start the helper in the background, fully detached from this process.
+ * @param[in] cmd_path path to kart_cli
+ * @param[in] socket_filename helper socket
+ * @param[in] helper_environ environment for the helper
+ * @return read end of a pipe the helper writes to once it is ready for commands, or -1 on error
+ */
+int spawn_helper(char *cmd_path, char *socket_filename, char **helper_environ)
+{
+    int ready_pipe[2];
+    if (pipe(ready_pipe) < 0)
+    {
+        debug("pipe: errno=%d\n", errno);
+        return -1;
+    }
+
+    // perform a double fork and spawn to detach the helper, wait till
+    // the first forked child has completed
+    int status;
+    if (fork() == 0)
+    {
+        // create a grandchild process and close stdin/stdout/stderr
+        // to detach the helper process and ensure no fd's from the initial calling
+        // process are left open in it
+        if (fork() == 0)
+        {
+            // start helper in background
+            char ready_fd[16];
+            snprintf(ready_fd, sizeof(ready_fd), "%d", ready_pipe[1]);
+            char *helper_argv[] = {cmd_path, "helper", "--socket", socket_filename, "--ready-fd", ready_fd, NULL};
+
+            int status;
+            close(ready_pipe[0]);
+            environ = helper_environ;
+            for (int fd = 0; fd < 3; fd++){
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+            debug("grandchild: execvp: %s helper --socket %s --ready-fd %s\n", cmd_path, socket_filename, ready_fd);
+            status = execvp(helper_argv[0], helper_argv);
+
+            if (status < 0)
+            {
+                fprintf(stderr, "Error running kart helper, %s: %s", cmd_path, strerror(status));
+                exit(1);
+            }
+        }
+        exit(0);
+    }
+    else
+    {
+        wait(&status);
+    }
+
+    close(ready_pipe[1]);
+    return ready_pipe[0];
+}
+
+/**
+ * @brief wait for a newly spawned helper to be ready for commands
+ * @param[in] ready_fd read end of the pipe returned by spawn_helper
+ * @return 0 ready, 1 the helper exited or timed out before it was ready
+ */
+int wait_for_helper_ready(int ready_fd)
+{
+    struct pollfd pfd = {.fd = ready_fd, .events = POLLIN};
+    int r;
+    while ((r = poll(&pfd, 1, HELPER_START_TIMEOUT_MS)) < 0 && errno == EINTR)
+        ;
+    if (r <= 0)
+    {
+        debug("poll: r=%d errno=%d\n", r, errno);
+        return 1;
+    }
+
+    // the helper writes a single byte once it is ready, if it exits first this is EOF
+    char ready;
+    ssize_t n;
+    while ((n = read(ready_fd, &ready, 1)) < 0 && errno == EINTR)
+        ;
+    return (n == 1) ? 0 : 1;
 }
 
 /**
@@ -223,7 +643,6 @@ void exit_on_sigint(int sig)
 void handle_sigusr1(int sig) {
     // This lets the child signal to us that we shouldn't try to kill kart when SIGINT (Ctrl+C) occurs.
     signal(SIGINT, SIG_IGN);
-    sleep(86400);
 }
 
 int main(int argc, char **argv, char **environ)
@@ -236,6 +655,7 @@ int main(int argc, char **argv, char **environ)
 
     if (is_helper_enabled())
     {
+        long long started_at = trace_now();
         debug("enabled %s, pid=%d\n", cmd_path, getpid());
 
         // Make this process the leader of a process group:
@@ -248,42 +668,17 @@ int main(int argc, char **argv, char **environ)
         int listSZ;
         for (listSZ = 0; environ[listSZ] != NULL; listSZ++)
             ;
-        char **helper_environ = malloc(listSZ * sizeof(char *));
-
-        cJSON *env = NULL;
-        cJSON *args = NULL;
-        cJSON *payload = cJSON_CreateObject();
-        cJSON_AddNumberToObject(payload, "pid", getpid());
-        env = cJSON_AddObjectToObject(payload, "environ");
+        char **helper_environ = malloc((listSZ + 1) * sizeof(char *));
 
         int found = 0;
-        // filter the environment so that KART_USE_HELPER isn't passed to the
-        // spawned process and so getting into a loop
         for (env_ptr = environ; *env_ptr != NULL; env_ptr++)
         {
-            char *key = malloc(strlen(*env_ptr));
-            char *val = malloc(strlen(*env_ptr));
-
-            if (sscanf(*env_ptr, "%[^=]=%[^\x04]", key, val) != 2) {
-                // not found with two values in a key=value pair
-                if (sscanf(*env_ptr, "%[^=]=", key) != 1) {
-                    fprintf(stderr, "error reading environment variable where only name is present\n");
-                }
-            }
-            if (strcmp(key, "KART_USE_HELPER"))
+            if (is_forwarded_env(*env_ptr))
             {
                 helper_environ[found++] = *env_ptr;
-                cJSON_AddStringToObject(env, key, val);
             }
         }
-        helper_environ[listSZ] = NULL;
-
-        char **arg_ptr;
-        args = cJSON_AddArrayToObject(payload, "argv");
-        for (arg_ptr = argv; *arg_ptr != NULL; arg_ptr++)
-        {
-            cJSON_AddItemToArray(args, cJSON_CreateString(*arg_ptr));
-        }
+        helper_environ[found] = NULL;
 
         int fp = open(getcwd(NULL, 0), O_RDONLY);
         int fds[4] = {fileno(stdin), fileno(stdout), fileno(stderr), fp};
@@ -297,82 +692,78 @@ int main(int argc, char **argv, char **environ)
             exit(1);
         }
 
-        int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-
         struct sockaddr_un addr;
         addr.sun_family = AF_UNIX;
         strcpy(addr.sun_path, socket_filename);
 
-        // if there is no open socket perform a double fork and spawn to
-        // detach the helper, wait till the first forked child has completed
-        // then attempt to connect to the socket the helper will open
-        if (connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        int socket_fd = connect_to_helper(&addr);
+
+        // if there is no open socket, start the helper - but only one kart process should do
+        // that at a time, so that parallel invocations share a single helper. Once we hold the
+        // lock, check again in case another process started the helper while we waited for it.
+        if (socket_fd < 0)
         {
             debug("no open socket found @%s\n", socket_filename);
-            int status;
-            if (fork() == 0)
-            {
-                // create a grandchild process and close stdin/stdout/stderr
-                // to detach the helper process and ensure no fd's from the initial calling
-                // process are left open in it
-                if (fork() == 0)
-                {
-                    // start helper in background and wait
-                    char *helper_argv[] = {&cmd_path[0], "helper", "--socket", socket_filename, NULL};
 
-                    int status;
-                    environ = helper_environ;
-                    for (int fd = 0; fd < 3; fd++){
-                        fcntl(fd, F_SETFD, FD_CLOEXEC);
-                    }
-                    debug("grandchild: execvp: %s helper --socket %s\n", cmd_path, socket_filename);
-                    status = execvp(helper_argv[0], helper_argv);
+            size_t lock_filename_sz = strlen(socket_filename) + strlen(".lock") + 1;
+            char *lock_filename = malloc(lock_filename_sz);
+            snprintf(lock_filename, lock_filename_sz, "%s.lock", socket_filename);
+            int lock_fd = open(lock_filename, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0)
+            {
+                fprintf(stderr, "Error locking %s: %s\n", lock_filename, strerror(errno));
+                return 2;
+            }
+            free(lock_filename);
 
-                    if (status < 0)
+            socket_fd = connect_to_helper(&addr);
+            if (socket_fd < 0)
+            {
+                long long spawned_at = trace_now();
+                int ready_fd = spawn_helper(cmd_path, socket_filename, helper_environ);
+                if (ready_fd >= 0)
+                {
+                    debug("parent: waiting for helper to be ready\n");
+                    if (wait_for_helper_ready(ready_fd))
                     {
-                        fprintf(stderr, "Error running kart helper, %s: %s", cmd_path, strerror(status));
-                        exit(1);
+                        debug("parent: helper exited or timed out before it was ready\n");
                     }
+                    close(ready_fd);
+                }
+                trace_span("launcher start helper", spawned_at, trace_now(), NULL);
+
+                socket_fd = connect_to_helper(&addr);
+                if (socket_fd < 0)
+                {
+                    fprintf(stderr, "Timeout connecting to kart helper\n");
+                    return 2;
                 }
-                exit(0);
             }
             else
             {
-                wait(&status);
+                debug("open socket found @%s after waiting for lock\n", socket_filename);
             }
 
-            debug("parent: waiting for socket\n");
-
-            int rtc, max_retry = 50;
-            struct timespec sleep_for = {0, 250 * 1000 * 1000};
-            while ((rtc = connect(socket_fd, (struct sockaddr *)&addr, sizeof addr)) != 0 && --max_retry >= 0)
-            {
-                nanosleep(&sleep_for, NULL);
-            }
-            if (rtc < 0)
-            {
-                fprintf(stderr, "Timeout connecting to kart helper\n");
-                return 2;
-            }
+            // releases the lock
+            close(lock_fd);
         } else {
             debug("open socket found @%s\n", socket_filename);
         }
+        trace_span("launcher connect", started_at, trace_now(), NULL);
 
-        // set up exit code semaphore
-        if ((semid = semget(IPC_PRIVATE, 1, SEM_FLAGS)) < 0)
+        size_t payload_len;
+        char *payload = use_json_payload() ? build_json_payload(argv, environ, &payload_len)
+                                           : build_command_frame(argv, environ, &payload_len);
+        if (payload == NULL)
         {
-            fprintf(stderr, "Error setting up result communication with helper %s\n", strerror(errno));
-            return 5;
+            fprintf(stderr, "Error building command for kart helper\n");
+            return 3;
         }
-
-        cJSON_AddNumberToObject(payload, "semid", semid);
-        char *payload_string = cJSON_PrintUnformatted(payload);
-
-        debug("payload (%lub): %s\n", strlen(payload_string), payload_string);
+        debug("payload: %zub\n", payload_len);
 
         struct iovec iov = {
-            .iov_base = payload_string,
-            .iov_len = strlen(payload_string)};
+            .iov_base = payload,
+            .iov_len = payload_len};
 
         union
         {
@@ -396,22 +787,50 @@ int main(int argc, char **argv, char **environ)
         memcpy((int *)CMSG_DATA(cmsg), fds, sizeof(fds));
         msg.msg_controllen = cmsg->cmsg_len;
 
-        signal(SIGALRM, exit_on_sigalrm);
         signal(SIGINT, exit_on_sigint);
         signal(SIGUSR1, handle_sigusr1);
 
-        if (sendmsg(socket_fd, &msg, 0) < 0)
+        ssize_t sent;
+        while ((sent = sendmsg(socket_fd, &msg, 0)) < 0 && errno == EINTR)
+            ;
+        // send whatever didn't fit in the socket buffer the first time
+        while (sent >= 0 && (size_t)sent < payload_len)
+        {
+            ssize_t r = send(socket_fd, payload + sent, payload_len - sent, 0);
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            sent = (r < 0) ? r : sent + r;
+        }
+        if (sent < 0)
         {
             fprintf(stderr, "Error sending command to kart helper %s\n", strerror(errno));
             return 3;
         };
+        free(payload);
+
+        debug("complete, waiting for exit code\n");
 
-        debug("complete, sleeping until exit\n");
+        // The helper keeps the socket open for as long as the command runs, then sends an exit frame.
+        int exit_code;
+        if (wait_for_exit_code(socket_fd, &exit_code))
+        {
+            fprintf(stderr, "No response from kart helper\n");
+            return 4;
+        }
+        debug("exit_code=%d\n", exit_code);
 
-        // The process needs to sleep for as long as the longest command, clone etc. could take.
-        sleep(86400);
-        fprintf(stderr, "Timed out, no response from kart helper\n");
-        return 4;
+        // the whole round trip - the helper traces what happened in between
+        cJSON *trace_args = cJSON_CreateObject();
+        cJSON *trace_argv = cJSON_AddArrayToObject(trace_args, "argv");
+        for (int i = 1; i < argc; i++)
+        {
+            cJSON_AddItemToArray(trace_argv, cJSON_CreateString(argv[i]));
+        }
+        cJSON_AddNumberToObject(trace_args, "exit_code", exit_code);
+        trace_span("launcher", started_at, trace_now(), trace_args);
+        return exit_code;
     }
     else
     {
@@ -33,8 +33,9 @@ elseif(WIN32)
   set(BUNDLE_PREFIX_REL_EXE ${BUNDLE_DIR_NAME}/kart.exe)
 endif()
 
+set(BUNDLE_DEPENDS venv/.kart-native.stamp)
 if(NOT WIN32)
-  set(BUNDLE_DEPENDS kart_cli_helper)
+  list(APPEND BUNDLE_DEPENDS kart_cli_helper)
 endif()
 
 add_custom_command(
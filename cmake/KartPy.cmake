@@ -88,6 +88,19 @@ if(CLI_HELPER)
   list(APPEND CLI_DEPS ${KART_EXE_HELPER})
 endif()
 
+# The compiled accelerators (native/) are installed straight into the virtualenv site-packages, since Kart
+# itself is an editable install
+set(KART_NATIVE_VENV
+    ${CMAKE_CURRENT_BINARY_DIR}/venv/${Python3_PURELIB_REL_PATH}/$<TARGET_FILE_NAME:kart_native>)
+add_custom_command(
+  OUTPUT venv/.kart-native.stamp
+  DEPENDS kart_native venv/.venv.stamp
+  WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+  COMMAND ${CMAKE_COMMAND} -E copy $<TARGET_FILE:kart_native> ${KART_NATIVE_VENV}
+  COMMAND ${CMAKE_COMMAND} -E touch venv/.kart-native.stamp
+  COMMENT "Installing Kart native module...")
+list(APPEND CLI_DEPS venv/.kart-native.stamp)
+
 add_custom_command(
   OUTPUT ${KART_EXE_VENV} ${KART_EXE_BUILD}
   DEPENDS py-dependencies setup.py
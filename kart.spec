@@ -162,6 +162,8 @@ pyi_analysis = Analysis(
         *collect_submodules('kart.sqlalchemy.adapter'),
         *collect_submodules('kart.tabular'),
         *collect_submodules('kart.upgrade'),
+        # built from native/ and installed directly into the venv
+        '_kart_native',
         # via pygit2
         '_cffi_backend',
         # via a cython module ???
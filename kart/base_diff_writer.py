@@ -12,7 +12,7 @@ from kart.diff_format import DiffFormat
 from kart.diff_structs import FILES_KEY, WORKING_COPY_EDIT, BINARY_FILE, Delta
 from kart.exceptions import CrsError, InvalidOperation
 from kart.key_filters import RepoKeyFilter
-from kart import list_of_conflicts
+from kart import list_of_conflicts, tracing
 from kart.promisor_utils import FetchPromisedBlobsProcess, object_is_promised
 from kart.repo import KartRepoState
 from kart.spatial_filter import SpatialFilter
@@ -342,7 +342,9 @@ class BaseDiffWriter:
         )
         if self.include_wc_diff:
             self._check_for_linked_dataset_changes(ds_path, ds_diff)
-        self.write_ds_diff(ds_path, ds_diff, diff_format=diff_format)
+        # Feature deltas are mostly loaded lazily - so this also includes most of the time spent loading them.
+        with tracing.span("diff write dataset", cat="diff", dataset=ds_path):
+            self.write_ds_diff(ds_path, ds_diff, diff_format=diff_format)
         return has_changes
 
     def write_ds_diff(self):
@@ -480,13 +482,32 @@ class BaseDiffWriter:
                 return None
             return callable()
 
+        from kart.spatial_filter.index import FeatureEnvelopeIndex
+
+        # Features with indexed envelopes can mostly be matched without being loaded.
+        with FeatureEnvelopeIndex.open(self.repo) as envelope_index:
+            old_envelope_matches = old_spatial_filter.match_indexed_envelopes(
+                envelope_index, _lazy_blob_ids(d.old for k, d in unfiltered_deltas)
+            )
+            new_envelope_matches = new_spatial_filter.match_indexed_envelopes(
+                envelope_index, _lazy_blob_ids(d.new for k, d in unfiltered_deltas)
+            )
+
         delta_fetcher = self._get_delta_fetcher(ds_path)
 
         for key, delta in unfiltered_deltas:
             do_yield = bool(delta.flags & WORKING_COPY_EDIT)
-            omr = lazy_eval(lambda: old_spatial_filter.matches_delta_value(delta.old))
+            omr = lazy_eval(
+                lambda: old_spatial_filter.matches_delta_value(
+                    delta.old, old_envelope_matches
+                )
+            )
             do_yield |= bool(omr)
-            nmr = lazy_eval(lambda: new_spatial_filter.matches_delta_value(delta.new))
+            nmr = lazy_eval(
+                lambda: new_spatial_filter.matches_delta_value(
+                    delta.new, new_envelope_matches
+                )
+            )
             do_yield |= bool(nmr)
             if omr is not None and nmr is not None:
                 self.record_spatial_filter_stat(
@@ -736,6 +757,15 @@ class BaseDiffWriter:
             self.linked_dataset_changes.add(ds_path)
 
 
+def _lazy_blob_ids(key_values):
+    """Returns the blob IDs of the features in the given delta KeyValues that haven't been loaded yet."""
+    return [
+        kv.value.blob_id
+        for kv in key_values
+        if kv is not None and hasattr(kv.value, "blob_id")
+    ]
+
+
 class FeatureDeltaFetcher:
     """
     Given a diff Delta, either reports that it is available immediately, or kicks off a fetch so that it will be
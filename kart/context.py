@@ -63,8 +63,13 @@ class Context(object):
             allowed_states = KartRepoState.NORMAL
 
         if not hasattr(self, "_repo"):
+            from . import helper_state
+
             try:
-                self._repo = KartRepo(self.repo_path)
+                self._repo = helper_state.get_warm_repo(
+                    self.repo_path
+                ) or KartRepo(self.repo_path)
+                helper_state.report_repo_opened(self.repo_path)
             except NotFound:
                 if self.user_repo_path:
                     message = "Not an existing Kart repository"
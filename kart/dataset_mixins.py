@@ -142,13 +142,9 @@ class DatasetDiffMixin:
                 other, key_encoder_method, key_filter, reverse=reverse
             )
         else:
-            raw_diff = self.get_raw_diff_for_subtree(
+            deltas = self.get_raw_deltas_for_subtree(
                 other, subtree_name, reverse=reverse
             )
-            # NOTE - we could potentially call diff.find_similar() to detect renames here
-            deltas = self.wrap_deltas_from_raw_diff(
-                raw_diff, lambda path: f"{subtree_name}/{path}"
-            )
 
         def _no_dataset_error(method_name):
             raise RuntimeError(
@@ -244,6 +240,42 @@ class DatasetDiffMixin:
                 path if old_blob else None, path if new_blob else None
             )
 
+    def get_raw_deltas_for_subtree(
+        self: "BaseDataset",
+        other: Optional["BaseDataset"],
+        subtree_name: str,
+        reverse: bool = False,
+    ):
+        """
+        Yields RawDiffDeltas for every change between some subtree of this dataset and the same subtree of another
+        dataset, with paths relative to the dataset. Large diffs are stored in the repo's diff-cache, so the same diff
+        is streamed from the cache next time instead of being run again - see kart.diff_cache.RawDiffCache.
+        """
+        self_subtree = self.get_subtree(subtree_name)
+        other_subtree = other.get_subtree(subtree_name) if other else self._empty_tree
+        if reverse:
+            old_tree, new_tree = other_subtree, self_subtree
+        else:
+            old_tree, new_tree = self_subtree, other_subtree
+
+        diff_cache = self.repo.diff_cache
+        deltas = diff_cache.get(old_tree, new_tree)
+        if deltas is None:
+            raw_diff = self.get_raw_diff_for_subtree(
+                other, subtree_name, reverse=reverse
+            )
+            # NOTE - we could potentially call diff.find_similar() to detect renames here
+            deltas = self.wrap_deltas_from_raw_diff(raw_diff, lambda path: path)
+            if len(raw_diff) >= diff_cache.MIN_DELTAS:
+                deltas = diff_cache.store(old_tree, new_tree, deltas)
+
+        for d in deltas:
+            if d.old_path is not None:
+                d.old_path = f"{subtree_name}/{d.old_path}"
+            if d.new_path is not None:
+                d.new_path = f"{subtree_name}/{d.new_path}"
+            yield d
+
     def wrap_deltas_from_raw_diff(
         self: "BaseDataset", raw_diff: pygit2.Diff, path_transform: Callable[[str], str]
     ):
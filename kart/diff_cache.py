@@ -0,0 +1,139 @@
+import logging
+import os
+import uuid
+
+import msgpack
+
+from kart.dataset_mixins import RawDiffDelta
+
+L = logging.getLogger(__name__)
+
+
+class RawDiffCache:
+    """
+    An on-disk cache of the raw deltas (the status and paths of each changed blob) between two trees,
+    stored in the repo's gitdir at .kart/diff-cache. Since trees are immutable, the diff between two tree
+    oids never changes, so an entry is simply keyed by the two tree oids. Deltas are stored before any
+    key filtering or spatial filtering is applied - these are applied afterwards, to the deltas from the
+    cache, just as they are to the deltas from a diff - so the same entry serves every filter.
+
+    Only diffs with at least MIN_DELTAS deltas are stored, since smaller diffs are cheap to run again.
+    Once the cache is larger than KART_DIFF_CACHE_SIZE (in MiB), the least recently used entries are removed.
+    Setting KART_DIFF_CACHE_SIZE=0 disables the cache.
+    """
+
+    DIRNAME = "diff-cache"
+
+    MIN_DELTAS = 1000
+
+    DEFAULT_MAX_SIZE = 256 * 1024 * 1024
+
+    def __init__(self, repo):
+        self.path = repo.gitdir_path / self.DIRNAME
+        self.max_size = self.get_max_size()
+
+    @classmethod
+    def get_max_size(cls):
+        try:
+            return int(os.environ["KART_DIFF_CACHE_SIZE"]) * 1024 * 1024
+        except (KeyError, ValueError):
+            return cls.DEFAULT_MAX_SIZE
+
+    @property
+    def enabled(self):
+        return self.max_size > 0
+
+    def _entry_path(self, old_tree, new_tree):
+        return self.path / f"{old_tree.id}...{new_tree.id}"
+
+    def get(self, old_tree, new_tree):
+        """
+        Returns an iterable of the RawDiffDeltas from old_tree -> new_tree that were previously stored,
+        with paths relative to those trees, or None if this diff isn't in the cache.
+        The deltas are read from disk as they are iterated over.
+        """
+        if not self.enabled:
+            return None
+        entry_path = self._entry_path(old_tree, new_tree)
+        try:
+            # Marks this entry as recently used, so it is the last to be evicted.
+            os.utime(entry_path)
+        except FileNotFoundError:
+            return None
+        except OSError:
+            # Probably a read-only repo - we can still read the entry.
+            if not entry_path.exists():
+                return None
+        L.debug("diff-cache hit: %s", entry_path.name)
+        return self._read_entry(entry_path)
+
+    def _read_entry(self, entry_path):
+        with open(entry_path, "rb") as f:
+            for status, status_char, old_path, new_path in msgpack.Unpacker(
+                f, raw=False
+            ):
+                yield RawDiffDelta(status, status_char, old_path, new_path)
+
+    def store(self, old_tree, new_tree, deltas):
+        """
+        Yields the given RawDiffDeltas from old_tree -> new_tree, and stores them in the cache as they are yielded.
+        The entry is only added once every delta has been yielded, so a partially consumed diff isn't stored.
+        """
+        if not self.enabled:
+            yield from deltas
+            return
+
+        entry_path = self._entry_path(old_tree, new_tree)
+        tmp_path = self.path / f".tmp-{uuid.uuid4().hex}"
+        try:
+            self.path.mkdir(exist_ok=True)
+            f = open(tmp_path, "wb")
+        except OSError as e:
+            L.info("Can't store diff in diff-cache: %s", e)
+            yield from deltas
+            return
+
+        stored = True
+        try:
+            with f:
+                packer = msgpack.Packer(use_bin_type=True)
+                for d in deltas:
+                    if stored:
+                        entry = (d.status, d.status_char, d.old_path, d.new_path)
+                        try:
+                            f.write(packer.pack(entry))
+                        except OSError as e:
+                            # Eg, the disk is full - the diff itself is still fine.
+                            L.info("Can't store diff in diff-cache: %s", e)
+                            stored = False
+                    yield d
+            if stored:
+                os.replace(tmp_path, entry_path)
+                L.debug("diff-cache store: %s", entry_path.name)
+        finally:
+            tmp_path.unlink(missing_ok=True)
+
+        if stored:
+            self.evict()
+
+    def evict(self):
+        """Removes the least recently used entries until the cache is no larger than max_size."""
+        entries = []
+        total_size = 0
+        for entry_path in self.path.iterdir():
+            if entry_path.name.startswith("."):
+                continue
+            try:
+                stat = entry_path.stat()
+            except FileNotFoundError:
+                continue
+            entries.append((stat.st_mtime, stat.st_size, entry_path))
+            total_size += stat.st_size
+
+        entries.sort()
+        for mtime, size, entry_path in entries:
+            if total_size <= self.max_size:
+                break
+            L.debug("diff-cache evict: %s", entry_path.name)
+            entry_path.unlink(missing_ok=True)
+            total_size -= size
@@ -1,10 +1,11 @@
+import concurrent.futures
 import threading
+from collections import defaultdict
 
 import pygit2
 
+from kart import native
 from kart.diff_util import get_dataset_diff
-from kart.exceptions import SubprocessError
-from kart import subprocess_util as subprocess
 
 ACCURACY_SUBTREE_SAMPLES = {
     "veryfast": 2,
@@ -17,36 +18,104 @@ ACCURACY_SUBTREE_SAMPLES = {
 ACCURACY_CHOICES = ("veryfast", "fast", "medium", "good", "exact")
 
 
-def get_exact_diff_blob_count(repo, tree1, tree2):
+_TREE_MODE = 0o040000
+
+
+def _parse_raw_tree(data):
+    """
+    Yields (sort_key, mode, oid) for each entry in the given raw git tree object. The sort key is the entry's name,
+    with a trailing "/" if it is a tree - entries are sorted by this key in git's tree order.
+    """
+    data = bytes(data)
+    pos = 0
+    while pos < len(data):
+        space = data.index(b" ", pos)
+        nul = data.index(b"\0", space)
+        mode = int(data[pos:space], 8)
+        name = data[space + 1 : nul]
+        oid = data[nul + 1 : nul + 21]
+        if len(oid) != 20:
+            raise ValueError("Invalid tree object")
+        pos = nul + 21
+        yield (name + b"/" if mode == _TREE_MODE else name), mode, oid
+
+
+def diff_raw_trees(data1, data2):
+    """
+    Given two raw git tree objects, returns (blob_count, subtree_pairs) - the number of entries that differ and
+    aren't trees, and a list of (oid1, oid2) pairs (each oid as 20 bytes, or None if missing) for the child trees
+    which differ, which can be compared in turn using this same function. Only entries with the same name are
+    compared, and by mode and oid only. Uses _kart_native if it is available - this is the reference implementation.
+    """
+    if native.lib is not None:
+        return native.lib.diff_raw_trees(data1, data2)
+
+    entries1 = {key: (mode, oid) for key, mode, oid in _parse_raw_tree(data1)}
+    entries2 = {key: (mode, oid) for key, mode, oid in _parse_raw_tree(data2)}
+    blob_count = 0
+    subtree_pairs = []
+    for key in sorted(entries1.keys() | entries2.keys()):
+        entry1 = entries1.get(key)
+        entry2 = entries2.get(key)
+        if entry1 == entry2:
+            continue
+        if key.endswith(b"/"):
+            subtree_pairs.append(
+                (entry1[1] if entry1 else None, entry2[1] if entry2 else None)
+            )
+        else:
+            blob_count += 1
+    return blob_count, subtree_pairs
+
+
+def split_exact_diff(repo, tree1, tree2):
     """
-    Returns an exact blob count for the diff between the two pygit2.Tree instances
+    Splits the task of counting the blobs that differ between the two pygit2.Tree instances into smaller tasks.
+    Returns (blob_count, subtree_pairs) - the number of differing blobs that are direct children of the given trees,
+    and a list of (oid1, oid2) pairs of subtrees which also need to be counted using count_diff_blobs.
     """
     if tree1 == tree2:
-        return 0
+        return 0, []
+    return diff_raw_trees(tree1.read_raw(), tree2.read_raw())
 
-    git_rev_spec = f"{tree1.id}..{tree2.id}"
-    p = subprocess.Popen(
-        [
-            "git",
-            "-C",
-            repo.path,
-            "diff",
-            "--name-only",
-            "--no-renames",
-            git_rev_spec,
-        ],
-        stdout=subprocess.PIPE,
-        encoding="utf-8",
-    )
-    count = sum(1 for x in p.stdout)
-    retcode = p.wait()
-    if retcode != 0:
-        raise SubprocessError("Error calling git diff", exit_code=retcode)
+
+def count_diff_blobs(repo, subtree_pairs, cancel_token=None):
+    """
+    Returns the number of blobs that differ between each of the given (oid1, oid2) pairs of subtrees - as returned
+    by diff_raw_trees - by walking down through every pair of subtrees that differ. Subtrees that are the same in
+    both are never read, and paths are never generated.
+    """
+    count = 0
+    stack = list(subtree_pairs)
+    while stack:
+        if cancel_token is not None:
+            cancel_token.check()
+        oid1, oid2 = stack.pop()
+        blob_count, child_pairs = diff_raw_trees(
+            _read_raw_tree(repo, oid1), _read_raw_tree(repo, oid2)
+        )
+        count += blob_count
+        stack.extend(child_pairs)
     return count
 
 
+def _read_raw_tree(repo, oid):
+    if oid is None:
+        return b""
+    return repo[pygit2.Oid(raw=oid)].read_raw()
+
+
+def get_exact_diff_blob_count(repo, tree1, tree2, cancel_token=None):
+    """
+    Returns an exact blob count for the diff between the two pygit2.Tree instances - the same as the number of
+    paths output by `git diff --name-only --no-renames`, but without generating any of the paths.
+    """
+    blob_count, subtree_pairs = split_exact_diff(repo, tree1, tree2)
+    return blob_count + count_diff_blobs(repo, subtree_pairs, cancel_token)
+
+
 def get_approximate_diff_blob_count(
-    repo, accuracy, tree1, tree2, dataset_path, path_encoder
+    repo, accuracy, tree1, tree2, dataset_path, path_encoder, cancel_token=None
 ):
     """
     Returns an approximate blob count of the required accuracy for the diff between the two pygit2.Tree instances,
@@ -58,10 +127,11 @@ def get_approximate_diff_blob_count(
 
     total_samples_to_take = ACCURACY_SUBTREE_SAMPLES[accuracy]
     return path_encoder.diff_estimate(
-        tree1, tree2, path_encoder.branches, total_samples_to_take
+        tree1, tree2, path_encoder.branches, total_samples_to_take, cancel_token
     )
 
 
+# Setting this cancels every estimate that is running - see CancellationToken.
 terminate_estimate_thread = threading.Event()
 
 
@@ -69,6 +139,31 @@ class ThreadTerminated(RuntimeError):
     pass
 
 
+class CancellationToken:
+    """
+    Used to cancel an estimate that is running. A token is also cancelled when its parent is cancelled - each
+    estimate has its own token, which is a child of the caller's token if one is given, and ultimately they are all
+    children of terminate_estimate_thread. Has the same is_set() / set() interface as threading.Event.
+    """
+
+    def __init__(self, parent=terminate_estimate_thread):
+        self.parent = parent
+        self._event = threading.Event()
+
+    def set(self):
+        self._event.set()
+
+    def is_set(self):
+        return self._event.is_set() or (
+            self.parent is not None and self.parent.is_set()
+        )
+
+    def check(self):
+        """Raises ThreadTerminated if this token has been cancelled."""
+        if self.is_set():
+            raise ThreadTerminated()
+
+
 def get_data_tree(repo, ds):
     if ds:
         return ds.feature_tree if ds.DATASET_TYPE == "table" else ds.tile_tree
@@ -83,12 +178,17 @@ def estimate_diff_feature_counts(
     *,
     include_wc_diff=False,
     accuracy,
+    cancel_token=None,
+    num_threads=None,
 ):
     """
     Estimates feature counts for each dataset in the given diff.
     Returns a dict (keys are dataset paths; values are feature counts)
     Datasets with (probably) no features changed are not present in the dict.
     `accuracy` should be one of ACCURACY_CHOICES
+    The work is shared between a pool of num_threads threads - the estimate for each dataset is a separate task,
+    and exact counts are split further into a task per subtree. Raises ThreadTerminated if the cancel_token (or
+    terminate_estimate_thread) is set before the estimate is complete.
     """
     base = base.peel(pygit2.Tree)
     target = target.peel(pygit2.Tree)
@@ -108,67 +208,115 @@ def estimate_diff_feature_counts(
         if annotation is not None:
             return annotation
 
+    # This token is cancelled if the caller cancels the estimate, but also if any part of the estimate fails -
+    # there's no point in the other threads continuing.
+    estimate_token = CancellationToken(
+        cancel_token if cancel_token is not None else terminate_estimate_thread
+    )
+
     base_rs = repo.structure(base)
     target_rs = repo.structure(target)
 
     base_ds_paths = {ds.path for ds in base_rs.datasets()}
     target_ds_paths = {ds.path for ds in target_rs.datasets()}
-    all_ds_paths = base_ds_paths | target_ds_paths
+    all_ds_paths = sorted(base_ds_paths | target_ds_paths)
     workdir_diff_cache = repo.working_copy.workdir_diff_cache()
 
-    dataset_change_counts = {}
-    for dataset_path in all_ds_paths:
-        if terminate_estimate_thread.is_set():
-            raise ThreadTerminated()
-
-        base_ds = base_rs.datasets().get(dataset_path)
-        target_ds = target_rs.datasets().get(dataset_path)
-        if not base_ds and not target_ds:
-            continue
-
-        base_data_tree = get_data_tree(repo, base_ds)
-        target_data_tree = get_data_tree(repo, target_ds)
-        if (base_ds or target_ds).DATASET_TYPE != "table":
-            # point-cloud datasets have a small number of tiles, so we can just count them.
-            accuracy = "exact"
-
-        if accuracy == "exact" and include_wc_diff:
-            # can't really avoid this - to generate an exact count for this diff we have to generate the diff
-
-            ds_diff = get_dataset_diff(
-                dataset_path,
-                base_rs.datasets(),
-                target_rs.datasets(),
-                include_wc_diff=include_wc_diff,
-                workdir_diff_cache=workdir_diff_cache,
-            )
-            ds_total = len(ds_diff.get("feature", []))
-
-        elif accuracy == "exact":
-            # nice, simple, no stats involved. but slow :/
-            ds_total = get_exact_diff_blob_count(repo, base_data_tree, target_data_tree)
-        else:
-            path_encoder = (
-                base_ds.feature_path_encoder
-                if base_ds
-                else target_ds.feature_path_encoder
-            )
-            ds_total = get_approximate_diff_blob_count(
-                repo,
-                accuracy,
-                base_data_tree,
-                target_data_tree,
-                dataset_path,
-                path_encoder,
-            )
-            if include_wc_diff and target_ds:
-                # TODO: this code shouldn't special-case tabular working copies
-                table_wc = repo.working_copy.tabular
-                if table_wc:
-                    ds_total += table_wc.tracking_changes_count(target_ds)
-
-        if ds_total:
-            dataset_change_counts[dataset_path] = ds_total
+    dataset_change_counts = defaultdict(int)
+    with concurrent.futures.ThreadPoolExecutor(max_workers=num_threads) as executor:
+        future_to_dataset_path = {}
+        # Things that depend on the working copy are done on this thread, once everything else is submitted.
+        working_copy_tasks = []
+
+        try:
+            for dataset_path in all_ds_paths:
+                estimate_token.check()
+
+                base_ds = base_rs.datasets().get(dataset_path)
+                target_ds = target_rs.datasets().get(dataset_path)
+                if not base_ds and not target_ds:
+                    continue
+
+                base_data_tree = get_data_tree(repo, base_ds)
+                target_data_tree = get_data_tree(repo, target_ds)
+                ds_accuracy = accuracy
+                if (base_ds or target_ds).DATASET_TYPE != "table":
+                    # point-cloud datasets have a small number of tiles, so we can just count them.
+                    ds_accuracy = "exact"
+
+                if ds_accuracy == "exact" and include_wc_diff:
+                    # can't really avoid this - to generate an exact count for this diff we have to generate the diff
+                    working_copy_tasks.append((dataset_path, None))
+                    continue
+
+                if ds_accuracy == "exact":
+                    # nice, simple, no stats involved.
+                    blob_count, subtree_pairs = split_exact_diff(
+                        repo, base_data_tree, target_data_tree
+                    )
+                    dataset_change_counts[dataset_path] += blob_count
+                    for subtree_pair in subtree_pairs:
+                        future = executor.submit(
+                            count_diff_blobs, repo, [subtree_pair], estimate_token
+                        )
+                        future_to_dataset_path[future] = dataset_path
+                else:
+                    path_encoder = (
+                        base_ds.feature_path_encoder
+                        if base_ds
+                        else target_ds.feature_path_encoder
+                    )
+                    future = executor.submit(
+                        get_approximate_diff_blob_count,
+                        repo,
+                        ds_accuracy,
+                        base_data_tree,
+                        target_data_tree,
+                        dataset_path,
+                        path_encoder,
+                        estimate_token,
+                    )
+                    future_to_dataset_path[future] = dataset_path
+                    if include_wc_diff and target_ds:
+                        working_copy_tasks.append((dataset_path, target_ds))
+
+            for dataset_path, target_ds in working_copy_tasks:
+                estimate_token.check()
+                if target_ds is None:
+                    ds_diff = get_dataset_diff(
+                        dataset_path,
+                        base_rs.datasets(),
+                        target_rs.datasets(),
+                        include_wc_diff=include_wc_diff,
+                        workdir_diff_cache=workdir_diff_cache,
+                    )
+                    dataset_change_counts[dataset_path] += len(
+                        ds_diff.get("feature", [])
+                    )
+                else:
+                    # TODO: this code shouldn't special-case tabular working copies
+                    table_wc = repo.working_copy.tabular
+                    if table_wc:
+                        dataset_change_counts[
+                            dataset_path
+                        ] += table_wc.tracking_changes_count(target_ds)
+
+            for future in concurrent.futures.as_completed(future_to_dataset_path):
+                dataset_path = future_to_dataset_path[future]
+                dataset_change_counts[dataset_path] += future.result()
+
+        except BaseException:
+            # Stop any tasks that are running, and don't start any more.
+            estimate_token.set()
+            for future in future_to_dataset_path:
+                future.cancel()
+            raise
+
+    dataset_change_counts = {
+        dataset_path: ds_total
+        for dataset_path, ds_total in dataset_change_counts.items()
+        if ds_total
+    }
 
     if not include_wc_diff:
         repo.diff_annotations.store(
@@ -178,7 +326,6 @@ def estimate_diff_feature_counts(
             data=dataset_change_counts,
         )
 
-    if terminate_estimate_thread.is_set():
-        raise ThreadTerminated()
+    estimate_token.check()
 
     return dataset_change_counts
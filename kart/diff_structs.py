@@ -49,6 +49,10 @@ class KeyValue:
             self._cached_value = self.value()
         return self._cached_value
 
+    def discard_cached_value(self):
+        """Forgets the result of evaluating a lazy value - it will be evaluated again if it is needed again."""
+        self.__dict__.pop("_cached_value", None)
+
 
 # Delta flags:
 WORKING_COPY_EDIT = 0x1  # Delta represents a change made in the WC - it is "dirty".
@@ -147,6 +151,16 @@ class Delta:
             return self.new.get_lazy_value()
         return None
 
+    def discard_cached_values(self):
+        """
+        Forgets any lazily evaluated values that have been cached. Diff writers that stream their output call this
+        once a delta has been written, so that the values of every delta in the diff don't accumulate in memory.
+        """
+        if self.old is not None:
+            self.old.discard_cached_value()
+        if self.new is not None:
+            self.new.discard_cached_value()
+
     @property
     def key(self):
         # To be stored in a Diff, a Delta needs a single key.
@@ -7,6 +7,7 @@ from kart.exceptions import SubprocessError
 from kart.key_filters import DatasetKeyFilter, RepoKeyFilter
 from kart.structure import RepoStructure
 from kart import subprocess_util as subprocess
+from kart import tracing
 
 L = logging.getLogger("kart.diff_util")
 
@@ -130,9 +131,10 @@ def get_dataset_diff(
 
         # If the diff_format is none, then we don't need to do any work to generate the diff. Else:
         if diff_format != DiffFormat.NONE:
-            base_target_diff = from_ds.diff(
-                to_ds, ds_filter=ds_filter, reverse=reverse, diff_format=diff_format
-            )
+            with tracing.span("diff base<>target", cat="diff", dataset=ds_path):
+                base_target_diff = from_ds.diff(
+                    to_ds, ds_filter=ds_filter, reverse=reverse, diff_format=diff_format
+                )
             L.debug("base<>target diff (%s): %s", ds_path, repr(base_target_diff))
 
     if include_wc_diff:
@@ -141,11 +143,12 @@ def get_dataset_diff(
             workdir_diff_cache = target_ds.repo.working_copy.workdir_diff_cache()
 
         if target_ds is not None:
-            target_wc_diff = target_ds.diff_to_working_copy(
-                workdir_diff_cache,
-                ds_filter=ds_filter,
-                convert_to_dataset_format=convert_to_dataset_format,
-            )
+            with tracing.span("diff target<>working copy", cat="diff", dataset=ds_path):
+                target_wc_diff = target_ds.diff_to_working_copy(
+                    workdir_diff_cache,
+                    ds_filter=ds_filter,
+                    convert_to_dataset_format=convert_to_dataset_format,
+                )
             L.debug(
                 "target<>working_copy diff (%s): %s",
                 ds_path,
@@ -1,14 +1,22 @@
+import itertools
 import logging
+import math
+import multiprocessing
 import time
 import uuid
-from contextlib import contextmanager
+import zlib
+from collections import deque
+from contextlib import ExitStack, contextmanager
 from enum import Enum, auto
 
 import click
 import pygit2
 
 from kart.exceptions import NO_CHANGES, InvalidOperation, NotFound, SubprocessError
+from kart.object_builder import merge_trees
+from kart.schema import Schema
 from kart import subprocess_util as subprocess
+from kart import tracing
 from kart.tabular.version import (
     SUPPORTED_VERSIONS,
     dataset_class_for_version,
@@ -17,9 +25,13 @@ from kart.tabular.version import (
 from kart.tabular.import_source import TableImportSource
 from kart.tabular.pk_generation import PkGeneratingTableImportSource
 from kart.timestamps import minutes_to_tz_offset
+from kart.utils import get_num_available_cores
 
 L = logging.getLogger("kart.fast_import")
 
+# Features are sent to the encoding workers in batches of this many.
+ENCODE_BATCH_SIZE = 1000
+
 
 class FastImportSettings:
     """
@@ -27,11 +39,26 @@ class FastImportSettings:
     If not set, reasonable defaults are used.
     """
 
-    def __init__(self, *, max_pack_size=None, max_delta_depth=None):
+    def __init__(
+        self,
+        *,
+        max_pack_size=None,
+        max_delta_depth=None,
+        num_workers=None,
+        num_shards=None,
+    ):
         # Maximum size of pack files
         self.max_pack_size = max_pack_size or "2G"
         # Maximum depth of delta-compression chains
         self.max_delta_depth = max_delta_depth or 0
+        # Number of worker processes that encode features while they are streamed to git-fast-import.
+        # Defaults to the number of available cores.
+        if num_workers is None:
+            num_workers = max(1, int(math.ceil(get_num_available_cores())))
+        self.num_workers = max(1, num_workers)
+        # Number of git-fast-import processes that feature blobs are split between - each one writes its own pack.
+        # The trees they write are merged once they are all done. Defaults to 1 - no sharding.
+        self.num_shards = max(1, num_shards or 1)
 
     def as_args(self):
         args = []
@@ -146,8 +173,11 @@ def git_fast_import(repo, *args):
         stderr=subprocess.DEVNULL,
     )
     try:
-        yield p
-        p.stdin.write(b"\ndone\n")
+        # The git fast-import subprocess span lasts until git has finished with the stream, this one only until
+        # Kart has finished writing it.
+        with tracing.span("fast-import stream", cat="fast-import"):
+            yield p
+            p.stdin.write(b"\ndone\n")
     except BrokenPipeError:
         # if git-fast-import dies early, we get an EPIPE here
         # we'll deal with it below
@@ -276,6 +306,7 @@ def fast_import_tables(
 
     try:
         import_ref = None
+        shard_refs = []
         if header is None:
             # import onto a temp branch. then reset the head branch afterwards.
             import_ref = f"refs/kart-import/{uuid.uuid4()}"
@@ -286,7 +317,22 @@ def fast_import_tables(
             orig_branch = repo.head_branch
             header = generate_header(repo, sources, message, import_ref, from_commit)
 
-        with git_fast_import(repo, *cmd_args) as proc:
+            # Sharding is only supported when importing onto a temp branch, since the final commit is rewritten.
+            if settings.num_shards > 1:
+                shard_refs = [
+                    f"{import_ref}-shard-{i}" for i in range(settings.num_shards)
+                ]
+
+        with ExitStack() as stack:
+            proc = stack.enter_context(git_fast_import(repo, *cmd_args))
+            shard_procs = [
+                stack.enter_context(git_fast_import(repo, *cmd_args))
+                for shard_ref in shard_refs
+            ]
+            for shard_ref, shard_proc in zip(shard_refs, shard_procs):
+                shard_proc.stdin.write(
+                    generate_shard_header(repo, shard_ref).encode("utf8")
+                )
             proc.stdin.write(header.encode("utf8"))
 
             # Write the extra blob that records the repo's version:
@@ -295,21 +341,29 @@ def fast_import_tables(
                     raise ValueError(f"{blob_path} already exists")
 
             for source in sources:
-                _import_single_source(
-                    repo,
-                    source,
-                    replace_existing,
-                    from_commit,
-                    proc,
-                    replace_ids,
-                    limit,
-                    verbosity,
-                )
+                with tracing.span(
+                    "import dataset", cat="fast-import", dest_path=source.dest_path
+                ):
+                    _import_single_source(
+                        repo,
+                        source,
+                        replace_existing,
+                        from_commit,
+                        proc,
+                        replace_ids,
+                        limit,
+                        verbosity,
+                        num_workers=settings.num_workers,
+                        shard_procs=shard_procs,
+                    )
 
         if import_ref is not None:
             # we created a temp branch for the import above.
             # now we need to reset the head branch to the temp branch tip.
             new_tree = repo.revparse_single(import_ref).peel(pygit2.Tree)
+            for shard_ref in shard_refs:
+                shard_tree = repo.revparse_single(shard_ref).peel(pygit2.Tree)
+                new_tree = merge_trees(repo, new_tree, shard_tree)
             if not allow_empty:
                 if new_tree == from_tree:
                     raise NotFound("No changes to commit", exit_code=NO_CHANGES)
@@ -326,8 +380,9 @@ def fast_import_tables(
             )
     finally:
         # remove the import branches
-        if import_ref is not None and import_ref in repo.references:
-            repo.references.delete(import_ref)
+        for ref in [import_ref, *shard_refs]:
+            if ref is not None and ref in repo.references:
+                repo.references.delete(ref)
 
 
 def _import_single_source(
@@ -339,6 +394,8 @@ def _import_single_source(
     replace_ids,
     limit,
     verbosity,
+    num_workers=1,
+    shard_procs=(),
 ):
     """
     repo - the Kart repo to import into.
@@ -352,6 +409,8 @@ def _import_single_source(
         0: no progress information is printed to stdout.
         1: basic status information
         2: full output of `git-fast-import --stats ...`
+    num_workers - how many worker processes to use for encoding features.
+    shard_procs - extra git-fast-import processes to split the feature blobs between, if any.
     """
     replacing_dataset = None
     if replace_existing == ReplaceExisting.GIVEN:
@@ -412,6 +471,10 @@ def _import_single_source(
         feature_blobs_already_written = getattr(
             source, "feature_blobs_already_written", False
         )
+        if limit is not None:
+            # Features can be read ahead of being written, so make sure no features are read past the limit.
+            src_iterator = itertools.islice(src_iterator, limit)
+
         if feature_blobs_already_written:
             # This is an optimisation for upgrading repos in-place from V2 -> V3,
             # which are so similar we don't even need to rewrite the blobs.
@@ -432,20 +495,45 @@ def _import_single_source(
                 replacing_dataset=replacing_dataset,
             )
         else:
-            feature_blob_iter = dataset.import_iter_feature_blobs(
-                repo, src_iterator, source
+            feature_blob_iter = _encode_feature_blobs(
+                repo, dataset, src_iterator, source, num_workers
             )
 
-        for i, (feature_path, blob_data) in enumerate(feature_blob_iter):
-            if feature_blobs_already_written:
-                copy_existing_blob_to_stream(proc.stdin, feature_path, blob_data)
+        shard_streams = [p.stdin for p in shard_procs]
+        num_written = 0
+        for feature_path, blob_data in feature_blob_iter:
+            if isinstance(blob_data, pygit2.Tree):
+                # A whole tree of features that are unchanged from the replacing dataset.
+                tree_path = feature_path
+                num_features = len(blob_data)
             else:
-                write_blob_to_stream(proc.stdin, feature_path, blob_data)
+                tree_path = feature_path.rpartition("/")[0]
+                num_features = 1
 
-            if i and progress_every and i % progress_every == 0:
-                click.echo(f"  {i:,d} features... @{time.monotonic()-t1:.1f}s")
+            if shard_streams:
+                stream = shard_streams[_shard_for_tree(tree_path, len(shard_streams))]
+            else:
+                stream = proc.stdin
+
+            if isinstance(blob_data, pygit2.Tree):
+                copy_existing_tree_to_stream(stream, feature_path, blob_data.id)
+            elif isinstance(blob_data, pygit2.Blob):
+                copy_existing_blob_to_stream(stream, feature_path, blob_data.id)
+            elif feature_blobs_already_written:
+                copy_existing_blob_to_stream(stream, feature_path, blob_data)
+            else:
+                write_blob_to_stream(stream, feature_path, blob_data)
+
+            prev_num_written = num_written
+            num_written += num_features
+            if progress_every and (
+                num_written // progress_every > prev_num_written // progress_every
+            ):
+                click.echo(
+                    f"  {num_written:,d} features... @{time.monotonic()-t1:.1f}s"
+                )
 
-            if limit is not None and i == (limit - 1):
+            if limit is not None and num_written >= limit:
                 click.secho(f"  Stopping at {limit:,d} features", fg="yellow")
                 break
         t2 = time.monotonic()
@@ -464,6 +552,75 @@ def _import_single_source(
         click.echo(f"Closed in {(t3-t2):.0f}s")
 
 
+def _encode_feature_blobs(repo, dataset, src_iterator, source, num_workers):
+    """
+    Yields (feature_path, blob_data) for each feature, the same as dataset.import_iter_feature_blobs - but
+    the features are encoded in batches by a pool of worker processes, while the calling process carries on
+    reading features from the source and writing the encoded blobs to git-fast-import.
+    """
+    # Small imports aren't worth starting the worker processes for.
+    first_features = list(itertools.islice(src_iterator, ENCODE_BATCH_SIZE * 2))
+    src_iterator = itertools.chain(first_features, src_iterator)
+    if num_workers == 1 or len(first_features) <= ENCODE_BATCH_SIZE:
+        yield from dataset.import_iter_feature_blobs(repo, src_iterator, source)
+        return
+
+    schema = source.schema
+    # Only a few batches are in flight at once, so that the reading doesn't get too far ahead of the writing.
+    max_in_flight = num_workers * 2
+    initargs = (repo.path, repo.table_dataset_version, dataset.path, schema.dumps())
+    with multiprocessing.get_context().Pool(
+        num_workers, initializer=_init_encode_worker, initargs=initargs
+    ) as pool:
+        in_flight = deque()
+        for batch in _feature_value_batches(src_iterator, schema):
+            in_flight.append(pool.apply_async(_encode_batch_in_worker, (batch,)))
+            if len(in_flight) >= max_in_flight:
+                yield from in_flight.popleft().get()
+        while in_flight:
+            yield from in_flight.popleft().get()
+
+
+def _feature_value_batches(src_iterator, schema):
+    """
+    Groups the features into batches for the encoding workers. Features are sent as tuples of values in
+    schema order - features from some import sources are DB rows or similar, which can't be pickled.
+    """
+    batch = []
+    for feature in src_iterator:
+        batch.append(tuple(schema.feature_to_raw_dict(feature).values()))
+        if len(batch) >= ENCODE_BATCH_SIZE:
+            yield batch
+            batch = []
+    if batch:
+        yield batch
+
+
+_encode_worker_state = None
+
+
+def _init_encode_worker(repo_path, table_dataset_version, ds_path, schema_data):
+    from kart.repo import KartRepo
+
+    global _encode_worker_state
+    repo = KartRepo(repo_path, validate=False)
+    schema = Schema.loads(schema_data)
+    dataset_class = dataset_class_for_version(table_dataset_version)
+    dataset = dataset_class.new_dataset_for_writing(ds_path, schema, repo)
+    _encode_worker_state = (dataset, schema)
+
+
+def _encode_batch_in_worker(batch):
+    dataset, schema = _encode_worker_state
+    return [dataset.encode_feature(feature, schema) for feature in batch]
+
+
+def _shard_for_tree(tree_path, num_shards):
+    # Features are sharded by the tree that directly contains them - that way, each shard gets a fair share
+    # even when neighbouring primary keys are imported in order, and most trees are only written by one shard.
+    return zlib.crc32(tree_path.encode("utf8")) % num_shards
+
+
 def write_blob_to_stream(stream, blob_path, blob_data):
     stream.write(f"M 644 inline {blob_path}\ndata {len(blob_data)}\n".encode("utf8"))
     stream.write(blob_data)
@@ -480,6 +637,10 @@ def copy_existing_blob_to_stream(stream, blob_path, blob_sha):
     stream.write(f"M 644 {blob_sha} {blob_path}\n".encode("utf8"))
 
 
+def copy_existing_tree_to_stream(stream, tree_path, tree_sha):
+    stream.write(f"M 040000 {tree_sha} {tree_path}\n".encode("utf8"))
+
+
 def generate_header(repo, sources, message, branch, from_commit):
     if message is None:
         message = generate_message(sources)
@@ -497,6 +658,17 @@ def generate_header(repo, sources, message, branch, from_commit):
     return result
 
 
+def generate_shard_header(repo, branch):
+    # Shard commits are only used to get git-fast-import to write out the shard's trees.
+    committer = repo.committer_signature()
+    message = "Kart import shard"
+    return (
+        f"commit {branch}\n"
+        f"committer {committer.name} <{committer.email}> {committer.time} {minutes_to_tz_offset(committer.offset)}\n"
+        f"data {len(message.encode('utf8'))}\n{message}\n"
+    )
+
+
 def generate_message(sources):
     first_source = next(iter(sources))
     return first_source.aggregate_import_source_desc(sources)
@@ -8,6 +8,7 @@ from enum import IntEnum
 
 from osgeo import ogr, osr
 
+from . import native
 from .cli_util import StringFromFile
 from .exceptions import GeometryError
 
@@ -197,15 +198,20 @@ class Geometry(bytes):
             name = f"{name} {suffix}"
         return name
 
-    def envelope(self, only_2d=False, calculate_if_missing=False):
+    def envelope(self, only_2d=False, calculate_if_missing=False, allow_ogr=True):
         """
         Returns the envelope as a tuple of 4, 6, or 8 values, or None if no envelope is stored.
         The tuple ordering is (min-x, max-x, min-y, max-y, min-z?, max-z?, min-m?, max-m?) - ? values may be missing.
         If only_2d is True, then only (min-x, max-x, min-y, max-y) is returned, even if more values are present.
-        if calculate_if_missing is True then the entire geometry is loaded into OGR in order to calculate the envelope.
+        if calculate_if_missing is True then a missing envelope is calculated by walking the WKB - see wkb_envelope -
+        or if that isn't possible, by loading the entire geometry into OGR (unless allow_ogr is False, in which case
+        None is returned - for callers that are about to load the geometry into OGR anyway).
         """
         return geom_envelope(
-            self, only_2d=only_2d, calculate_if_missing=calculate_if_missing
+            self,
+            only_2d=only_2d,
+            calculate_if_missing=calculate_if_missing,
+            allow_ogr=allow_ogr,
         )
 
     @classmethod
@@ -341,6 +347,14 @@ def normalise_gpkg_geom(gpkg_geom):
             else:
                 return Geometry.of(gpkg_geom[:4] + b"\x00\x00\x00\x00" + gpkg_geom[8:])
 
+        if wkb_is_le:
+            # Only the envelope needs changing - which can usually be done without OGR.
+            result = _replace_gpkg_envelope(
+                gpkg_geom, flags, wkb_offset, want_envelope_type
+            )
+            if result is not None:
+                return result
+
     # roundtrip it, the envelope and LE-ness are done by ogr_to_gpkg_geom
     return ogr_to_gpkg_geom(
         gpkg_geom_to_ogr(gpkg_geom),
@@ -348,6 +362,29 @@ def normalise_gpkg_geom(gpkg_geom):
     )
 
 
+def _replace_gpkg_envelope(gpkg_geom, flags, wkb_offset, envelope_type):
+    """
+    Returns the given little-endian geometry with the given type of envelope and srs_id=0, exactly as
+    ogr_to_gpkg_geom would - or None if this can't be done without OGR (see _walk_wkb_envelope).
+    """
+    try:
+        envelope, wkb_end = _walk_wkb_envelope(gpkg_geom, wkb_offset)
+    except ValueError:
+        return None
+    if envelope is None and not flags & _GPKG_EMPTY_BIT:
+        # OGR would set the empty bit - leave that to OGR.
+        return None
+
+    flags = (flags & (_GPKG_LE_BIT | _GPKG_EMPTY_BIT)) | (envelope_type << 1)
+    header = struct.pack("<ccBBi", b"G", b"P", 0, flags, 0)
+    envelope_bytes = b""
+    if envelope_type == GPKG_ENVELOPE_XY:
+        envelope_bytes = struct.pack("<dddd", *envelope[:4])
+    elif envelope_type == GPKG_ENVELOPE_XYZ:
+        envelope_bytes = struct.pack("<dddddd", *envelope)
+    return Geometry(header + envelope_bytes + gpkg_geom[wkb_offset:wkb_end])
+
+
 def gpkg_geom_to_wkb(gpkg_geom):
     """
     Parse GeoPackage geometry values.
@@ -364,8 +401,11 @@ def gpkg_geom_to_wkb(gpkg_geom):
 
     if wkb[0] == 0:
         # Force little-endian
-        geom = ogr.CreateGeometryFromWkb(wkb)
-        wkb = geom.ExportToIsoWkb(ogr.wkbNDR)
+        try:
+            wkb = wkb_to_little_endian(wkb)
+        except ValueError:
+            geom = ogr.CreateGeometryFromWkb(wkb)
+            wkb = geom.ExportToIsoWkb(ogr.wkbNDR)
     return wkb
 
 
@@ -640,7 +680,9 @@ def hex_ewkb_to_gpkg_geom(hex_ewkb):
     return normalise_gpkg_geom(gpkg_geom)
 
 
-def geom_envelope(gpkg_geom, only_2d=False, calculate_if_missing=False):
+def geom_envelope(
+    gpkg_geom, only_2d=False, calculate_if_missing=False, allow_ogr=True
+):
     """
     Parse GeoPackage geometry to a 2D envelope.
     This is a shortcut to avoid instantiating a full OGR geometry if possible.
@@ -657,7 +699,7 @@ def geom_envelope(gpkg_geom, only_2d=False, calculate_if_missing=False):
     if gpkg_geom is None:
         return None
 
-    if not isinstance(gpkg_geom, bytes):
+    if not isinstance(gpkg_geom, (bytes, memoryview)):
         raise TypeError("Expected bytes")
 
     if gpkg_geom[0:2] != b"GP":  # 0x4750
@@ -684,6 +726,12 @@ def geom_envelope(gpkg_geom, only_2d=False, calculate_if_missing=False):
     if envelope_format == "":
         if not calculate_if_missing:
             return None
+        try:
+            envelope = wkb_envelope(gpkg_geom, 8)
+            return envelope[:4] if envelope is not None else None
+        except ValueError:
+            if not allow_ogr:
+                return None
         ogr_geom = gpkg_geom_to_ogr(gpkg_geom)
         if ogr_geom.IsEmpty():
             # envelope is apparently (0, 0, 0, 0), thanks OGR :/
@@ -705,6 +753,155 @@ def geom_envelope(gpkg_geom, only_2d=False, calculate_if_missing=False):
         return envelope
 
 
+def wkb_envelope(wkb, offset=0):
+    """
+    Walks the ISO WKB geometry at the given offset in wkb (which can be bytes or a memoryview), and returns its
+    envelope without using OGR. The envelope is (min-x, max-x, min-y, max-y) for XY and XYM geometries,
+    or (min-x, max-x, min-y, max-y, min-z, max-z) for XYZ and XYZM geometries, or None if the geometry is empty.
+    Raises ValueError if the geometry can't be walked - see _walk_wkb_envelope - in which case use OGR instead.
+    """
+    return _walk_wkb_envelope(wkb, offset)[0]
+
+
+def wkb_to_little_endian(wkb, offset=0):
+    """
+    Returns the ISO WKB geometry at the given offset in wkb as little-endian WKB, without using OGR - the same
+    as OGR's ExportToIsoWkb(ogr.wkbNDR). Raises ValueError if the geometry can't be walked - see _walk_wkb_envelope.
+    """
+    if native.lib is not None:
+        return native.lib.wkb_to_little_endian(wkb, offset)
+    out = bytearray()
+    _walk_wkb_py(wkb, offset, out)
+    return bytes(out)
+
+
+# The geometry types that can be walked without OGR, and the type of their children, if they have children.
+_WKB_CHILD_TYPES = {
+    GeometryType.POINT: None,
+    GeometryType.LINESTRING: None,
+    GeometryType.POLYGON: None,
+    GeometryType.MULTIPOINT: GeometryType.POINT,
+    GeometryType.MULTILINESTRING: GeometryType.LINESTRING,
+    GeometryType.MULTIPOLYGON: GeometryType.POLYGON,
+    GeometryType.GEOMETRYCOLLECTION: None,
+}
+
+
+def _walk_wkb_envelope(wkb, offset):
+    """
+    Walks the ISO WKB geometry at the given offset, and returns (envelope, end_offset) - see wkb_envelope.
+    Only the geometry types in _WKB_CHILD_TYPES are supported - not curves, surfaces, or OGR's non-ISO type codes.
+    Raises ValueError for these, and for geometries with mixed byte orders or dimensions, or with NaN coordinates
+    (other than in an empty point). Uses _kart_native if it is available - this is the reference implementation.
+    """
+    if native.lib is not None:
+        return native.lib.wkb_envelope(wkb, offset)
+    envelope, end_offset, has_z = _walk_wkb_py(wkb, offset, None)
+    if envelope is None:
+        return None, end_offset
+    return tuple(envelope[:6] if has_z else envelope[:4]), end_offset
+
+
+# Deeper nesting than this isn't something that needs to be handled without OGR.
+_WKB_MAX_DEPTH = 32
+
+
+def _walk_wkb_py(wkb, offset, out):
+    if offset < 0:
+        raise ValueError("Invalid WKB")
+    # The last value is set once any point is found - infinite coordinates don't make the envelope empty.
+    envelope = [math.inf, -math.inf, math.inf, -math.inf, math.inf, -math.inf, False]
+    try:
+        end_offset, dims = _walk_wkb_geometry(
+            wkb, offset, None, None, 0, envelope, out
+        )
+    except (struct.error, IndexError):
+        raise ValueError("Invalid WKB")
+    if not envelope[6]:
+        return None, end_offset, dims[1]
+    return envelope, end_offset, dims[1]
+
+
+def _walk_wkb_geometry(wkb, offset, parent_dims, want_type, depth, envelope, out):
+    if depth > _WKB_MAX_DEPTH:
+        raise ValueError("WKB is nested too deeply")
+    byte_order = wkb[offset]
+    if byte_order not in (0, 1):
+        raise ValueError("Invalid WKB byte order")
+    bo = _bo(byte_order)
+    (wkb_type,) = struct.unpack_from(f"{bo}I", wkb, offset + 1)
+    geom_type, iso_zm = wkb_type % 1000, wkb_type // 1000
+    if wkb_type >= 4000 or geom_type not in _WKB_CHILD_TYPES:
+        raise ValueError(f"Unsupported WKB geometry type {wkb_type}")
+    if want_type is not None and geom_type != want_type:
+        raise ValueError(f"Unexpected WKB geometry type {wkb_type}")
+    has_z = iso_zm in (1, 3)
+    dims = (byte_order, has_z, iso_zm in (2, 3))
+    if parent_dims is not None and dims != parent_dims:
+        raise ValueError("WKB has mixed byte orders or dimensions")
+    offset += 5
+    if out is not None:
+        out += struct.pack("<BI", 1, wkb_type)
+
+    num_values = 2 + (iso_zm > 0) + (iso_zm == 3)
+    if geom_type == GeometryType.POINT:
+        x, y = struct.unpack_from(f"{bo}dd", wkb, offset)
+        if math.isnan(x) and math.isnan(y):
+            # POINT EMPTY - see WKB_POINT_EMPTY_LE - doesn't contribute to the envelope.
+            envelope = None
+        offset = _walk_wkb_points(wkb, offset, bo, num_values, 1, has_z, envelope, out)
+        return offset, dims
+
+    (count,) = struct.unpack_from(f"{bo}I", wkb, offset)
+    offset += 4
+    if out is not None:
+        out += struct.pack("<I", count)
+    if geom_type == GeometryType.LINESTRING:
+        offset = _walk_wkb_points(
+            wkb, offset, bo, num_values, count, has_z, envelope, out
+        )
+    elif geom_type == GeometryType.POLYGON:
+        for i in range(count):
+            (num_points,) = struct.unpack_from(f"{bo}I", wkb, offset)
+            offset += 4
+            if out is not None:
+                out += struct.pack("<I", num_points)
+            offset = _walk_wkb_points(
+                wkb, offset, bo, num_values, num_points, has_z, envelope, out
+            )
+    else:
+        child_type = _WKB_CHILD_TYPES[geom_type]
+        for i in range(count):
+            offset, _ = _walk_wkb_geometry(
+                wkb, offset, dims, child_type, depth + 1, envelope, out
+            )
+    return offset, dims
+
+
+def _walk_wkb_points(wkb, offset, bo, num_values, num_points, has_z, envelope, out):
+    values = struct.unpack_from(f"{bo}{num_values * num_points}d", wkb, offset)
+    offset += 8 * len(values)
+    if out is not None:
+        out += struct.pack(f"<{len(values)}d", *values)
+
+    if envelope is None or not values:
+        return offset
+    envelope[6] = True
+    for i in range(0, len(values), num_values):
+        x, y = values[i], values[i + 1]
+        z = values[i + 2] if has_z else 0.0
+        if math.isnan(x) or math.isnan(y) or math.isnan(z):
+            raise ValueError("WKB has NaN coordinates")
+        envelope[0] = min(envelope[0], x)
+        envelope[1] = max(envelope[1], x)
+        envelope[2] = min(envelope[2], y)
+        envelope[3] = max(envelope[3], y)
+        if has_z:
+            envelope[4] = min(envelope[4], z)
+            envelope[5] = max(envelope[5], z)
+    return offset
+
+
 def ring_as_wkt(*points, repeat_first_point=True, dp=None):
     if repeat_first_point:
         points_iter = itertools.chain(points, [points[0]])
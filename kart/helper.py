@@ -1,8 +1,9 @@
-import errno
-import json
+import gc
 import os
+import select
 import signal
 import socket
+import struct
 import sys
 import traceback
 from datetime import datetime
@@ -10,13 +11,18 @@ from pathlib import Path
 
 import click
 
-from . import HELPER_PRESERVE_ENV_VARS
-from .socket_utils import recv_json_and_fds
-from .cli import load_commands_from_args, cli, is_windows, is_darwin, is_linux
+from . import HELPER_PRESERVE_ENV_VARS, helper_state, tracing
+from .socket_utils import recv_command_and_fds, send_exit_frame
+from .cli import load_commands_from_args, cli, is_windows
 
 
 log_filename = None
 
+# How often an idle pool worker checks whether the helper that forked it is still running.
+POOL_WORKER_POLL_INTERVAL = 5
+# Busy pool workers send their PID to the helper in this format.
+POOL_PID = struct.Struct("=i")
+
 
 def _helper_log(msg):
     if log_filename:
@@ -24,6 +30,17 @@ def _helper_log(msg):
             log_file.write(f"{datetime.now()} [{os.getpid()}]: {msg}\n")
 
 
+def _exit_code_from_system_exit(system_exit):
+    # Mirrors how the Python interpreter turns SystemExit into a process exit code.
+    code = system_exit.code
+    if code is None:
+        return 0
+    if isinstance(code, int):
+        return code
+    print(code, file=sys.stderr)
+    return 1
+
+
 def getsid():
     if hasattr(os, "getsid"):
         return os.getsid(0)
@@ -46,8 +63,37 @@ def getsid():
     show_default=True,
     help="Timeout and shutdown helper when no commands received with this time",
 )
+@click.option(
+    "--pool-size",
+    "pool_size",
+    default=0,
+    show_default=True,
+    envvar="KART_HELPER_POOL_SIZE",
+    help=(
+        "Number of pre-forked workers to keep waiting for commands. "
+        "0 forks a new process for each command once it is received."
+    ),
+)
+@click.option(
+    "--warm-repos",
+    "warm_repos",
+    default=4,
+    show_default=True,
+    envvar="KART_HELPER_WARM_REPOS",
+    help=(
+        "Number of recently used repositories to keep open in the helper, "
+        "so that commands don't need to open them from scratch. 0 disables this."
+    ),
+)
+@click.option(
+    "--ready-fd",
+    "ready_fd",
+    type=int,
+    hidden=True,
+    help="File descriptor to write a single byte to once the helper is ready for commands",
+)
 @click.argument("args", nargs=-1, type=click.UNPROCESSED)
-def helper(ctx, socket_filename, timeout, args):
+def helper(ctx, socket_filename, timeout, pool_size, warm_repos, ready_fd, args):
     """Start the background helper process to speed up interaction"""
     if is_windows:
         click.echo("Helper mode not currently supported on Windows")
@@ -77,9 +123,11 @@ def helper(ctx, socket_filename, timeout, args):
     sock = socket.socket(family=socket.AF_UNIX)
     os.umask(0o077)
     try:
-        # TODO - this will take over a socket from an existing running helper process
-        #  it should check to see if another helper is already running and bail out
         if os.path.exists(socket_filename):
+            # Don't take over the socket from another running helper process.
+            if _is_helper_listening(socket_filename):
+                click.echo(f"Helper already running on socket [{socket_filename}]")
+                ctx.exit(1)
             os.unlink(socket_filename)
 
         sock.bind(str(socket_filename))
@@ -106,194 +154,328 @@ def helper(ctx, socket_filename, timeout, args):
     from pygments.formatters import TerminalFormatter
     import pygments.styles.default
 
+    # Move everything allocated so far into the permanent generation, so that the garbage collector
+    # doesn't touch (and so copy-on-write fault) those pages in every forked child.
+    gc.freeze()
+
+    warm_state = _WarmState(warm_repos)
+
+    if ready_fd is not None:
+        # Let kart_cli_helper know that commands won't wait on any more startup work.
+        try:
+            os.write(ready_fd, b"\x01")
+            os.close(ready_fd)
+        except OSError as e:
+            _helper_log(f"error signalling ready: {e}")
+        _helper_log("ready")
+
+    if pool_size > 0:
+        _run_worker_pool(
+            sock, socket_filename, timeout, pool_size, warm_state, required_environment
+        )
+
+    # The helper will exit if no command received within timeout
+    sock.settimeout(timeout)
     while True:
-        # The helper will exit if no command received within timeout
-        sock.settimeout(timeout)
+        _helper_log(f"socket ready, waiting for messages (timeout={timeout})")
+        readable, _, _ = select.select([sock, *warm_state.fds], [], [], timeout)
+        if not readable:
+            _helper_log("socket timeout, bye (0)")
+            _unlink_socket(socket_filename)
+            sys.exit()
+
+        if warm_state.is_readable(readable):
+            warm_state.update()
+        if sock not in readable:
+            continue
+
         try:
-            _helper_log(f"socket ready, waiting for messages (timeout={timeout})")
             client, info = sock.accept()
-            _helper_log("pre-fork messaged received")
-            if os.fork() != 0:
-                # parent
-                continue
-            else:
-                # child
-                _helper_log("post-fork")
-
-                payload, fds = recv_json_and_fds(client, maxfds=4)
-                if not payload or len(fds) != 4:
-                    click.echo(
-                        "No payload or fds passed from kart_cli_helper: exit(-1)"
-                    )
-                    sys.exit(-1)
-
-                # as there is a new process the child could drop permissions here or use a security system to set up
-                # controls, chroot etc.
-
-                # change to the calling processes working directory
-                # TODO - pass as path for windows
-                os.fchdir(fds[3])
-                _helper_log(f"cwd={os.getcwd()}")
-
-                # set this processes stdin/stdout/stderr to the calling processes passed in fds
-                # TODO - have these passed as named pipes paths, will work on windows as well
-
-                # 0,1,2 are the wrong places since they were closed before the helper was attached
-
-                sys.stdin = os.fdopen(fds[0], "r")
-                sys.stdout = os.fdopen(fds[1], "w")
-                sys.stderr = os.fdopen(fds[2], "w")
-
-                # re-enable SIGCHLD so subprocess handling works
-                signal.signal(signal.SIGCHLD, signal.SIG_DFL)
-
-                try:
-                    calling_environment = json.loads(payload)
-                except (TypeError, ValueError, json.decoder.JSONDecodeError) as e:
-                    raise RuntimeError(
-                        "kart helper: Unable to read command from kart_cli_helper",
-                        e,
-                        f"Payload:\n{repr(payload)}",
-                    )
-                else:
-                    try:
-                        # Join the process group of the calling process - so that if they get killed, we get killed to.
-                        os.setpgid(0, calling_environment["pid"])
-                        os.environ["_KART_PGID_SET"] = "1"
-                    except OSError as e:
-                        # Kart will still work even if this fails: it just means SIGINT Ctrl+C might not work properly.
-                        # We'll just log it and hope for the best.
-                        _helper_log(f"error joining caller's process group: {e}")
-                        pass
-
-                    sys.argv[1:] = calling_environment["argv"][1:]
-                    _helper_log(f"cmd={' '.join(calling_environment['argv'])}")
-                    os.environ.clear()
-                    os.environ.update(
-                        {
-                            **calling_environment["environ"],
-                            **required_environment,
-                            "KART_HELPER_PID": str(os.getppid()),
-                            "KART_CALLER_PID": str(calling_environment["pid"]),
-                        }
-                    )
-
-                    # setup the semctl() function
-                    import ctypes
-                    import ctypes.util
-
-                    libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
-                    if is_darwin:
-                        SETVAL = 8
-
-                        #  union semun {
-                        #          int     val;            /* value for SETVAL */
-                        #          struct  semid_ds *buf;  /* buffer for IPC_STAT & IPC_SET */
-                        #          u_short *array;         /* array for GETALL & SETALL */
-                        #  };
-                        class C_SEMUN(ctypes.Union):
-                            _fields_ = (
-                                ("val", ctypes.c_int),
-                                ("semid_ds", ctypes.c_void_p),
-                                ("array", ctypes.POINTER(ctypes.c_ushort)),
-                            )
-
-                    elif is_linux:
-                        SETVAL = 16
-
-                        # union semun {
-                        #     int              val;    /* Value for SETVAL */
-                        #     struct semid_ds *buf;    /* Buffer for IPC_STAT, IPC_SET */
-                        #     unsigned short  *array;  /* Array for GETALL, SETALL */
-                        #     struct seminfo  *__buf;  /* Buffer for IPC_INFO
-                        # };
-                        class C_SEMUN(ctypes.Union):
-                            _fields_ = (
-                                ("val", ctypes.c_int),
-                                ("semid_ds", ctypes.c_void_p),
-                                ("array", ctypes.POINTER(ctypes.c_ushort)),
-                                ("seminfo", ctypes.c_void_p),
-                            )
-
-                    # arg (union semun) is a variadic arg. On macOS/arm64 the
-                    # calling convention differs between fixed & variadic args
-                    # so we _must_ treat it as variadic.
-                    libc.semctl.argtypes = (
-                        ctypes.c_int,
-                        ctypes.c_int,
-                        ctypes.c_int,
-                    )
-                    libc.semctl.restype = ctypes.c_int
-
-                    semid = calling_environment["semid"]
-                    SEMNUM = 0
-
-                    _helper_log(f"semid={semid}")
-                    try:
-                        _helper_log("invoking cli()...")
-                        # Don't let helper mode mess up the usage-text, or the shell complete environment variables.
-                        prog_name = (
-                            "kart"
-                            if os.path.basename(sys.argv[0]) == "kart_cli"
-                            else None
-                        )
-                        cli(prog_name=prog_name, complete_var="_KART_COMPLETE")
-                    except SystemExit as system_exit:
-                        """exit is called in the commands but we ignore as we need to clean up the caller"""
-                        # TODO - do we ever see negative exit codes from cli (git etc)?
-                        _helper_log(
-                            f"SystemExit from cli(): {system_exit.code} semval={1000+system_exit.code}"
-                        )
-                        if (
-                            libc.semctl(
-                                semid,
-                                SEMNUM,
-                                SETVAL,
-                                C_SEMUN(val=system_exit.code + 1000),
-                            )
-                            < 0
-                        ):
-                            raise RuntimeError(
-                                f"Error setting semid {semid}[{SEMNUM}]=1000+{system_exit.code}: "
-                                f"{errno.errorcode.get(ctypes.get_errno(), ctypes.get_errno())}"
-                            )
-                    except Exception:
-                        # TODO - should ext-run capture/handle this?
-                        _helper_log(
-                            f"unhandled exception from cli() semval=1001: {traceback.format_exc()}"
-                        )
-                        print("kart helper: unhandled exception", file=sys.stderr)
-                        traceback.print_exc(file=sys.stderr)
-                        if libc.semctl(semid, SEMNUM, SETVAL, C_SEMUN(val=1001)) < 0:
-                            raise RuntimeError(
-                                f"Error setting semid {semid}[{SEMNUM}]=1001: "
-                                f"{errno.errorcode.get(ctypes.get_errno(), ctypes.get_errno())}"
-                            )
-                    else:
-                        _helper_log("return from cli() without SystemExit semval=1000")
-                        if libc.semctl(semid, SEMNUM, SETVAL, C_SEMUN(val=1000)) < 0:
-                            raise RuntimeError(
-                                f"Error setting semid {semid}[{SEMNUM}]=1000: "
-                                f"{errno.errorcode.get(ctypes.get_errno(), ctypes.get_errno())}"
-                            )
-
-                    try:
-                        # send a signal to caller that we are done
-                        _helper_log(
-                            f"sending SIGALRM to pid {calling_environment['pid']}"
-                        )
-                        os.kill(calling_environment["pid"], signal.SIGALRM)
-                    except ProcessLookupError as e:
-                        _helper_log(f"error signalling caller: {e}")
-                        pass
-
-                _helper_log("bye(0)")
-                sys.exit()
-
         except socket.timeout:
-            _helper_log("socket timeout, bye (0)")
-            try:
-                os.unlink(socket_filename)
-            except FileNotFoundError:
-                """already unlinked???"""
+            continue
+        _helper_log("pre-fork messaged received")
+        forked_at = tracing.now()
+        if os.fork() != 0:
+            # parent
+            client.close()
+        else:
+            # child
+            _handle_client(client, required_environment, forked_at=forked_at)
+
+
+def _is_helper_listening(socket_filename):
+    probe = socket.socket(family=socket.AF_UNIX)
+    try:
+        probe.connect(str(socket_filename))
+        return True
+    except OSError:
+        return False
+    finally:
+        probe.close()
+
+
+def _unlink_socket(socket_filename):
+    try:
+        os.unlink(socket_filename)
+    except FileNotFoundError:
+        """already unlinked???"""
+
+
+class _WarmState:
+    """
+    Keeps up to max_repos of the repositories most recently used by commands open in the helper,
+    so that forked commands inherit them - see kart.helper_state.
+    """
+
+    def __init__(self, max_repos):
+        self.max_repos = max_repos
+        self.fds = []
+        if max_repos > 0:
+            report_r, report_w = os.pipe()
+            helper_state.start_reporting(report_w)
+            self.fds = [report_r]
+
+    def is_readable(self, readable):
+        return any(fd in readable for fd in self.fds)
+
+    def update(self):
+        """Opens any newly reported repositories. Returns True if anything changed."""
+        changed = False
+        for repo_path in helper_state.read_reported_repos(self.fds[0]):
+            if helper_state.warm_repo(repo_path, self.max_repos):
+                _helper_log(f"warm repo: {repo_path}")
+                changed = True
+        if changed:
+            # As above - keep the garbage collector from touching this in forked children.
+            gc.freeze()
+        return changed
+
+
+def _run_worker_pool(
+    sock, socket_filename, timeout, pool_size, warm_state, required_environment
+):
+    """
+    Keeps pool_size forked workers parked in accept() on the helper socket, so that a command doesn't have to
+    wait for a fork. Each worker runs a single command then exits - as soon as it accepts a connection it tells
+    us its PID over a pipe, and we fork a replacement. Never returns.
+
+    Idle workers are retired - when the helper shuts down, or when they should be replaced by workers that
+    inherit newly warmed state - by closing the write end of their "retire" pipe. A worker that has already
+    accepted a connection no longer watches that pipe, so retiring never interrupts a command.
+    """
+    busy_r, busy_w = os.pipe()
+    helper_pid = os.getpid()
+    idle_workers = set()
+    retire_r = retire_w = None
+
+    # Workers race to accept each connection - the losers get EAGAIN and go back to waiting.
+    sock.setblocking(False)
+
+    def _spawn_worker():
+        pid = os.fork()
+        if pid == 0:
+            os.close(busy_r)
+            os.close(retire_w)
+            for fd in warm_state.fds:
+                os.close(fd)
+            _pool_worker(sock, busy_w, retire_r, helper_pid, required_environment)
+        idle_workers.add(pid)
+
+    def _start_generation():
+        nonlocal retire_r, retire_w
+        _retire_generation()
+        retire_r, retire_w = os.pipe()
+        for i in range(pool_size):
+            _spawn_worker()
+        _helper_log(f"worker pool ready: {sorted(idle_workers)} (timeout={timeout})")
+
+    def _retire_generation():
+        if retire_w is not None:
+            os.close(retire_w)
+            os.close(retire_r)
+        idle_workers.clear()
+
+    _start_generation()
+
+    while True:
+        # The helper will exit if no command received within timeout
+        readable, _, _ = select.select([busy_r, *warm_state.fds], [], [], timeout)
+        if not readable:
+            _helper_log("pool timeout, bye (0)")
+            _unlink_socket(socket_filename)
+            _retire_generation()
             sys.exit()
+
+        if busy_r in readable:
+            # Each busy worker writes its PID atomically, so we only ever read whole PIDs.
+            data = os.read(busy_r, POOL_PID.size * 64)
+            for (pid,) in POOL_PID.iter_unpack(data):
+                _helper_log(f"worker {pid} busy")
+                idle_workers.discard(pid)
+
+        if warm_state.is_readable(readable) and warm_state.update():
+            # Replace all the idle workers with ones that inherit the newly warmed state.
+            _start_generation()
+            continue
+
+        # Replace any worker that has gone away - whether it's now busy, or it died while idle.
+        for pid in list(idle_workers):
+            try:
+                os.kill(pid, 0)
+            except ProcessLookupError:
+                idle_workers.discard(pid)
+        while len(idle_workers) < pool_size:
+            _spawn_worker()
+
+
+def _pool_worker(sock, busy_w, retire_r, helper_pid, required_environment):
+    while True:
+        readable, _, _ = select.select(
+            [sock, retire_r], [], [], POOL_WORKER_POLL_INTERVAL
+        )
+        if retire_r in readable or os.getppid() != helper_pid:
+            # retired, or the helper has gone away: don't keep the socket alive
+            os._exit(0)
+        if sock in readable:
+            try:
+                client, info = sock.accept()
+                break
+            except (BlockingIOError, socket.timeout):
+                # another worker got this connection
+                continue
+
+    os.write(busy_w, POOL_PID.pack(os.getpid()))
+    os.close(busy_w)
+    os.close(retire_r)
+    sock.close()
+
+    # on some platforms an accepted socket inherits O_NONBLOCK from the listening socket
+    client.setblocking(True)
+    _handle_client(client, required_environment)
+
+
+def _handle_client(client, required_environment, forked_at=None):
+    """
+    Runs a single command sent by kart_cli_helper on the given client socket, in this (forked) process.
+    forked_at is when the helper started forking this process, if it was forked for this command.
+    Never returns.
+    """
+    received_at = tracing.now()
+    _helper_log("post-fork")
+
+    try:
+        calling_environment, fds = recv_command_and_fds(client, maxfds=4)
+    except (TypeError, ValueError) as e:
+        raise RuntimeError(
+            "kart helper: Unable to read command from kart_cli_helper", e
+        )
+    if calling_environment is None and not fds:
+        # Closed without sending anything - eg another helper checking if this one is running.
+        _helper_log("connection closed without a command, bye(0)")
+        sys.exit()
+    if not calling_environment or len(fds) != 4:
+        click.echo("No payload or fds passed from kart_cli_helper: exit(-1)")
+        sys.exit(-1)
+
+    # as there is a new process the child could drop permissions here or use a security system to set up
+    # controls, chroot etc.
+
+    # change to the calling processes working directory
+    # TODO - pass as path for windows
+    os.fchdir(fds[3])
+    _helper_log(f"cwd={os.getcwd()}")
+
+    # set this processes stdin/stdout/stderr to the calling processes passed in fds
+    # TODO - have these passed as named pipes paths, will work on windows as well
+
+    # 0,1,2 are the wrong places since they were closed before the helper was attached
+
+    sys.stdin = os.fdopen(fds[0], "r")
+    sys.stdout = os.fdopen(fds[1], "w")
+    sys.stderr = os.fdopen(fds[2], "w")
+
+    # re-enable SIGCHLD so subprocess handling works
+    signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+
+    try:
+        # Join the process group of the calling process - so that if they get killed, we get killed to.
+        os.setpgid(0, calling_environment["pid"])
+        os.environ["_KART_PGID_SET"] = "1"
+    except OSError as e:
+        # Kart will still work even if this fails: it just means SIGINT Ctrl+C might not work properly.
+        # We'll just log it and hope for the best.
+        _helper_log(f"error joining caller's process group: {e}")
+        pass
+
+    sys.argv[1:] = calling_environment["argv"][1:]
+    _helper_log(f"cmd={' '.join(calling_environment['argv'])}")
+    os.environ.clear()
+    os.environ.update(
+        {
+            **calling_environment["environ"],
+            **required_environment,
+            "KART_HELPER_PID": str(os.getppid()),
+            "KART_CALLER_PID": str(calling_environment["pid"]),
+        }
+    )
+
+    # Only now that we have the caller's environment do we know whether - and where - to trace this command.
+    if forked_at is not None:
+        tracing.add_span("helper fork", forked_at, received_at, cat="helper")
+    command_started_at = tracing.now()
+    tracing.add_span(
+        "helper receive command", received_at, command_started_at, cat="helper"
+    )
+
+    try:
+        _helper_log("invoking cli()...")
+        # Don't let helper mode mess up the usage-text, or the shell complete environment variables.
+        prog_name = (
+            "kart"
+            if os.path.basename(sys.argv[0]) == "kart_cli"
+            else None
+        )
+        cli(prog_name=prog_name, complete_var="_KART_COMPLETE")
+    except SystemExit as system_exit:
+        """exit is called in the commands but we ignore as we need to clean up the caller"""
+        exit_code = _exit_code_from_system_exit(system_exit)
+        _helper_log(
+            f"SystemExit from cli(): {system_exit.code} exit_code={exit_code}"
+        )
+    except Exception:
+        # TODO - should ext-run capture/handle this?
+        _helper_log(
+            f"unhandled exception from cli() exit_code=1: {traceback.format_exc()}"
+        )
+        print("kart helper: unhandled exception", file=sys.stderr)
+        traceback.print_exc(file=sys.stderr)
+        exit_code = 1
+    else:
+        _helper_log("return from cli() without SystemExit exit_code=0")
+        exit_code = 0
+
+    # make sure all output has reached the caller before it exits
+    for stream in (sys.stdout, sys.stderr):
+        try:
+            stream.flush()
+        except OSError:
+            pass
+
+    tracing.add_span(
+        "helper command",
+        command_started_at,
+        cat="helper",
+        argv=calling_environment["argv"][1:],
+        exit_code=exit_code,
+    )
+
+    try:
+        # send the exit code back to the caller, which is polling the socket
+        _helper_log(f"sending exit frame to pid {calling_environment['pid']}")
+        send_exit_frame(client, exit_code)
+    except OSError as e:
+        _helper_log(f"error sending exit frame to caller: {e}")
+        pass
+
+    _helper_log("bye(0)")
+    sys.exit()
@@ -0,0 +1,167 @@
+"""
+Per-repository state that the long-lived helper process (see kart.helper) keeps warm between commands.
+
+Each command run by the helper reports which repository it opened. The helper then opens that repository
+itself and keeps the most recently used few open. Since every command runs in a process forked from the
+helper, later commands inherit the already-open repository instead of starting cold. An inherited
+repository is only used if HEAD, config and the index are unchanged since the helper opened it.
+
+Only state that is safe to share across a fork is kept warm - no database connections, and nothing that
+depends on the contents of the working copy.
+"""
+
+import os
+import select
+import struct
+from collections import OrderedDict
+from pathlib import Path
+
+# The environment variables that change which repository pygit2 opens - see GIT_REPOSITORY_OPEN_FROM_ENV.
+GIT_ENV_VARS = (
+    "GIT_ALTERNATE_OBJECT_DIRECTORIES",
+    "GIT_CEILING_DIRECTORIES",
+    "GIT_COMMON_DIR",
+    "GIT_DIR",
+    "GIT_INDEX_FILE",
+    "GIT_NAMESPACE",
+    "GIT_NO_REPLACE_OBJECTS",
+    "GIT_OBJECT_DIRECTORY",
+    "GIT_WORK_TREE",
+)
+
+# If any of these files in the gitdir change, a warm repository is discarded.
+STAMP_FILES = ("HEAD", "config", "index")
+
+# Repo paths are reported from commands to the helper in this format: a length, then the path.
+# Each report is a single write of no more than PIPE_BUF bytes, so reports can't be interleaved.
+_REPORT_LEN = struct.Struct("=I")
+_MAX_REPORT_LEN = select.PIPE_BUF
+
+# Resolved repo path -> _WarmRepo, least recently used first.
+_warm_repos = OrderedDict()
+
+# Set in the helper - commands write the repo paths they open to this pipe.
+_report_fd = None
+_reported_paths = set()
+_unread_reports = bytearray()
+
+
+def _repo_key(repo_path):
+    return str(Path(repo_path).resolve())
+
+
+def _git_env():
+    return {k: os.environ.get(k) for k in GIT_ENV_VARS}
+
+
+def _stamp(gitdir_path):
+    result = []
+    for filename in STAMP_FILES:
+        try:
+            s = os.stat(gitdir_path / filename)
+            result.append((s.st_mtime_ns, s.st_size, s.st_ino))
+        except FileNotFoundError:
+            result.append(None)
+    return tuple(result)
+
+
+class _WarmRepo:
+    def __init__(self, repo_path):
+        from .repo import KartRepo
+
+        self.git_env = _git_env()
+        self.repo = KartRepo(repo_path)
+        self.stamp = _stamp(self.repo.gitdir_path)
+
+        # Read everything that nearly every command reads, and that is safe to inherit.
+        repo = self.repo
+        repo.ensure_supported_version()
+        repo.table_dataset_version
+        repo.workingcopy_location
+        # This parses the spatial filter, which is cached by SpatialFilter.from_spec
+        repo.spatial_filter
+
+    def is_valid(self):
+        return self.git_env == _git_env() and self.stamp == _stamp(
+            self.repo.gitdir_path
+        )
+
+
+def get_warm_repo(repo_path):
+    """
+    Called by a command: returns the Kart repository at repo_path if it was inherited from the helper and is
+    still valid, otherwise returns None.
+    """
+    if not _warm_repos:
+        return None
+    # Each forked command only takes the inherited repository once.
+    entry = _warm_repos.pop(_repo_key(repo_path), None)
+    if entry is None or not entry.is_valid():
+        return None
+
+    from .working_copy import WorkingCopy
+
+    repo = entry.repo
+    repo.working_copy = WorkingCopy(repo)
+    return repo
+
+
+def report_repo_opened(repo_path):
+    """Called by a command: lets the helper know that this command opened the repository at repo_path."""
+    if _report_fd is None:
+        return
+    key = _repo_key(repo_path)
+    if key in _reported_paths:
+        return
+    _reported_paths.add(key)
+
+    path_bytes = os.fsencode(key)
+    if _REPORT_LEN.size + len(path_bytes) > _MAX_REPORT_LEN:
+        return
+    try:
+        os.write(_report_fd, _REPORT_LEN.pack(len(path_bytes)) + path_bytes)
+    except OSError:
+        pass
+
+
+def start_reporting(report_fd):
+    """Called by the helper: commands forked from now on will report the repo paths they open to report_fd."""
+    global _report_fd
+    _report_fd = report_fd
+
+
+def read_reported_repos(read_fd):
+    """Called by the helper: reads the repo paths that commands have reported since the last call."""
+    _unread_reports.extend(os.read(read_fd, _MAX_REPORT_LEN * 16))
+    result = []
+    while len(_unread_reports) >= _REPORT_LEN.size:
+        (length,) = _REPORT_LEN.unpack_from(_unread_reports)
+        if len(_unread_reports) < _REPORT_LEN.size + length:
+            break
+        path_bytes = _unread_reports[_REPORT_LEN.size : _REPORT_LEN.size + length]
+        del _unread_reports[: _REPORT_LEN.size + length]
+        result.append(os.fsdecode(bytes(path_bytes)))
+    return result
+
+
+def warm_repo(repo_path, max_repos):
+    """
+    Called by the helper: opens the repository at repo_path (or keeps the one already open, if it is still
+    valid) so that commands forked from now on inherit it, and evicts the least recently used repositories
+    so no more than max_repos are kept. Returns True if a repository was newly opened.
+    """
+    key = _repo_key(repo_path)
+    entry = _warm_repos.pop(key, None)
+    newly_opened = False
+    if entry is None or not entry.is_valid():
+        try:
+            entry = _WarmRepo(key)
+            newly_opened = True
+        except Exception:
+            # The command that reported this repo will have dealt with (or reported) whatever the problem is.
+            entry = None
+    if entry is not None:
+        _warm_repos[key] = entry
+    while len(_warm_repos) > max_repos:
+        _warm_repos.popitem(last=False)
+    return newly_opened
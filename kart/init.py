@@ -76,7 +76,15 @@ from .working_copy import PartType
 @click.option(
     "--num-workers",
     "--num-processes",
-    help="How many import workers to run in parallel. This is not currently supported for tabular import, so this option is ignored.",
+    type=click.INT,
+    help="How many worker processes to use for encoding features while importing tables.",
+    default=None,
+    hidden=True,
+)
+@click.option(
+    "--num-shards",
+    type=click.INT,
+    help="How many git-fast-import processes to split the imported features between, each writing its own pack.",
     default=None,
     hidden=True,
 )
@@ -97,6 +105,7 @@ def init(
     wc_location,
     max_delta_depth,
     num_workers,
+    num_shards,
     spatial_filter_spec,
 ):
     """
@@ -144,7 +153,11 @@ def init(
         fast_import_tables(
             repo,
             sources,
-            settings=FastImportSettings(max_delta_depth=max_delta_depth),
+            settings=FastImportSettings(
+                max_delta_depth=max_delta_depth,
+                num_workers=num_workers,
+                num_shards=num_shards,
+            ),
             from_commit=None,
             message=message,
         )
@@ -17,7 +17,11 @@ from .diff_estimation import (
 )
 from kart.diff_structs import FILES_KEY, BINARY_FILE, DatasetDiff
 from kart.log import commit_obj_to_json
-from kart.output_util import dump_json_output, resolve_output_path
+from kart.output_util import (
+    dump_json_list_output,
+    dump_json_output,
+    resolve_output_path,
+)
 from kart.tabular.feature_output import feature_as_geojson, feature_as_json
 from kart.timestamps import datetime_to_iso8601_utc, timedelta_to_iso8601_tz
 
@@ -228,8 +232,15 @@ class JsonLinesDiffWriter(BaseDiffWriter):
       {"type": "meta", "dataset": dataset-path, "key": "schema.json", "change": {"-/+": old/new-value}}
     Feature which has changed:
       {"type": "feature", "dataset": dataset-path, "change": {"-/+": old/new-value}}
+
+    Diffs can have millions of deltas, so each line is encoded in a single call to json.dumps (which uses the C
+    encoder, unlike json.dump) and the lines are written in large chunks - see OUTPUT_BUFFER_SIZE. Each delta's values
+    are discarded once it has been written, so that memory use doesn't grow with the size of the diff.
     """
 
+    # Lines are buffered until roughly this many characters are waiting to be written.
+    OUTPUT_BUFFER_SIZE = 1024 * 1024
+
     @classmethod
     def _check_output_path(cls, repo, output_path):
         if isinstance(output_path, Path) and output_path.is_dir():
@@ -244,11 +255,26 @@ class JsonLinesDiffWriter(BaseDiffWriter):
         self.separators = (",", ":") if self.json_style == "extracompact" else None
         self._diff_estimate_accuracy = diff_estimate_accuracy
         self._output_lock = threading.RLock()
+        self._buffer = []
+        self._buffer_size = 0
+
+    def dump(self, obj, flush=False):
+        line = json.dumps(obj, separators=self.separators)
+        with self._output_lock:
+            self._buffer.append(line)
+            self._buffer_size += len(line) + 1
+            if flush or self._buffer_size >= self.OUTPUT_BUFFER_SIZE:
+                self.flush()
 
-    def dump(self, obj):
+    def flush(self):
+        """Writes any lines that are still buffered."""
         with self._output_lock:
-            json.dump(obj, self.fp, separators=self.separators)
-            self.fp.write("\n")
+            if self._buffer:
+                self._buffer.append("")
+                self.fp.write("\n".join(self._buffer))
+                self._buffer = []
+                self._buffer_size = 0
+            self.fp.flush()
 
     def write_header(self):
         self.dump(
@@ -256,7 +282,8 @@ class JsonLinesDiffWriter(BaseDiffWriter):
                 "type": "version",
                 "version": "kart.diff/v2",
                 "outputFormat": "JSONL+hexwkb",
-            }
+            },
+            flush=True,
         )
         if self._diff_estimate_accuracy is not None:
             t = threading.Thread(
@@ -287,7 +314,8 @@ class JsonLinesDiffWriter(BaseDiffWriter):
                     "type": "featureCountEstimate",
                     "accuracy": self._diff_estimate_accuracy,
                     "datasets": est,
-                }
+                },
+                flush=True,
             )
 
     def write_ds_diff(self, ds_path, ds_diff, diff_format=DiffFormat.FULL):
@@ -363,6 +391,7 @@ class JsonLinesDiffWriter(BaseDiffWriter):
                 )
             obj["change"] = change
             self.dump(obj)
+            delta.discard_cached_values()
 
     def write_file_diff(self, file_diff):
         obj = {"type": "file", "path": None, "binary": False, "change": None}
@@ -382,6 +411,7 @@ class JsonLinesDiffWriter(BaseDiffWriter):
     def write_warnings_footer(self):
         # If there's an estimate thread running (see write_header()), ask it to terminate
         terminate_estimate_thread.set()
+        self.flush()
         super().write_warnings_footer()
 
 
@@ -440,18 +470,16 @@ class GeojsonDiffWriter(BaseDiffWriter):
             )
         for ds_path, ds_diff in repo_diff.items():
             self._warn_about_any_non_feature_diffs(ds_path, ds_diff)
-            output_obj = {
-                "type": "FeatureCollection",
-                "features": self.filtered_dataset_deltas_as_geojson(ds_path, ds_diff),
-            }
 
             if self.output_path == "-":
                 ds_output_path = "-"
             else:
                 ds_output_filename = str(ds_path).replace("/", "__") + ".geojson"
                 ds_output_path = self.output_path / ds_output_filename
-            dump_json_output(
-                output_obj,
+            dump_json_list_output(
+                {"type": "FeatureCollection"},
+                "features",
+                self.filtered_dataset_deltas_as_geojson(ds_path, ds_diff),
                 ds_output_path,
                 json_style=self.json_style,
             )
@@ -500,3 +528,4 @@ class GeojsonDiffWriter(BaseDiffWriter):
                     change_type,
                     new_transform,
                 )
+            delta.discard_cached_values()
@@ -18,7 +18,7 @@ from kart.lfs_util import (
 from kart.object_builder import ObjectBuilder
 from kart.rev_list_objects import rev_list_tile_pointer_files
 from kart.repo import KartRepoState
-from kart.s3_util import fetch_multiple_from_s3
+from kart.s3_util import fetch_multiple_from_s3, get_fetch_concurrency
 from kart.spatial_filter import SpatialFilter
 from kart.structs import CommitWithReference
 from kart import subprocess_util as subprocess
@@ -364,12 +364,12 @@ def fetch_lfs_blobs_for_pointer_files(
         return
 
     if urls:
-        _do_fetch_from_urls(repo, urls, quiet=quiet)
+        _do_fetch_from_urls(repo, urls, lfs_oid_sizes=urls_sizes, quiet=quiet)
     if non_urls and remote_name:
         _do_fetch_from_remote(repo, non_urls, remote_name, quiet=quiet)
 
 
-def _do_fetch_from_urls(repo, urls_and_lfs_oids, quiet=False):
+def _do_fetch_from_urls(repo, urls_and_lfs_oids, lfs_oid_sizes=None, quiet=False):
     non_s3_url = next(
         (url for (url, lfs_oid) in urls_and_lfs_oids if not url.startswith("s3://")),
         None,
@@ -379,13 +379,22 @@ def _do_fetch_from_urls(repo, urls_and_lfs_oids, quiet=False):
             f"Invalid URL - only S3 URLs are currently supported for linked-storage datasets: {non_s3_url}"
         )
 
+    lfs_oid_sizes = lfs_oid_sizes or {}
+    # Several pointer files can point to the same tile - it only needs to be fetched once.
+    urls_by_lfs_oid = {lfs_oid: url for (url, lfs_oid) in urls_and_lfs_oids}
     urls_and_paths_and_oids = [
-        (url, get_local_path_from_lfs_oid(repo, lfs_oid), lfs_oid)
-        for (url, lfs_oid) in urls_and_lfs_oids
+        (
+            url,
+            get_local_path_from_lfs_oid(repo, lfs_oid),
+            lfs_oid,
+            lfs_oid_sizes.get(lfs_oid),
+        )
+        for (lfs_oid, url) in urls_by_lfs_oid.items()
     ]
-    path_parents = {path.parent for url, path, lfs_oid in urls_and_paths_and_oids}
+    path_parents = {args[1].parent for args in urls_and_paths_and_oids}
     for path_parent in path_parents:
         path_parent.mkdir(parents=True, exist_ok=True)
+    # The tiles are downloaded straight into the LFS cache - they are reflinked from there into the workdir.
     fetch_multiple_from_s3(urls_and_paths_and_oids, quiet=quiet)
 
 
@@ -402,8 +411,14 @@ def _do_fetch_from_remote(repo, pointer_file_and_lfs_oids, remote_name, quiet=Fa
     try:
         # TODO - capture progress reporting and do our own.
         extra_kwargs = {"stdout": subprocess.DEVNULL} if quiet else {}
+        # Git-LFS uses lfs.concurrenttransfers - unless KART_FETCH_CONCURRENCY is set, Git-LFS's default is used.
+        if "KART_FETCH_CONCURRENCY" in os.environ:
+            concurrency = get_fetch_concurrency()
+            cmd = ["git", "-c", f"lfs.concurrenttransfers={concurrency}", "lfs"]
+        else:
+            cmd = ["git-lfs"]
         subprocess.check_call(
-            ["git-lfs", "fetch", remote_name, tree.hex],
+            [*cmd, "fetch", remote_name, tree.hex],
             cwd=repo.workdir_path,
             **extra_kwargs,
         )
@@ -2,6 +2,7 @@ import logging
 import sys
 
 import click
+import pygit2
 
 from . import commit
 from .cli_util import StringFromFile, call_and_exit_flag, KartCommand
@@ -18,6 +19,7 @@ from .merge_util import (
     merge_status_to_text,
     write_merged_index_flags,
 )
+from .object_builder import copy_and_modify_tree, merge_tree_changes
 from .output_util import dump_json_output
 from .pack_util import write_to_packfile
 from .repo import KartRepoFiles, KartRepoState
@@ -52,6 +54,36 @@ def get_commit_message(
     return message
 
 
+def _get_subtrees(repo, tree3, path):
+    """Returns the three versions of the subtree at the given path - the empty tree for any that are missing."""
+
+    def _get_subtree(tree):
+        try:
+            subtree = tree / path if path and tree is not None else tree
+        except KeyError:
+            subtree = None
+        return subtree if isinstance(subtree, pygit2.Tree) else repo.empty_tree
+
+    return tree3.map(_get_subtree, skip_nones=False)
+
+
+def _write_merged_tree(repo, ours, merge_changes, subtree_indexes):
+    """
+    Writes the merged tree, given the tree-level changes to ours and the libgit2 merge of each of the subtrees that
+    couldn't be merged one tree at a time - none of which may have conflicts. Returns the ID of the merged tree.
+    """
+    for path, index in subtree_indexes.items():
+        subtree_id = index.write_tree(repo, write_merged_index_flags(repo))
+        if not path:
+            return subtree_id
+        *parent_names, name = path.split("/")
+        changes = merge_changes
+        for parent_name in parent_names:
+            changes = changes.setdefault(parent_name, {})
+        changes[name] = repo[subtree_id]
+    return copy_and_modify_tree(repo, ours, merge_changes).id
+
+
 def do_merge(
     repo, ff, ff_only, dry_run, commit, message, launch_editor=True, quiet=False
 ):
@@ -116,10 +148,22 @@ def do_merge(
         return merge_jdict
 
     tree3 = commit_with_ref3.map(lambda c: c.tree)
-    index = repo.merge_trees(**tree3.as_dict(), flags={"find_renames": False})
+    # Most merges can be done one tree at a time, reusing every subtree that has only changed on one side - this
+    # is much quicker than building a merge index that has an entry for every feature. Only the subtrees where the
+    # same blob has changed on both sides are merged by libgit2, so that any conflicts in them can be found.
+    merge_changes, subtree_paths = merge_tree_changes(*tree3)
+    subtree_indexes = {
+        path: repo.merge_trees(
+            **_get_subtrees(repo, tree3, path).as_dict(),
+            flags={"find_renames": False},
+        )
+        for path in subtree_paths
+    }
 
-    if index.conflicts:
-        merged_index = MergedIndex.from_pygit2_index(index)
+    if any(index.conflicts for index in subtree_indexes.values()):
+        merged_index = MergedIndex.from_subtree_indexes(
+            copy_and_modify_tree(repo, tree3.ours, merge_changes), subtree_indexes
+        )
         conflicts_writer_class = BaseConflictsWriter.get_conflicts_writer_class("json")
         conflicts_writer = conflicts_writer_class(
             repo, summarise=2, merged_index=merged_index, merge_context=merge_context
@@ -142,7 +186,9 @@ def do_merge(
     check_git_user(repo)
 
     with write_to_packfile(repo):
-        merge_tree_id = index.write_tree(repo, write_merged_index_flags(repo))
+        merge_tree_id = _write_merged_tree(
+            repo, tree3.ours, merge_changes, subtree_indexes
+        )
         L.debug(f"Merge tree: {merge_tree_id}")
 
         user = repo.default_signature
@@ -122,6 +122,44 @@ class MergedIndex:
         resolves = {}
         return MergedIndex(entries, conflicts, resolves)
 
+    @classmethod
+    def from_subtree_indexes(cls, merged_tree, subtree_indexes):
+        """
+        Like from_pygit2_index, but for a merge where only some subtrees were merged by libgit2 - subtree_indexes
+        is {subtree_path: pygit2.Index}. The entries from outside those subtrees are read from merged_tree - whatever
+        merged_tree contains at those subtree paths is ignored.
+        """
+
+        def _prefixed_entry(prefix, entry):
+            if entry is None or not prefix:
+                return cls._ensure_entry(entry)
+            return cls.Entry(f"{prefix}/{entry.path}", entry.id, entry.mode)
+
+        def _in_subtree(path):
+            if "" in subtree_indexes:
+                return True
+            parts = path.split("/")
+            return any(
+                "/".join(parts[:i]) in subtree_indexes for i in range(1, len(parts))
+            )
+
+        index = pygit2.Index()
+        index.read_tree(merged_tree)
+        entries = {
+            e.path: cls._ensure_entry(e) for e in index if not _in_subtree(e.path)
+        }
+        conflicts = {}
+        for prefix, subtree_index in subtree_indexes.items():
+            for e in subtree_index:
+                entry = _prefixed_entry(prefix, e)
+                entries[entry.path] = entry
+            for c in subtree_index.conflicts:
+                conflicts[str(len(conflicts))] = AncestorOursTheirs(
+                    *(_prefixed_entry(prefix, e) for e in c)
+                )
+        resolves = {}
+        return MergedIndex(entries, conflicts, resolves)
+
     def __eq__(self, other):
         if not isinstance(other, MergedIndex):
             return False
@@ -0,0 +1,17 @@
+"""
+Access to _kart_native, the optional compiled module built from native/ by the CMake project.
+
+Every function in _kart_native has a pure-Python reference implementation alongside the code that calls it,
+which is used if the compiled module isn't available (eg, when kart is pip-installed without the CMake build)
+or if KART_USE_NATIVE=0 is set. The two must always give identical results.
+"""
+
+import os
+
+lib = None
+
+if os.environ.get("KART_USE_NATIVE", "1") != "0":
+    try:
+        import _kart_native as lib
+    except ImportError:
+        pass
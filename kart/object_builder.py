@@ -149,6 +149,128 @@ def copy_and_modify_tree(repo, tree, changes):
     return tree
 
 
+def merge_trees(repo, tree, other_tree):
+    """
+    Returns a tree containing the contents of both of the given trees. Where both contain a subtree with the same name,
+    these are merged recursively - otherwise, entries from other_tree replace those with the same name in tree.
+    Only the subtrees found in both trees are visited, so this is quick when the trees are mostly disjoint.
+    Conflicts are not detected.
+    """
+    tree_builder = repo.TreeBuilder(tree)
+    for entry in other_tree:
+        name = entry.name
+        if isinstance(entry, pygit2.Tree):
+            try:
+                subtree = tree / name
+            except KeyError:
+                subtree = None
+            if isinstance(subtree, pygit2.Tree) and subtree.oid != entry.oid:
+                entry = merge_trees(repo, subtree, entry)
+            tree_builder.insert(name, entry.oid, pygit2.GIT_FILEMODE_TREE)
+        else:
+            tree_builder.insert(name, entry.oid, pygit2.GIT_FILEMODE_BLOB)
+
+    tree_oid = tree_builder.write()
+    return repo[tree_oid]
+
+
+def merge_tree_changes(ancestor, ours, theirs):
+    """
+    Does a three-way merge of the given trees one tree at a time, without reading any blobs. Wherever two of the
+    three versions of an entry are the same, the merged entry is the remaining version - so a subtree that has only
+    changed on one side is reused as is, and only the subtrees that have changed on both sides are visited.
+    Returns (changes, subtree_paths) - the changes that need to be made to ours to get the merged tree, in the nested
+    dict format accepted by copy_and_modify_tree, and the paths of the subtrees that couldn't be merged this way
+    since they contain a blob that has changed on both sides, or a tree and a blob that conflict. Those subtrees
+    need to be merged by libgit2, which can also resolve changes to the contents of text blobs - changes doesn't
+    contain anything for them. The path of the root tree is the empty string.
+    """
+    subtree_paths = []
+    changes, num_entries = _merge_tree_changes(
+        ancestor, ours, theirs, "", subtree_paths
+    )
+    return changes or {}, subtree_paths
+
+
+def _tree_entries(tree):
+    return {entry.name: entry for entry in tree} if tree is not None else {}
+
+
+def _same_entry(entry, other_entry):
+    if entry is None or other_entry is None:
+        return entry is other_entry
+    return entry.oid == other_entry.oid and entry.filemode == other_entry.filemode
+
+
+def _is_tree_or_none(entry):
+    return entry is None or isinstance(entry, pygit2.Tree)
+
+
+def _merge_tree_changes(ancestor, ours, theirs, path, subtree_paths):
+    """
+    Returns (changes, num_entries) where num_entries is the number of entries in the merged tree. If this tree can't
+    be merged without libgit2, its path is appended to subtree_paths instead and changes is None.
+    """
+    ancestor_entries = _tree_entries(ancestor)
+    our_entries = _tree_entries(ours)
+    their_entries = _tree_entries(theirs)
+
+    changes = {}
+    num_entries = len(our_entries)
+    # Entries only found in the ancestor have been deleted on both sides - nothing to do.
+    for name in our_entries.keys() | their_entries.keys():
+        ancestor_entry = ancestor_entries.get(name)
+        our_entry = our_entries.get(name)
+        their_entry = their_entries.get(name)
+
+        if _same_entry(our_entry, their_entry) or _same_entry(
+            ancestor_entry, their_entry
+        ):
+            continue
+
+        if _same_entry(ancestor_entry, our_entry):
+            if their_entry is not None and their_entry.filemode not in (
+                pygit2.GIT_FILEMODE_BLOB,
+                pygit2.GIT_FILEMODE_TREE,
+            ):
+                # copy_and_modify_tree can't preserve other filemodes - leave this tree to libgit2.
+                break
+            changes[name] = their_entry
+            num_entries += (their_entry is not None) - (our_entry is not None)
+            continue
+
+        if _is_tree_or_none(our_entry) and _is_tree_or_none(their_entry):
+            # The tree has changed on both sides (or been deleted on one side) - merge its entries.
+            if not isinstance(ancestor_entry, pygit2.Tree):
+                ancestor_entry = None
+            sub_path = f"{path}/{name}" if path else name
+            sub_changes, sub_num_entries = _merge_tree_changes(
+                ancestor_entry, our_entry, their_entry, sub_path, subtree_paths
+            )
+            if sub_changes is None:
+                # Left for libgit2 to merge - it is never empty, since it contains a conflicting blob.
+                num_entries += our_entry is None
+            elif sub_num_entries == 0:
+                # Git doesn't store empty trees.
+                changes[name] = None
+                num_entries -= our_entry is not None
+            else:
+                changes[name] = sub_changes
+                num_entries += our_entry is None
+            continue
+
+        break
+    else:
+        return changes, num_entries
+
+    # Any subtrees of this tree that were already added are part of this tree now.
+    subtree_paths[:] = [
+        p for p in subtree_paths if not (path == "" or p.startswith(f"{path}/"))
+    ]
+    subtree_paths.append(path)
+    return None, 1
+
+
 def _empty_tree(repo):
     """Returns the empty tree object for this repo."""
     return repo.get(repo.TreeBuilder().write())
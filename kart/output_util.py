@@ -208,6 +208,80 @@ def dump_json_output(
     fp.write("\n")
 
 
+# Streamed JSON output is written in chunks of roughly this many characters.
+OUTPUT_BUFFER_SIZE = 1024 * 1024
+
+
+def dump_json_list_output(
+    output,
+    list_key,
+    items,
+    output_path,
+    json_style="pretty",
+    encoder_class=ExtendedJsonEncoder,
+):
+    """
+    Dumps the output to JSON in the output file, with the given items (which can be a generator) as a list at
+    output[list_key] - so, the same as dump_json_output({**output, list_key: list(items)}), but without needing to
+    have all the items in memory at once. Each item is encoded separately and they are written in large chunks,
+    which is much faster than iterencode for very long lists - but the output is exactly the same.
+    """
+    fp = resolve_output_path(output_path)
+    if can_output_colour(fp):
+        # Output to a terminal - the syntax highlighting is much slower than the JSON encoding anyway.
+        dump_json_output(
+            {**output, list_key: items},
+            output_path,
+            json_style=json_style,
+            encoder_class=encoder_class,
+        )
+        return
+
+    output = _maybe_legacy_style_output({**output, list_key: []})
+    json_params = JSON_PARAMS[json_style]
+    json_encoder = encoder_class(**json_params)
+    # The list is encoded as [] so that we can find where to put the items in the output.
+    head, sep, tail = json_encoder.encode(output).rpartition("[]")
+    head += "["
+    tail = "]" + tail
+
+    indent = json_params.get("indent")
+    if indent is not None:
+        # The items are nested two levels deep - inside the top-level object, inside the list.
+        item_newline = "\n" + " " * (indent * 2)
+        first_item_prefix = item_newline
+        item_separator = "," + item_newline
+        list_end = "\n" + " " * indent
+    else:
+        item_newline = None
+        first_item_prefix = ""
+        item_separator = json_params.get("separators", (", ", ": "))[0]
+        list_end = ""
+
+    buffer = [head]
+    buffer_size = 0
+    prefix = first_item_prefix
+    for item in items:
+        encoded = json_encoder.encode(item)
+        if item_newline is not None:
+            # JSON strings can't contain newlines, so every newline is part of the indentation.
+            encoded = encoded.replace("\n", item_newline)
+        buffer.append(prefix)
+        buffer.append(encoded)
+        prefix = item_separator
+        buffer_size += len(encoded)
+        if buffer_size >= OUTPUT_BUFFER_SIZE:
+            fp.write("".join(buffer))
+            buffer = []
+            buffer_size = 0
+
+    if prefix is item_separator:
+        buffer.append(list_end)
+    buffer.append(tail)
+    buffer.append("\n")
+    fp.write("".join(buffer))
+
+
 def _maybe_legacy_style_output(output):
     # If the caller ran "sno status", return output starting with "sno.status/v1"
     # But if they run "kart status", return the unchanged output ie "kart.status/v1".
@@ -231,6 +231,18 @@ class PointCloudImporter(TileImporter):
             return convert_tile_to_copc
         return None
 
+    # When converting to COPC, the COPC writer has all of the points in memory at once, plus a copy of them while it
+    # builds the octree. PDAL stores X, Y and Z as doubles, so each point in memory is 12 bytes larger than on disk.
+    COPC_CONVERSION_MEMORY_FACTOR = 3
+
+    def estimate_copy_or_convert_memory(self, tile_source):
+        if self.get_conversion_func(tile_source) is None:
+            return 0
+        point_count = tile_source.metadata["tile"].get("pointCount", 0)
+        point_length = tile_source.metadata["format.json"]["pointDataRecordLength"]
+        memory_per_point = (point_length + 12) * self.COPC_CONVERSION_MEMORY_FACTOR
+        return point_count * memory_per_point
+
     def existing_tile_matches_source(self, source_oid, existing_summary):
         """Check if the existing tile can be reused instead of reimporting."""
         source_oid = prefix_sha256(source_oid)
@@ -421,6 +421,12 @@ class KartRepo(pygit2.Repository):
 
         return DiffAnnotations(self)
 
+    @cached_property
+    def diff_cache(self):
+        from .diff_cache import RawDiffCache
+
+        return RawDiffCache(self)
+
     def write_config(
         self,
         wc_location=None,
@@ -7,6 +7,8 @@ import pygit2
 
 from kart.core import all_trees_with_paths_in_tree
 from kart.exceptions import SubprocessError
+from kart.tabular.v3_paths import nonrecursive_diff
+from kart import native
 from kart import subprocess_util as subprocess
 
 
@@ -131,22 +133,218 @@ def rev_list_matching_blobs(repo, start_commits, stop_commits, pathspecs, path_p
 FEATURE_BLOBS_PATTERN = re.compile(r"(.+)/\.(?:sno|table)-dataset[^/]*/feature/.+")
 
 
-def rev_list_feature_blobs(repo, start_commits, stop_commits):
+def rev_list_feature_blobs(repo, start_commits, stop_commits, incremental=False):
     """
     Yield all the blobs with a path identifying them as features (or rows) of a "table-dataset".
     Yields tuples in the form: (commit_id, match_result, blob).
     To get the entire path, use match_result.group(0) - this can be decoded if necessary.
     To get the dataset-path, use match_result.group(1)
+    If incremental is True, only yields the blobs that each commit adds or changes - see walk_changed_dataset_blobs.
     """
-    pathspecs = get_dataset_pathspecs(
+    walk_fn = walk_changed_dataset_blobs if incremental else walk_dataset_blobs
+    return walk_fn(
         repo,
         start_commits,
         stop_commits,
         dirname_filter=lambda d: d.startswith(".table-dataset") or d == ".sno-dataset",
+        subtree_name="feature",
     )
-    return rev_list_matching_blobs(
-        repo, start_commits, stop_commits, pathspecs, FEATURE_BLOBS_PATTERN
-    )
+
+
+def new_oid_set():
+    """
+    Returns an empty set for storing oids as 20 bytes (ie, Oid.raw) - uses the compact _kart_native.OidSet
+    if it is available, otherwise just a set.
+    """
+    return native.lib.OidSet() if native.lib is not None else set()
+
+
+class DatasetBlobPath:
+    """
+    The path of a blob found by walk_dataset_blobs. Has the same interface as the match result of
+    FEATURE_BLOBS_PATTERN / TILE_POINTER_FILES_PATTERN, but the entire path is only built if needed.
+    """
+
+    __slots__ = ("ds_path", "rel_path")
+
+    def __init__(self, ds_path, rel_path):
+        self.ds_path = ds_path
+        self.rel_path = rel_path
+
+    def group(self, index=0):
+        if index == 0:
+            return f"{self.ds_path}/{self.rel_path}"
+        elif index == 1:
+            return self.ds_path
+        raise IndexError("no such group")
+
+
+def walk_dataset_blobs(
+    repo, start_commits, stop_commits, dirname_filter, subtree_name
+):
+    """
+    Does the same as rev_list_matching_blobs, but looks only at blobs inside the given subtree of each
+    dataset - eg "feature" - and walks the commits and trees in-process rather than using git rev-list.
+    Yields tuples in the form: (commit_id, path, blob) - path is a DatasetBlobPath.
+    dirname_filter should match whichever dataset-dirnames are relevant, eg ".table-dataset".
+
+    Like git rev-list --objects, each commit is visited newest first, each tree and blob will only be visited
+    once, and nothing is visited that is reachable from the stop commits. Objects that are missing from the
+    repo (eg, due to a partial clone) are skipped.
+    """
+    seen = new_oid_set()
+
+    def _walk_tree(tree, path, yield_blobs):
+        # Yields (ds_path, rel_path, blob) for each unseen blob in a dataset subtree, in this tree.
+        for entry in _tree_entries(tree):
+            if entry.type != pygit2.GIT_OBJ_TREE:
+                continue
+            oid = entry.id.raw
+            if oid in seen:
+                continue
+            seen.add(oid)
+            if entry.name.startswith("."):
+                if dirname_filter(entry.name):
+                    subtree = _child_tree(entry, subtree_name)
+                    if subtree is not None:
+                        yield from _walk_dataset_subtree(
+                            subtree,
+                            path,
+                            f"{entry.name}/{subtree_name}",
+                            yield_blobs,
+                        )
+                continue
+            entry_path = f"{path}/{entry.name}" if path else entry.name
+            yield from _walk_tree(entry, entry_path, yield_blobs)
+
+    def _walk_dataset_subtree(tree, ds_path, rel_path, yield_blobs):
+        oid = tree.id.raw
+        if oid in seen:
+            return
+        seen.add(oid)
+        for entry in _tree_entries(tree):
+            oid = entry.id.raw
+            if oid in seen:
+                continue
+            if entry.type == pygit2.GIT_OBJ_TREE:
+                yield from _walk_dataset_subtree(
+                    entry, ds_path, f"{rel_path}/{entry.name}", yield_blobs
+                )
+            elif entry.type == pygit2.GIT_OBJ_BLOB:
+                seen.add(oid)
+                if yield_blobs:
+                    yield ds_path, f"{rel_path}/{entry.name}", entry
+
+    # Everything reachable from the stop commits has already been taken care of.
+    for commit_id in stop_commits:
+        for _ in _walk_tree(repo[commit_id].peel(pygit2.Tree), "", False):
+            pass
+
+    for commit in _walk_commits(repo, start_commits, stop_commits):
+        commit_id = commit.id.hex
+        for ds_path, rel_path, blob in _walk_tree(commit.tree, "", True):
+            yield commit_id, DatasetBlobPath(ds_path, rel_path), blob
+
+
+def walk_changed_dataset_blobs(
+    repo, start_commits, stop_commits, dirname_filter, subtree_name
+):
+    """
+    Like walk_dataset_blobs, but rather than visiting every blob reachable from the start commits, only visits the
+    blobs that each commit adds or changes compared to its parent(s). These are found by diffing each commit's trees
+    against those of its parents, without descending into any trees which are unchanged.
+
+    Every parent of a visited commit is either also visited, or is reachable from the stop commits - so if the blobs
+    reachable from the stop commits have already been taken care of, this visits every blob that hasn't, in time
+    proportional to the number of changes rather than to the size of the repo. A blob can be visited more than once,
+    eg if a feature is changed back to a previous version.
+    """
+    for commit in _walk_commits(repo, start_commits, stop_commits):
+        commit_id = commit.id.hex
+        # For a merge commit, only blobs that differ from every parent are new.
+        changed = None
+        for parent_tree in [p.tree for p in commit.parents] or [None]:
+            changes = dict(
+                _diff_dataset_blobs(
+                    commit.tree, parent_tree, dirname_filter, subtree_name
+                )
+            )
+            if changed is None:
+                changed = changes
+            else:
+                changed = {k: v for k, v in changed.items() if k in changes}
+            if not changed:
+                break
+
+        for (ds_path, rel_path), blob in changed.items():
+            yield commit_id, DatasetBlobPath(ds_path, rel_path), blob
+
+
+def _walk_commits(repo, start_commits, stop_commits):
+    # Newest first, like git rev-list.
+    if not start_commits:
+        return
+    walker = repo.walk(None, pygit2.GIT_SORT_TIME)
+    for commit_id in start_commits:
+        walker.push(repo[commit_id].peel(pygit2.Commit).id)
+    for commit_id in stop_commits:
+        walker.hide(repo[commit_id].peel(pygit2.Commit).id)
+    yield from walker
+
+
+def _diff_dataset_blobs(new_tree, old_tree, dirname_filter, subtree_name, path=""):
+    # Yields ((ds_path, rel_path), blob) for each blob in a dataset subtree of new_tree that differs from the blob at
+    # the same path in old_tree.
+    for name, (old, new) in nonrecursive_diff(old_tree, new_tree).items():
+        if new is None or new.type != pygit2.GIT_OBJ_TREE:
+            continue
+        if old is not None and old.type != pygit2.GIT_OBJ_TREE:
+            old = None
+        if name.startswith("."):
+            if dirname_filter(name):
+                new_subtree = _child_tree(new, subtree_name)
+                old_subtree = (
+                    _child_tree(old, subtree_name) if old is not None else None
+                )
+                if new_subtree is not None:
+                    yield from _diff_subtree_blobs(
+                        new_subtree, old_subtree, path, f"{name}/{subtree_name}"
+                    )
+            continue
+        entry_path = f"{path}/{name}" if path else name
+        yield from _diff_dataset_blobs(
+            new, old, dirname_filter, subtree_name, entry_path
+        )
+
+
+def _diff_subtree_blobs(new_tree, old_tree, ds_path, rel_path):
+    if old_tree is not None and old_tree.id == new_tree.id:
+        return
+    for name, (old, new) in nonrecursive_diff(old_tree, new_tree).items():
+        if new is None:
+            continue
+        if new.type == pygit2.GIT_OBJ_TREE:
+            if old is not None and old.type != pygit2.GIT_OBJ_TREE:
+                old = None
+            yield from _diff_subtree_blobs(new, old, ds_path, f"{rel_path}/{name}")
+        elif new.type == pygit2.GIT_OBJ_BLOB:
+            yield (ds_path, f"{rel_path}/{name}"), new
+
+
+def _tree_entries(tree):
+    try:
+        return list(tree)
+    except KeyError:
+        # This tree is missing, eg due to a partial clone.
+        return []
+
+
+def _child_tree(tree, name):
+    try:
+        child = tree / name
+    except KeyError:
+        return None
+    return child if child.type == pygit2.GIT_OBJ_TREE else None
 
 
 TILE_POINTER_FILES_PATTERN = re.compile(
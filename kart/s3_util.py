@@ -5,10 +5,14 @@ import functools
 import os
 from pathlib import Path
 import tempfile
+import threading
 from threading import current_thread
+import time
 from urllib.parse import urlparse
+import uuid
 
 import boto3
+from boto3.s3.transfer import TransferConfig
 import click
 
 from kart.exceptions import NotFound, NO_IMPORT_SOURCE, NO_CHECKSUM
@@ -119,12 +123,26 @@ def parse_s3_url(s3_url):
     return bucket, key
 
 
-def fetch_from_s3(s3_url, output_path=None, sha256_hash=None):
+# Objects larger than this are downloaded as several ranged GETs of this size, some of which are run concurrently.
+_MULTIPART_CHUNK_SIZE = 16 * 1024 * 1024
+_MULTIPART_CONCURRENCY = 4
+
+_TRANSFER_CONFIG = TransferConfig(
+    multipart_threshold=_MULTIPART_CHUNK_SIZE,
+    multipart_chunksize=_MULTIPART_CHUNK_SIZE,
+    max_concurrency=_MULTIPART_CONCURRENCY,
+)
+
+
+def fetch_from_s3(s3_url, output_path=None, sha256_hash=None, callback=None):
     """
     Downloads the object at s3_url to output_path.
     If output-path is not set, creates a temporary file using tempfile.mkstemp()
     If sha_256 hash is set, verifies that the downloaded file has the expected hash -
         if it does not, deletes the downloaded file and raises a ValueError.
+        The file is only moved to output_path once it has been verified, so that a file with the wrong contents is
+        never found at output_path - for instance, when output_path is in the LFS cache.
+    If callback is set, it is called from time to time with the number of bytes downloaded since it was last called.
     """
     bucket, key = parse_s3_url(s3_url)
     if output_path is None:
@@ -132,48 +150,121 @@ def fetch_from_s3(s3_url, output_path=None, sha256_hash=None):
         # If we keep it open, boto3 won't be able to write to it (on Windows):
         os.close(fd)
     output_path = Path(output_path).resolve()
-    get_s3_bucket(bucket).download_file(key, str(output_path))
+    download_path = output_path
+    if sha256_hash:
+        download_path = output_path.with_name(f"{output_path.name}.{uuid.uuid4()}")
+
+    get_s3_bucket(bucket).download_file(
+        key, str(download_path), Callback=callback, Config=_TRANSFER_CONFIG
+    )
 
     if sha256_hash:
-        actual_hash, size = get_oid_and_size_of_file(output_path)
+        actual_hash, size = get_oid_and_size_of_file(download_path)
         if actual_hash != sha256_hash:
-            output_path.unlink()
+            download_path.unlink()
             raise ValueError(
                 f"Checksum verification failed on file downloaded from {s3_url}"
             )
+        os.replace(download_path, output_path)
 
     return output_path
 
 
 # Fetching from S3 and writing to disk is I/O bound, so, we don't have a theoretical way of deciding how many threads to
 # use (if it was compute bound, then $NUM_CORES threads would be a good place to start).
-# But, in practise, 8 threads seems to be fast.
+# But, in practise, 8 threads seems to be fast. This can be overridden using KART_FETCH_CONCURRENCY - when fetching a lot
+# of small objects, the time taken is mostly spent waiting for each request to start, and more threads can help.
 _FETCH_MULTIPLE_FROM_S3_WORKER_COUNT = 8
 
 
+def get_fetch_concurrency():
+    """Returns the number of objects that should be fetched concurrently - from S3, or by Git-LFS."""
+    try:
+        result = int(os.environ.get("KART_FETCH_CONCURRENCY", ""))
+    except ValueError:
+        return _FETCH_MULTIPLE_FROM_S3_WORKER_COUNT
+    return max(1, result)
+
+
 def fetch_multiple_from_s3(s3_urls_and_paths, quiet=False):
     """
-    Given a list of tuples [(s3_url, pathlib_Path, sha256_hash), ...] downloads each URL to the given output path,
-    and verifies that the downloaded file has the appropriate hash, using _FETCH_MULTIPLE_FROM_S3_WORKER_COUNT worker threads.
-    The sha_256 is optional, it can be set to None or ommitted from the tuple entirely.
+    Given a list of tuples [(s3_url, pathlib_Path, sha256_hash, size), ...] downloads each URL to the given output path,
+    and verifies that the downloaded file has the appropriate hash, using get_fetch_concurrency() worker threads.
+    The sha_256 and the size are optional, they can be set to None or ommitted from the tuple entirely. If the sizes
+    are known, the largest objects are fetched first (so that the last few threads aren't left fetching large objects
+    once the rest are done), and the progress bar shows bytes fetched and throughput, rather than objects fetched.
 
     Displays a progress bar unless disabled using quiet=True.
     """
+    s3_urls_and_paths = [(*args, None, None)[:4] for args in s3_urls_and_paths]
+    sizes = [size for (s3_url, path, sha256_hash, size) in s3_urls_and_paths]
+    all_sizes_known = all(size is not None for size in sizes)
+    if all_sizes_known:
+        s3_urls_and_paths.sort(key=lambda args: args[3], reverse=True)
+
     disable = True if quiet else None
+    if all_sizes_known:
+        progress_kwargs = {
+            "total": sum(sizes),
+            "unit": "B",
+            "unit_scale": True,
+            "unit_divisor": 1024,
+        }
+    else:
+        progress_kwargs = {"total": len(s3_urls_and_paths), "unit": "object"}
     progress = progress_bar(
-        total=len(s3_urls_and_paths),
-        unit="object",
-        desc="Fetching S3 objects",
-        disable=disable,
+        desc="Fetching S3 objects", disable=disable, **progress_kwargs
     )
 
+    start_time = time.monotonic()
+    progress_lock = threading.Lock()
+
     with progress as p, concurrent.futures.ThreadPoolExecutor(
-        max_workers=_FETCH_MULTIPLE_FROM_S3_WORKER_COUNT
+        max_workers=get_fetch_concurrency()
     ) as executor:
-        futures = [executor.submit(fetch_from_s3, *args) for args in s3_urls_and_paths]
-        for future in concurrent.futures.as_completed(futures):
-            future.result()  # Raises any exception that occurred in the worker thread.
-            p.update(1)
+
+        def progress_callback(size):
+            if not all_sizes_known:
+                return None
+            fetched = 0
+
+            def update_progress(num_bytes):
+                # Called from the boto3 transfer threads. When boto3 retries a part, the bytes it already reported
+                # are reported again (or are taken back, with a negative count) - so the bytes counted for each
+                # object are kept between zero and its size.
+                nonlocal fetched
+                with progress_lock:
+                    new_fetched = max(0, min(size, fetched + num_bytes))
+                    p.update(new_fetched - fetched)
+                    fetched = new_fetched
+
+            return update_progress
+
+        futures = [
+            executor.submit(
+                fetch_from_s3, s3_url, path, sha256_hash, progress_callback(size)
+            )
+            for (s3_url, path, sha256_hash, size) in s3_urls_and_paths
+        ]
+        try:
+            for future in concurrent.futures.as_completed(futures):
+                future.result()  # Raises any exception that occurred in the worker thread.
+                if not all_sizes_known:
+                    p.update(1)
+        except BaseException:
+            for future in futures:
+                future.cancel()
+            raise
+
+    if all_sizes_known:
+        elapsed = time.monotonic() - start_time
+        L.info(
+            "Fetched %d S3 objects (%d bytes) in %.1fs (%.0f bytes/s)",
+            len(s3_urls_and_paths),
+            sum(sizes),
+            elapsed,
+            sum(sizes) / elapsed if elapsed else 0,
+        )
 
 
 def expand_s3_glob(source_spec):
@@ -1,9 +1,30 @@
 import array
+import json
+import os
 import socket
+import struct
 
 # Setting the message length higher than this has no effect - the message gets chunked by TCP anyway.
 MAX_CHUNK_LEN = 8164
 
+# Frames sent between the kart_cli_helper launcher (cli_helper/kart.c) and the helper over the
+# AF_UNIX socket the command is sent on. Each frame is a fixed header - type & payload length, both
+# uint32 in network byte order - followed by the payload. Keep these in sync with kart.c.
+FRAME_HEADER = struct.Struct("!II")
+# Payload is the command exit code as an int32 in network byte order.
+FRAME_TYPE_EXIT = 1
+EXIT_FRAME_PAYLOAD = struct.Struct("!i")
+
+# The command sent from kart_cli_helper to the helper, as an alternative to JSON. Payload is the caller's PID,
+# the number of argv entries and the number of environment entries, then each argv entry and each
+# "KEY=VALUE" environment entry - each as a length followed by that many bytes. All uint32s in network byte order.
+FRAME_TYPE_COMMAND = 2
+COMMAND_FRAME_HEADER = struct.Struct("!III")
+COMMAND_ENTRY_LEN = struct.Struct("!I")
+# Big enough to receive the command - environment and all - of nearly every invocation with a single recvmsg.
+COMMAND_BUFFER_LEN = 256 * 1024
+
+
 # Function modified from https://docs.python.org/3/library/socket.html#socket.socket.recvmsg
 def recv_json_and_fds(sock, maxfds=0):
     chunks = []
@@ -13,16 +34,121 @@ def recv_json_and_fds(sock, maxfds=0):
             MAX_CHUNK_LEN, socket.CMSG_LEN(maxfds * fds.itemsize)
         )
         chunks.append(chunk)
-        for cmsg_level, cmsg_type, cmsg_data in ancdata:
-            if (
-                cmsg_level == socket.SOL_SOCKET
-                and cmsg_type == socket.SCM_RIGHTS
-                and cmsg_data
-            ):
-                fds.frombytes(
-                    cmsg_data[: len(cmsg_data) - (len(cmsg_data) % fds.itemsize)]
-                )
+        _read_fds(ancdata, fds)
         if not chunk or chunk.rstrip().endswith(b"}"):
             break
 
     return b"".join(chunks), list(fds)
+
+
+def _read_fds(ancdata, fds):
+    for cmsg_level, cmsg_type, cmsg_data in ancdata:
+        if (
+            cmsg_level == socket.SOL_SOCKET
+            and cmsg_type == socket.SCM_RIGHTS
+            and cmsg_data
+        ):
+            fds.frombytes(cmsg_data[: len(cmsg_data) - (len(cmsg_data) % fds.itemsize)])
+
+
+def recv_command_and_fds(sock, maxfds=0):
+    """
+    Receives a command sent by kart_cli_helper - either a FRAME_TYPE_COMMAND frame, or JSON.
+    Returns (command, fds) where command is a dict with "pid", "argv" and "environ" keys,
+    or (None, fds) if the socket was closed before anything was sent.
+    Raises ValueError if the command can't be read.
+    """
+    buf = bytearray(COMMAND_BUFFER_LEN)
+    fds = array.array("i")  # Array of ints
+    nbytes, ancdata, flags, addr = sock.recvmsg_into(
+        [buf], socket.CMSG_LEN(maxfds * fds.itemsize)
+    )
+    _read_fds(ancdata, fds)
+    if not nbytes:
+        return None, list(fds)
+
+    if buf[:1] == b"{":
+        payload = bytes(buf[:nbytes])
+        if not payload.rstrip().endswith(b"}"):
+            rest, more_fds = recv_json_and_fds(sock, maxfds=maxfds)
+            payload += rest
+            fds.extend(more_fds)
+        return json.loads(payload), list(fds)
+
+    nbytes = _recv_into_at_least(sock, buf, nbytes, FRAME_HEADER.size)
+    frame_type, length = FRAME_HEADER.unpack_from(buf)
+    if frame_type != FRAME_TYPE_COMMAND:
+        raise ValueError(f"Unexpected frame type {frame_type}")
+    frame_len = FRAME_HEADER.size + length
+    if frame_len > len(buf):
+        buf = buf[:nbytes] + bytearray(frame_len - nbytes)
+    _recv_into_at_least(sock, buf, nbytes, frame_len)
+
+    command = _parse_command_frame(memoryview(buf)[FRAME_HEADER.size : frame_len])
+    return command, list(fds)
+
+
+def _recv_into_at_least(sock, buf, nbytes, min_nbytes):
+    view = memoryview(buf)
+    while nbytes < min_nbytes:
+        r = sock.recv_into(view[nbytes:])
+        if not r:
+            raise ValueError("Socket closed part way through command")
+        nbytes += r
+    return nbytes
+
+
+def _parse_command_frame(payload):
+    try:
+        pid, argc, envc = COMMAND_FRAME_HEADER.unpack_from(payload)
+        pos = COMMAND_FRAME_HEADER.size
+        entries = []
+        for i in range(argc + envc):
+            (entry_len,) = COMMAND_ENTRY_LEN.unpack_from(payload, pos)
+            pos += COMMAND_ENTRY_LEN.size
+            if pos + entry_len > len(payload):
+                raise ValueError("Command entry overruns frame")
+            entries.append(os.fsdecode(bytes(payload[pos : pos + entry_len])))
+            pos += entry_len
+    except struct.error as e:
+        raise ValueError(f"Truncated command frame: {e}")
+
+    environ = {}
+    for entry in entries[argc:]:
+        key, _, value = entry.partition("=")
+        environ[key] = value
+    return {"pid": pid, "argv": entries[:argc], "environ": environ}
+
+
+def send_frame(sock, frame_type, payload=b""):
+    """Sends a single length-prefixed frame."""
+    sock.sendall(FRAME_HEADER.pack(frame_type, len(payload)) + payload)
+
+
+def recv_frame(sock):
+    """
+    Receives a single length-prefixed frame. Returns (frame_type, payload),
+    or (None, None) if the socket was closed before a complete frame was read.
+    """
+    header = _recv_exactly(sock, FRAME_HEADER.size)
+    if header is None:
+        return None, None
+    frame_type, length = FRAME_HEADER.unpack(header)
+    payload = _recv_exactly(sock, length)
+    if payload is None:
+        return None, None
+    return frame_type, payload
+
+
+def send_exit_frame(sock, exit_code):
+    send_frame(sock, FRAME_TYPE_EXIT, EXIT_FRAME_PAYLOAD.pack(exit_code))
+
+
+def _recv_exactly(sock, length):
+    buf = bytearray()
+    while len(buf) < length:
+        chunk = sock.recv(length - len(buf))
+        if not chunk:
+            return None
+        buf += chunk
+    return bytes(buf)
@@ -1,5 +1,6 @@
 import functools
 import logging
+import math
 import os
 import re
 import sys
@@ -17,7 +18,12 @@ from kart.exceptions import (
     NotFound,
     NotYetImplemented,
 )
-from kart.geometry import Geometry, GeometryType, geometry_from_string
+from kart.geometry import (
+    Geometry,
+    GeometryType,
+    bbox_as_wkt_polygon,
+    geometry_from_string,
+)
 from kart.lfs_util import pointer_file_bytes_to_dict
 from kart.output_util import dump_json_output
 from kart.promisor_utils import object_is_promised
@@ -131,12 +137,40 @@ def resolve(ctx, reference, do_envelope, output_format):
     hidden=True,
     help="Don't do any indexing, instead just calculate the envelope for this feature / encode or decode this envelope.",
 )
+@click.option(
+    "--incremental",
+    is_flag=True,
+    default=False,
+    help=(
+        "Only index the features that each new commit adds or changes compared to its parents. "
+        "This is much faster for small changes, but relies on the existing index being complete."
+    ),
+)
+@click.option(
+    "--with-cells",
+    is_flag=True,
+    default=False,
+    help=(
+        "Also index the features by the cells of a quadtree over the world, so that the features in a region can be "
+        "found without checking every envelope. Once added, the cells are kept up to date by later indexing."
+    ),
+)
+@click.option(
+    "--num-workers",
+    "--num-processes",
+    type=click.INT,
+    help="How many processes to use to calculate envelopes. Defaults to the number of available CPU cores.",
+    default=None,
+    hidden=True,
+)
 @click.argument(
     "commits",
     nargs=-1,
 )
 @click.pass_context
-def index(ctx, clear_existing, dry_run, debug, commits):
+def index(
+    ctx, clear_existing, dry_run, debug, incremental, with_cells, num_workers, commits
+):
     """
     Maintains the index needed to perform a spatially-filtered clone using this repo as the server.
     Indexes all features added by the supplied commits and their ancestors.
@@ -166,6 +200,9 @@ def index(ctx, clear_existing, dry_run, debug, commits):
         verbosity=ctx.obj.verbosity + 1,
         clear_existing=clear_existing,
         dry_run=dry_run,
+        num_workers=num_workers,
+        incremental=incremental,
+        with_cells=with_cells,
     )
 
 
@@ -574,12 +611,13 @@ class SpatialFilter:
         # Quick check - envelope intersects envelope?
         if self.filter_env is not None:
             try:
-                # Don't call envelope() with calculate_if_missing=True - calculating the envelope
-                # involves loading it into OGR, which we don't want to do twice (see below).
-                feature_env = feature_geometry.envelope(only_2d=True)
-
                 # Envelope might be missing (for POINT geometries, or, for unknown reasons).
-                # In this case, we use OGR to calculate it, but we keep the OGR geometry too.
+                # It can usually be calculated without OGR - see wkb_envelope.
+                feature_env = feature_geometry.envelope(
+                    only_2d=True, calculate_if_missing=True, allow_ogr=False
+                )
+
+                # Otherwise (eg, for empty or curved geometries), we use OGR, but we keep the OGR geometry too.
                 if feature_env is None:
                     feature_ogr = feature_geometry.to_ogr()
                     feature_env = feature_ogr.GetEnvelope()
@@ -605,12 +643,102 @@ class SpatialFilter:
         click.echo(f"Error applying spatial filter to geometry:\n{err}", err=True)
         return MatchResult.MATCHING
 
-    def matches_delta_value(self, delta_key_value):
+    # The smallest margin that _filter_wgs84 adds around the filter, in degrees - so that a filter with no area,
+    # such as a point, still has some area once buffered.
+    MIN_WGS84_MARGIN = 1e-6
+
+    @functools.cached_property
+    def _filter_wgs84(self):
+        """
+        Returns (envelope, outer_prepared_geometry, inner_prepared_geometry) for this spatial filter transformed to
+        EPSG:4326 - the CRS of the envelopes in feature_envelopes.db - or None if it can't be usefully transformed.
+        Only the vertices of the filter are reprojected, and the straight edges between them would be curved in
+        EPSG:4326 - so, as in transform_minmax_envelope, the filter is segmented before it is reprojected, and then
+        buffered by a margin: the outer geometry contains the whole filter, and the whole of the inner geometry is
+        inside the filter (the inner geometry is None if the filter is too thin to have one).
+        """
+        from osgeo import osr
+
+        try:
+            transform = osr.CoordinateTransformation(self.crs, make_crs("EPSG:4326"))
+            filter_ogr = self.filter_ogr.Clone()
+            filter_ogr.Transform(transform)
+            w, e, s, n = filter_ogr.GetEnvelope()
+            biggest_dimension = max(e - w, n - s)
+            if biggest_dimension >= 180:
+                # The filter probably crosses the antimeridian - its envelope isn't useful.
+                return None
+
+            # Segment the filter so that no edge spans more than about 1/10th of its size, or more than a degree.
+            min_x, max_x, min_y, max_y = self.filter_env
+            segments_per_side = max(10, math.ceil(biggest_dimension))
+            max_segment_length = max(max_x - min_x, max_y - min_y) / segments_per_side
+            filter_ogr = self.filter_ogr.Clone()
+            if max_segment_length > 0:
+                filter_ogr.Segmentize(max_segment_length)
+            filter_ogr.Transform(transform)
+        except RuntimeError as e:
+            L.info("Can't reproject spatial filter into EPSG:4326: %s", e)
+            return None
+
+        margin = max(0.1 * min(biggest_dimension, 1.0), self.MIN_WGS84_MARGIN)
+        outer_ogr = filter_ogr.Buffer(margin)
+        w, e, s, n = outer_ogr.GetEnvelope()
+        if w < -180 or e > 180:
+            # The buffered filter crosses the antimeridian.
+            return None
+        filter_env = (w, max(s, -90), e, min(n, 90))
+        inner_ogr = filter_ogr.Buffer(-margin)
+        inner_prep = (
+            None if inner_ogr.IsEmpty() else inner_ogr.CreatePreparedGeometry()
+        )
+        return filter_env, outer_ogr.CreatePreparedGeometry(), inner_prep
+
+    def match_indexed_envelopes(self, envelope_index, blob_ids):
+        """
+        Tests the features with the given blob IDs (pygit2.Oid) against this spatial filter without loading them,
+        using their envelopes from the given FeatureEnvelopeIndex (or None, if there isn't one).
+        Returns a dict {blob_id: MatchResult} of the features that can be decided this way - ie, those that have
+        envelopes which are either clearly disjoint from this spatial filter, or are clearly inside it. Features that
+        aren't indexed, or that have envelopes near the edge of this spatial filter, need to be tested using matches().
+        """
+        if self.match_all or envelope_index is None or not blob_ids:
+            return {}
+        filter_wgs84 = self._filter_wgs84
+        if filter_wgs84 is None:
+            return {}
+        filter_env, outer_prep, inner_prep = filter_wgs84
+
+        from osgeo import ogr
+
+        blob_ids_by_raw = {blob_id.raw: blob_id for blob_id in blob_ids}
+        disjoint, intersecting = envelope_index.find_envelopes(
+            list(blob_ids_by_raw), filter_env
+        )
+        result = {blob_ids_by_raw[raw]: MatchResult.NON_MATCHING for raw in disjoint}
+        for raw, (w, s, e, n) in intersecting.items():
+            if w > e:
+                # Envelope crosses the anti-meridian - leave this feature to matches().
+                continue
+            envelope_ogr = ogr.CreateGeometryFromWkt(bbox_as_wkt_polygon(w, e, s, n))
+            if not outer_prep.Intersects(envelope_ogr):
+                result[blob_ids_by_raw[raw]] = MatchResult.NON_MATCHING
+            elif inner_prep is not None and inner_prep.Contains(envelope_ogr):
+                result[blob_ids_by_raw[raw]] = MatchResult.MATCHING
+        return result
+
+    def matches_delta_value(self, delta_key_value, envelope_matches=None):
         # Returns a MatchResult describing whether the feature contained by the given Delta KeyValue matches this
         # spatial filter. The feature may need to be lazily loaded, or it may turn out not to be present in this repo,
         # in which case IS_PROMISED is returned.
+        # envelope_matches - optional, the result of match_indexed_envelopes for the features in these deltas - if
+        # the feature is found there, it doesn't need to be loaded.
         if delta_key_value is None:
             return MatchResult.NONEXISTENT
+        if envelope_matches:
+            blob_id = getattr(delta_key_value.value, "blob_id", None)
+            if blob_id in envelope_matches:
+                return envelope_matches[blob_id]
         try:
             value = delta_key_value.get_lazy_value()
             return self.matches(value)
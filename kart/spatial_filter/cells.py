@@ -0,0 +1,217 @@
+"""
+A hierarchical cell index over longitude / latitude, used alongside the feature_envelopes table so that the features
+in a region can be found without scanning every envelope. The feature_cells table is only written for indexes made
+using `kart spatial-filter index --with-cells`.
+
+The cells form a quadtree over the plate carrée grid: the level 0 cell is the whole world, and each cell at level L
+is split into 2x2 cells at level L + 1, down to MAX_LEVEL. Cell IDs are assigned in Z-order (Morton order), packed
+like S2 cell IDs - the position within the level is followed by a single marker bit, then by zeros for each level
+not descended to. This means that every descendant of a cell has an ID in a contiguous range around the cell's own
+ID, so "all features in or under this cell" is a range lookup on the cell column.
+"""
+
+MAX_LEVEL = 24
+
+# A feature's envelope is covered by cells at the deepest level where it spans at most this many cells per side.
+FEATURE_CELLS_PER_SIDE = 2
+# A query envelope can be split more finely, since it is only covered once per query.
+QUERY_CELLS_PER_SIDE = 4
+
+
+def _spread_bits(value):
+    """Spreads the bits of a 32-bit value out so that there is a zero bit between each one."""
+    value &= 0xFFFFFFFF
+    value = (value | (value << 16)) & 0x0000FFFF0000FFFF
+    value = (value | (value << 8)) & 0x00FF00FF00FF00FF
+    value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0F
+    value = (value | (value << 2)) & 0x3333333333333333
+    value = (value | (value << 1)) & 0x5555555555555555
+    return value
+
+
+def _compact_bits(value):
+    """Inverse of _spread_bits."""
+    value &= 0x5555555555555555
+    value = (value | (value >> 1)) & 0x3333333333333333
+    value = (value | (value >> 2)) & 0x0F0F0F0F0F0F0F0F
+    value = (value | (value >> 4)) & 0x00FF00FF00FF00FF
+    value = (value | (value >> 8)) & 0x0000FFFF0000FFFF
+    value = (value | (value >> 16)) & 0x00000000FFFFFFFF
+    return value
+
+
+def cell_id(level, x, y):
+    """Returns the ID of the cell at column x and row y of the 2**level by 2**level grid at the given level."""
+    assert 0 <= level <= MAX_LEVEL
+    assert 0 <= x < (1 << level) and 0 <= y < (1 << level)
+    morton = _spread_bits(x) | (_spread_bits(y) << 1)
+    return ((morton << 1) | 1) << (2 * (MAX_LEVEL - level))
+
+
+def _lowest_set_bit(cell):
+    return cell & -cell
+
+
+def cell_level(cell):
+    """Returns the level of the given cell."""
+    return MAX_LEVEL - (_lowest_set_bit(cell).bit_length() - 1) // 2
+
+
+def cell_position(cell):
+    """Inverse of cell_id - returns (level, x, y) for the given cell."""
+    level = cell_level(cell)
+    morton = cell >> (2 * (MAX_LEVEL - level) + 1)
+    return level, _compact_bits(morton), _compact_bits(morton >> 1)
+
+
+def cell_parent(cell):
+    """Returns the cell one level up that contains the given cell. The level 0 cell has no parent."""
+    lsb = _lowest_set_bit(cell) << 2
+    assert lsb <= cell_id(0, 0, 0)
+    return (cell & -lsb) | lsb
+
+
+def cell_ancestors(cell):
+    """Returns all the cells that contain the given cell, from the level 0 cell downwards - not including itself."""
+    result = []
+    for _ in range(cell_level(cell)):
+        cell = cell_parent(cell)
+        result.append(cell)
+    result.reverse()
+    return result
+
+
+def cell_range(cell):
+    """Returns (min_id, max_id) - the IDs of the given cell and all of its descendants are in this range, inclusive."""
+    lsb = _lowest_set_bit(cell)
+    return cell - lsb + 1, cell + lsb - 1
+
+
+def _grid_position(value, min_value, max_value):
+    num_cells = 1 << MAX_LEVEL
+    position = int((value - min_value) / (max_value - min_value) * num_cells)
+    return max(0, min(num_cells - 1, position))
+
+
+def cells_for_envelope(envelope, cells_per_side=FEATURE_CELLS_PER_SIDE):
+    """
+    Returns a list of cell IDs that together contain the given (w, s, e, n) envelope. All the cells are at the same
+    level - the deepest level at which the envelope spans no more than cells_per_side cells in each direction.
+    Envelopes where w > e cross the anti-meridian, and are covered as two separate pieces (which may be at
+    different levels).
+    """
+    w, s, e, n = envelope
+    if w > e:
+        result = cells_for_envelope((w, s, 180, n), cells_per_side)
+        result.extend(
+            c
+            for c in cells_for_envelope((-180, s, e, n), cells_per_side)
+            if c not in result
+        )
+        return result
+
+    min_x = _grid_position(w, -180, 180)
+    max_x = _grid_position(e, -180, 180)
+    min_y = _grid_position(s, -90, 90)
+    max_y = _grid_position(n, -90, 90)
+
+    shift = 0
+    while (max_x >> shift) - (min_x >> shift) >= cells_per_side or (
+        max_y >> shift
+    ) - (min_y >> shift) >= cells_per_side:
+        shift += 1
+
+    level = MAX_LEVEL - shift
+    return [
+        cell_id(level, x, y)
+        for x in range(min_x >> shift, (max_x >> shift) + 1)
+        for y in range(min_y >> shift, (max_y >> shift) + 1)
+    ]
+
+
+def cell_rows_for_envelopes(blob_ids, envelopes):
+    """Returns the (cell, blob_id) rows for the feature_cells table for the given features and their envelopes."""
+    return [
+        (cell, blob_id)
+        for blob_id, envelope in zip(blob_ids, envelopes)
+        for cell in cells_for_envelope(envelope)
+    ]
+
+
+def query_ranges_for_envelope(envelope):
+    """
+    Returns (ranges, ancestors) for finding the features whose cells could intersect the given envelope:
+    ranges - a list of (min_id, max_id) ranges, which contain the query's cells and all of their descendants.
+    ancestors - a sorted list of cells which contain at least one of the query's cells.
+    Any feature that intersects the envelope has at least one cell that is either in one of the ranges or is
+    one of the ancestors.
+    """
+    query_cells = cells_for_envelope(envelope, QUERY_CELLS_PER_SIDE)
+    ranges = sorted(cell_range(c) for c in query_cells)
+    ancestors = set()
+    for c in query_cells:
+        ancestors.update(cell_ancestors(c))
+    return ranges, sorted(ancestors)
+
+
+# SQLite has a limit on the number of parameters in a single statement.
+_QUERY_CHUNK_SIZE = 500
+
+
+def find_intersecting_blob_ids(db, envelope):
+    """
+    Given a sqlite connection to the feature_envelopes.db and a (w, s, e, n) envelope in EPSG:4326, returns the set
+    of blob IDs (as 20 bytes) of the indexed features whose envelopes intersect it. The feature_cells table is used
+    to find the candidates, which are then checked against their encoded envelopes - so the result is the same as
+    checking every envelope in the feature_envelopes table. Features that aren't indexed at all - eg, those without
+    a geometry - are not returned.
+    """
+    from kart.spatial_filter.index import EnvelopeEncoder
+
+    envelope_length = db.execute(
+        "SELECT length(envelope) FROM feature_envelopes LIMIT 1;"
+    ).fetchone()
+    if envelope_length is None:
+        return set()
+    encoder = EnvelopeEncoder(envelope_length[0] * 8 // 4)
+
+    # The envelopes are compared once encoded, which rounds them outwards - so the cells need to cover the
+    # query envelope as it will be after encoding, just as the feature_cells cover the encoded feature envelopes.
+    ranges, ancestors = query_ranges_for_envelope(
+        encoder.decode(encoder.encode(envelope))
+    )
+
+    candidates = set()
+    for min_id, max_id in ranges:
+        candidates.update(
+            row[0]
+            for row in db.execute(
+                "SELECT blob_id FROM feature_cells WHERE cell BETWEEN ? AND ?;",
+                (min_id, max_id),
+            )
+        )
+    for chunk in _chunks(ancestors):
+        placeholders = ",".join("?" * len(chunk))
+        candidates.update(
+            row[0]
+            for row in db.execute(
+                f"SELECT blob_id FROM feature_cells WHERE cell IN ({placeholders});",
+                chunk,
+            )
+        )
+
+    result = set()
+    for chunk in _chunks(list(candidates)):
+        placeholders = ",".join("?" * len(chunk))
+        rows = db.execute(
+            f"SELECT blob_id, envelope FROM feature_envelopes WHERE blob_id IN ({placeholders});",
+            chunk,
+        ).fetchall()
+        buffer = b"".join(row[1] for row in rows)
+        result.update(rows[i][0] for i in encoder.intersecting(envelope, buffer))
+    return result
+
+
+def _chunks(values):
+    for i in range(0, len(values), _QUERY_CHUNK_SIZE):
+        yield values[i : i + _QUERY_CHUNK_SIZE]
@@ -1,8 +1,11 @@
+import contextlib
 import functools
+import itertools
 import logging
 import math
+import multiprocessing
 import sys
-import time
+from collections import deque
 
 import click
 import pygit2
@@ -10,7 +13,7 @@ from osgeo import ogr, osr
 from pysqlite3 import dbapi2 as sqlite
 from sqlalchemy import Column, Table
 from sqlalchemy.orm import sessionmaker
-from sqlalchemy.types import BLOB
+from sqlalchemy.types import BLOB, Integer
 
 from kart.crs_util import make_crs, normalise_wkt
 from kart.exceptions import InvalidOperation, SubprocessError
@@ -18,14 +21,23 @@ from kart.geometry import Geometry
 from kart.repo import KartRepoFiles
 from kart.rev_list_objects import rev_list_feature_blobs
 from kart.serialise_util import msg_unpack
+from kart.spatial_filter.cells import cell_rows_for_envelopes, cells_for_envelope
 from kart.sqlalchemy import TableSet
 from kart.sqlalchemy.sqlite import sqlite_engine
 from kart.structs import CommitWithReference
+from kart.utils import chunk, get_num_available_cores
+from kart import native
 from kart import subprocess_util as subprocess
+from kart import tracing
 
 
 L = logging.getLogger("kart.spatial_filter.index")
 
+# Features are sent to the indexing workers in batches of this many.
+INDEX_BATCH_SIZE = 1000
+# While indexing, the transaction is committed every time at least this many envelopes have been written.
+INDEX_COMMIT_EVERY = 100_000
+
 
 def buffered_bulk_warn(self, message, sample):
     """For logging lots of identical warnings, but only actually outputs once per time flush_bulk_warns is called."""
@@ -169,17 +181,26 @@ class CrsHelper:
 
     @functools.lru_cache()
     def transform_from_src_crs(self, src_crs):
-        transform = osr.CoordinateTransformation(src_crs, self.target_crs)
-        if src_crs.IsSame(self.target_crs):
-            desc = f"IDENTITY({src_crs.GetAuthorityCode(None)})"
-        else:
-            desc = f"{src_crs.GetAuthorityCode(None)} -> {self.target_crs.GetAuthorityCode(None)}"
-        transform.desc = desc
-        return transform
+        return make_transform(src_crs, self.target_crs)
+
+
+def make_transform(src_crs, target_crs):
+    """
+    Returns a transform from src_crs to target_crs, with a description for logging.
+    Since transforms can't be pickled, the transform also has the source CRS as WKT.
+    """
+    transform = osr.CoordinateTransformation(src_crs, target_crs)
+    if src_crs.IsSame(target_crs):
+        desc = f"IDENTITY({src_crs.GetAuthorityCode(None)})"
+    else:
+        desc = f"{src_crs.GetAuthorityCode(None)} -> {target_crs.GetAuthorityCode(None)}"
+    transform.desc = desc
+    transform.src_wkt = src_crs.ExportToWkt()
+    return transform
 
 
 class SpatialTreeTables(TableSet):
-    """Tables for associating a variable number of S2 tokens with each feature."""
+    """Tables for associating an envelope, and a few cells of a hierarchical grid, with each feature."""
 
     def __init__(self):
         super().__init__()
@@ -208,6 +229,21 @@ class SpatialTreeTables(TableSet):
             sqlite_with_rowid=False,
         )
 
+        # "feature_cells" maps cells of a quadtree over the world to the features that are in them - see cells.py.
+        # Each feature in feature_envelopes has up to four cells, which together contain its encoded envelope.
+        # This table is optional - it is only written if the index is made using `--with-cells`.
+        # Rows aren't removed if a feature is re-indexed with a different envelope, but these are harmless -
+        # any query that finds a feature using its cells then checks its actual envelope.
+        self.cells = Table(
+            "feature_cells",
+            self.sqlalchemy_metadata,
+            # "cell" is the cell ID - see cells.cell_id.
+            Column("cell", Integer, nullable=False, primary_key=True),
+            # "blob_id" is the git object ID of the feature, as in feature_envelopes.
+            Column("blob_id", BLOB, nullable=False, primary_key=True),
+            sqlite_with_rowid=False,
+        )
+
 
 SpatialTreeTables.copy_tables_to_class()
 
@@ -215,6 +251,7 @@ SpatialTreeTables.copy_tables_to_class()
 def drop_tables(sess):
     sess.execute("DROP TABLE IF EXISTS commits;")
     sess.execute("DROP TABLE IF EXISTS feature_envelopes;")
+    sess.execute("DROP TABLE IF EXISTS feature_cells;")
 
 
 def _minimal_description_of_commit_set(repo, commits):
@@ -276,7 +313,14 @@ def _format_commits(repo, commit_ids):
 
 
 def update_spatial_filter_index(
-    repo, commits, verbosity=1, clear_existing=False, dry_run=False
+    repo,
+    commits,
+    verbosity=1,
+    clear_existing=False,
+    dry_run=False,
+    num_workers=None,
+    incremental=False,
+    with_cells=False,
 ):
     """
     Index the commits given in commit_spec, and write them to the feature_envelopes.db repo file.
@@ -285,6 +329,13 @@ def update_spatial_filter_index(
     commits - a set of commit IDs to index (ancestors of these are implicitly included).
     verbosity - how much non-essential information to output.
     clear_existing - when true, deletes any pre-existing data before re-indexing.
+    num_workers - how many worker processes calculate envelopes, or None to use the number of available cores.
+    incremental - when true, only indexes the features that each commit adds or changes compared to its parents,
+        rather than every feature reachable from the commits that isn't reachable from the already-indexed commits.
+        The result is the same as long as the existing index is complete, but the work done is proportional to the
+        number of changes - eg, for keeping the index up to date from a post-receive hook.
+    with_cells - when true, also writes the feature_cells table - see cells.py. Once an index has this table, it is
+        kept up to date whether or not with_cells is set, so that it stays complete.
     """
 
     # This is needed to allow just-in-time fetching features that are outside the spatial filter,
@@ -306,7 +357,9 @@ def update_spatial_filter_index(
         click.echo("Nothing to do: index already up to date.")
         return
 
-    feature_blob_iter = rev_list_feature_blobs(repo, start_commits, stop_commits)
+    feature_blob_iter = rev_list_feature_blobs(
+        repo, start_commits, stop_commits, incremental=incremental
+    )
 
     progress_every = None
     if verbosity >= 1:
@@ -316,7 +369,18 @@ def update_spatial_filter_index(
         if clear_existing:
             drop_tables(sess)
 
-        SpatialTreeTables.create_all(sess)
+        cells_table_exists = sess.scalar(
+            "SELECT count(*) FROM sqlite_master WHERE name = 'feature_cells';"
+        )
+        metadata = SpatialTreeTables().sqlalchemy_metadata
+        metadata.create_all(
+            sess.connection(),
+            tables=[
+                table
+                for table in metadata.sorted_tables
+                if table.name != "feature_cells" or with_cells or cells_table_exists
+            ],
+        )
         envelope_length = sess.scalar(
             "SELECT length(envelope) FROM feature_envelopes LIMIT 1;"
         )
@@ -337,56 +401,255 @@ def update_spatial_filter_index(
         click.echo("(Not performing the indexing due to --dry-run.")
         sys.exit(0)
 
-    t0 = time.monotonic()
+    started_at = tracing.now()
     i = 0
     trunc = _truncate_oid(repo)
 
+    num_workers = _check_num_workers(num_workers)
+    batches = _feature_batches(feature_blob_iter, crs_helper, trunc)
+
     # Using sqlite directly here instead of sqlalchemy is about 10x faster.
-    # Possibly due to huge number of unbatched queries.
-    # TODO - investigate further.
     db = sqlite.connect(f"file:{db_path}", uri=True)
-    with db:
-        dbcur = db.cursor()
-
-        for i, (commit_id, path_match_result, feature_blob) in enumerate(
-            feature_blob_iter
-        ):
-            if i and progress_every and i % progress_every == 0:
-                click.echo(f"  {i:,d} features... @{time.monotonic()-t0:.1f}s")
-                L.flush_bulk_warns()
-
-            ds_path = path_match_result.group(1)
-            transforms = crs_helper.transforms_for_dataset_at_commit(
-                ds_path,
-                commit_id,
+    # While building the index, we don't wait for each transaction to reach the disk. If the OS crashes
+    # part way through, the index may need to be rebuilt with --clear-existing.
+    orig_journal_mode = db.execute("PRAGMA journal_mode;").fetchone()[0]
+    db.execute("PRAGMA journal_mode = WAL;")
+    db.execute("PRAGMA synchronous = OFF;")
+    try:
+        with db:
+            dbcur = db.cursor()
+            uncommitted = 0
+
+            if with_cells and not cells_table_exists and envelope_length:
+                # The cells are being added to an existing index - add cells for the features already indexed.
+                _backfill_feature_cells(db, encoder)
+
+            with_cells = with_cells or bool(cells_table_exists)
+            for num_read, blob_ids, encoded_envelopes, cell_rows in _index_batches(
+                batches, bits_per_value, with_cells, num_workers
+            ):
+                prev_i = i
+                i += num_read
+                if progress_every and i // progress_every > prev_i // progress_every:
+                    click.echo(f"  {i:,d} features... @{_elapsed(started_at):.1f}s")
+                    L.flush_bulk_warns()
+
+                with tracing.span(
+                    "spatial-filter index write",
+                    cat="spatial-filter",
+                    num_features=len(blob_ids),
+                ):
+                    dbcur.executemany(
+                        "INSERT OR REPLACE INTO feature_envelopes (blob_id, envelope) VALUES (?, ?);",
+                        zip(blob_ids, encoder.split_encoded(encoded_envelopes)),
+                    )
+                    if with_cells:
+                        dbcur.executemany(
+                            "INSERT OR IGNORE INTO feature_cells (cell, blob_id) VALUES (?, ?);",
+                            cell_rows,
+                        )
+                uncommitted += len(blob_ids)
+                if uncommitted >= INDEX_COMMIT_EVERY:
+                    db.commit()
+                    uncommitted = 0
+
+            click.echo(f"  {i:,d} features... @{_elapsed(started_at):.1f}s")
+            L.flush_bulk_warns()
+
+            # Update indexed commits.
+            params = [
+                (bytes.fromhex(commit_id),) for commit_id in all_independent_commits
+            ]
+            dbcur.execute("DELETE FROM commits;")
+            dbcur.executemany("INSERT INTO commits (commit_id) VALUES (?);", params)
+    finally:
+        # Leave the database in its original journal mode for anything else that reads it.
+        db.execute(f"PRAGMA journal_mode = {orig_journal_mode};")
+        db.close()
+
+    tracing.add_span(
+        "spatial-filter index", started_at, cat="spatial-filter", num_features=i
+    )
+    click.echo(f"Indexed {i} features in {_elapsed(started_at):.1f}s")
+
+
+def _elapsed(started_at):
+    """Seconds since started_at, as returned by tracing.now()"""
+    return (tracing.now() - started_at) / 1_000_000
+
+
+def _check_num_workers(num_workers):
+    if num_workers is None:
+        return max(1, int(math.ceil(get_num_available_cores())))
+    else:
+        return max(1, num_workers)
+
+
+def _feature_batches(feature_blob_iter, crs_helper, trunc):
+    """
+    Reads the feature blobs to be indexed, and groups them into batches for _IndexWorker.index_batch.
+    Each batch is a tuple (num_read, transform_specs, features):
+    num_read - the number of feature blobs read, including any that were skipped.
+    transform_specs - dict of {transform_id: tuple of source CRS WKTs} for all the transform_ids in this batch.
+    features - list of tuples (feature_oid, feature_data, transform_id, feature_desc).
+    Transforms are sent by WKT since they can't be pickled, and each distinct list of them gets a transform_id
+    so that the workers only need to create them once.
+    """
+    transform_ids = {}
+    transform_wkts = {}
+    num_read = 0
+    transform_specs = {}
+    features = []
+
+    for commit_id, path_match_result, feature_blob in feature_blob_iter:
+        num_read += 1
+        ds_path = path_match_result.group(1)
+        transforms = crs_helper.transforms_for_dataset_at_commit(
+            ds_path,
+            commit_id,
+        )
+        if transforms:
+            transform_id = transform_ids.get(id(transforms))
+            if transform_id is None:
+                transform_id = len(transform_wkts)
+                transform_ids[id(transforms)] = transform_id
+                transform_wkts[transform_id] = tuple(t.src_wkt for t in transforms)
+            transform_specs[transform_id] = transform_wkts[transform_id]
+
+            feature_oid = feature_blob.id.hex
+            feature_desc = f"{commit_id[:trunc]}:{ds_path}:{feature_oid[:trunc]}"
+            features.append(
+                (feature_oid, feature_blob.data, transform_id, feature_desc)
             )
-            if not transforms:
-                continue
-            geom = get_geometry(repo, feature_blob)
+
+        if len(features) >= INDEX_BATCH_SIZE:
+            yield num_read, transform_specs, features
+            num_read = 0
+            transform_specs = {}
+            features = []
+
+    if num_read:
+        yield num_read, transform_specs, features
+
+
+def _index_batches(batches, bits_per_value, with_cells, num_workers):
+    """
+    Calculates the envelopes for each batch from _feature_batches, either serially or using a pool of worker processes.
+    Yields tuples (num_read, blob_ids, encoded_envelopes, cell_rows) in the same order as the batches - cell_rows is
+    None unless with_cells is set.
+    """
+    # Small updates - eg from a post-receive hook - aren't worth starting the worker processes for.
+    first_batches = list(itertools.islice(batches, 2))
+    batches = itertools.chain(first_batches, batches)
+
+    # Single-process variant - the calling process does everything.
+    if num_workers == 1 or len(first_batches) < 2:
+        worker = _IndexWorker(bits_per_value, with_cells)
+        for batch in batches:
+            yield worker.index_batch(batch, collect_warnings=False)[:4]
+        return
+
+    # Multi-process variant - the calling process reads features and writes the results, workers do the rest.
+    # Only a few batches are in flight at once, so that the reading doesn't get too far ahead of the writing.
+    max_in_flight = num_workers * 2
+    with multiprocessing.get_context().Pool(
+        num_workers,
+        initializer=_init_index_worker,
+        initargs=(bits_per_value, with_cells),
+    ) as pool:
+        in_flight = deque()
+        for batch in batches:
+            in_flight.append(pool.apply_async(_index_batch_in_worker, (batch,)))
+            if len(in_flight) >= max_in_flight:
+                yield _merge_worker_result(in_flight.popleft().get())
+        while in_flight:
+            yield _merge_worker_result(in_flight.popleft().get())
+
+
+def _merge_worker_result(result):
+    *result, (bulk_warns, bulk_warn_samples) = result
+    for message, occurrences in bulk_warns.items():
+        L.bulk_warns[message] = abs(L.bulk_warns.get(message, 0)) + occurrences
+        L.bulk_warn_samples[message] = bulk_warn_samples[message]
+    return tuple(result)
+
+
+def _backfill_feature_cells(db, encoder):
+    """Adds the feature_cells rows for every feature in feature_envelopes."""
+    cursor = db.execute("SELECT blob_id, envelope FROM feature_envelopes;")
+    while True:
+        rows = cursor.fetchmany(INDEX_COMMIT_EVERY)
+        if not rows:
+            break
+        envelopes = encoder.decode_many(b"".join(row[1] for row in rows))
+        db.executemany(
+            "INSERT OR IGNORE INTO feature_cells (cell, blob_id) VALUES (?, ?);",
+            cell_rows_for_envelopes([row[0] for row in rows], envelopes),
+        )
+
+
+class _IndexWorker:
+    """Calculates and encodes the envelopes for a batch of features - see _feature_batches."""
+
+    def __init__(self, bits_per_value, with_cells):
+        self.encoder = EnvelopeEncoder(bits_per_value)
+        self.with_cells = with_cells
+        self.target_crs = make_crs("EPSG:4326")
+        self.transforms = {}
+
+    def _transforms_for_batch(self, transform_specs):
+        for transform_id, src_wkts in transform_specs.items():
+            if transform_id not in self.transforms:
+                self.transforms[transform_id] = [
+                    make_transform(make_crs(wkt), self.target_crs) for wkt in src_wkts
+                ]
+        return self.transforms
+
+    def index_batch(self, batch, collect_warnings=True):
+        num_read, transform_specs, features = batch
+        transforms = self._transforms_for_batch(transform_specs)
+
+        blob_ids = []
+        envelopes = []
+        for feature_oid, feature_data, transform_id, feature_desc in features:
+            geom = get_geometry(None, feature_data)
             if geom is None or geom.is_empty():
                 continue
-            feature_oid = feature_blob.id.hex
-            feature_desc = f"{commit_id[:trunc]}:{ds_path}:{feature_oid[:trunc]}"
-            envelope = get_envelope_for_indexing(geom, transforms, feature_desc)
+            envelope = get_envelope_for_indexing(
+                geom, transforms[transform_id], feature_desc
+            )
             if envelope is None:
                 continue
-
-            params = (bytes.fromhex(feature_oid), encoder.encode(envelope))
-            dbcur.execute(
-                "INSERT OR REPLACE INTO feature_envelopes (blob_id, envelope) VALUES (?, ?);",
-                params,
+            blob_ids.append(bytes.fromhex(feature_oid))
+            envelopes.append(envelope)
+
+        warnings = None
+        if collect_warnings:
+            # Pass the warnings back to the calling process to be output.
+            warnings = (dict(L.bulk_warns), dict(L.bulk_warn_samples))
+            L.bulk_warns.clear()
+            L.bulk_warn_samples.clear()
+
+        encoded_envelopes = self.encoder.encode_many(envelopes)
+        cell_rows = None
+        if self.with_cells:
+            # The cells are chosen to contain the encoded envelopes, which have been rounded outwards.
+            cell_rows = cell_rows_for_envelopes(
+                blob_ids, self.encoder.decode_many(encoded_envelopes)
             )
+        return num_read, blob_ids, encoded_envelopes, cell_rows, warnings
+
+
+_index_worker = None
 
-        click.echo(f"  {i:,d} features... @{time.monotonic()-t0:.1f}s")
-        L.flush_bulk_warns()
 
-        # Update indexed commits.
-        params = [(bytes.fromhex(commit_id),) for commit_id in all_independent_commits]
-        dbcur.execute("DELETE FROM commits;")
-        dbcur.executemany("INSERT INTO commits (commit_id) VALUES (?);", params)
+def _init_index_worker(bits_per_value, with_cells):
+    global _index_worker
+    _index_worker = _IndexWorker(bits_per_value, with_cells)
 
-    t1 = time.monotonic()
-    click.echo(f"Indexed {i} features in {t1-t0:.1f}s")
+
+def _index_batch_in_worker(batch):
+    return _index_worker.index_batch(batch)
 
 
 def debug_index(repo, arg):
@@ -477,6 +740,8 @@ def _debug_envelope(arg):
     roundtripped = encoder.decode(encoded)
     click.echo(f"Encoded as {encoded_hex}\t\t({encoded})")
     click.echo(f"(which decodes as {roundtripped})")
+    cells = cells_for_envelope(roundtripped)
+    click.echo(f"(and is covered by the cells {', '.join(str(c) for c in cells)})")
 
 
 def _debug_encoded_envelope(arg):
@@ -595,6 +860,154 @@ class EnvelopeEncoder:
         normalised = encoded / self.VALUE_MAX_INT
         return normalised * (max_value - min_value) + min_value
 
+    # The batch methods below use _kart_native if it is available - the pure-Python versions are the reference.
+
+    def _use_native(self):
+        return native.lib is not None and self.BITS_PER_VALUE <= 32
+
+    def encode_many(self, envelopes):
+        """Encodes a sequence of envelopes, and concatenates them into a single bytes object."""
+        if self._use_native():
+            return native.lib.encode_envelopes(self.BITS_PER_VALUE, envelopes)
+        return b"".join(self.encode(e) for e in envelopes)
+
+    def decode_many(self, buffer):
+        """Inverse of encode_many - returns a list of envelopes."""
+        if len(buffer) % self.BYTES_PER_ENVELOPE:
+            raise ValueError(
+                f"Buffer length {len(buffer)} is not a multiple of the envelope length {self.BYTES_PER_ENVELOPE}"
+            )
+        if self._use_native():
+            return native.lib.decode_envelopes(self.BITS_PER_VALUE, buffer)
+        return [self.decode(encoded) for encoded in self.split_encoded(buffer)]
+
+    def intersecting(self, envelope, buffer):
+        """
+        Given an envelope and a buffer of encoded envelopes (as returned by encode_many), returns the indexes of
+        the encoded envelopes that intersect the given envelope. Since encoded envelopes are rounded outwards, this
+        can give false positives, but not false negatives.
+        """
+        if len(buffer) % self.BYTES_PER_ENVELOPE:
+            raise ValueError(
+                f"Buffer length {len(buffer)} is not a multiple of the envelope length {self.BYTES_PER_ENVELOPE}"
+            )
+        query = self.encode(envelope)
+        if self._use_native():
+            return native.lib.intersecting_envelopes(
+                self.BITS_PER_VALUE, query, buffer
+            )
+        query = self._unpack(query)
+        return [
+            i
+            for i, encoded in enumerate(self.split_encoded(buffer))
+            if self._unpacked_intersects(query, self._unpack(encoded))
+        ]
+
+    def split_encoded(self, buffer):
+        """Yields each of the encoded envelopes in a buffer of concatenated encoded envelopes."""
+        length = self.BYTES_PER_ENVELOPE
+        return (buffer[i : i + length] for i in range(0, len(buffer), length))
+
+    def _unpack(self, encoded):
+        integer = int.from_bytes(encoded, self.BYTE_ORDER)
+        result = []
+        for i in range(4):
+            result.append(integer & self.VALUE_MAX_INT)
+            integer >>= self.BITS_PER_VALUE
+        return tuple(reversed(result))
+
+    @staticmethod
+    def _unpacked_intersects(a, b):
+        # Envelopes where w > e cross the anti-meridian. The comparisons are inclusive, since even a zero-width
+        # encoded envelope has been rounded outwards to contain the original envelope.
+        a_w, a_s, a_e, a_n = a
+        b_w, b_s, b_e, b_n = b
+        if not (b_s <= a_n and b_n >= a_s):
+            return False
+        if a_w > a_e and b_w > b_e:
+            # Both contain the anti-meridian.
+            return True
+        if a_w > a_e or b_w > b_e:
+            return b_w <= a_e or b_e >= a_w
+        return b_w <= a_e and b_e >= a_w
+
+
+class FeatureEnvelopeIndex:
+    """
+    Read-only access to the envelopes in a repo's feature_envelopes.db, so that features can be tested against
+    a spatial filter using their encoded envelopes, without being loaded - see SpatialFilter.match_indexed_envelopes.
+    """
+
+    # The database is memory-mapped, so that repeated lookups are served from the OS page cache.
+    MMAP_SIZE = 256 * 1024 * 1024
+
+    # SQLite has a limit on the number of parameters in a single statement.
+    QUERY_CHUNK_SIZE = 500
+
+    def __init__(self, db, encoder):
+        self.db = db
+        self.encoder = encoder
+
+    @classmethod
+    @contextlib.contextmanager
+    def open(cls, repo):
+        """
+        Context manager - yields a FeatureEnvelopeIndex for the given repo's feature_envelopes.db, or None if the
+        repo has no envelopes indexed.
+        """
+        db_path = repo.gitdir_file(KartRepoFiles.FEATURE_ENVELOPES)
+        if not db_path.is_file():
+            yield None
+            return
+
+        db = sqlite.connect(f"{db_path.as_uri()}?mode=ro", uri=True)
+        try:
+            try:
+                db.execute(f"PRAGMA mmap_size = {cls.MMAP_SIZE};")
+                envelope_length = db.execute(
+                    "SELECT length(envelope) FROM feature_envelopes LIMIT 1;"
+                ).fetchone()
+            except sqlite.Error as e:
+                L.info("Can't read feature_envelopes.db: %s", e)
+                envelope_length = None
+            if envelope_length is None:
+                yield None
+            else:
+                yield cls(db, EnvelopeEncoder(envelope_length[0] * 8 // 4))
+        finally:
+            db.close()
+
+    def find_envelopes(self, blob_ids, envelope):
+        """
+        Looks up the given blob IDs (as 20 bytes) and checks their encoded envelopes against the given (w, s, e, n)
+        envelope in EPSG:4326. Returns (disjoint, intersecting):
+        disjoint - the set of blob IDs whose envelopes definitely don't intersect the given envelope.
+        intersecting - a dict {blob_id: (w, s, e, n)} of the blob IDs whose envelopes could intersect the given
+            envelope, with their decoded envelopes - which have been rounded outwards, and so contain the feature.
+        Blob IDs that aren't indexed - eg, features without a geometry - aren't in either result.
+        """
+        disjoint = set()
+        intersecting = {}
+        for blob_id_chunk in chunk(blob_ids, self.QUERY_CHUNK_SIZE):
+            placeholders = ",".join("?" * len(blob_id_chunk))
+            rows = self.db.execute(
+                f"SELECT blob_id, envelope FROM feature_envelopes WHERE blob_id IN ({placeholders});",
+                blob_id_chunk,
+            ).fetchall()
+            if not rows:
+                continue
+            buffer = b"".join(row[1] for row in rows)
+            hits = self.encoder.intersecting(envelope, buffer)
+            hit_rows = [rows[i] for i in hits]
+            hit_envelopes = self.encoder.decode_many(
+                b"".join(row[1] for row in hit_rows)
+            )
+            intersecting.update(
+                (row[0], tuple(env)) for row, env in zip(hit_rows, hit_envelopes)
+            )
+            disjoint.update(row[0] for row in rows if row[0] not in intersecting)
+        return disjoint, intersecting
+
 
 def get_envelope_for_indexing(geom, transforms, feature_desc):
     """
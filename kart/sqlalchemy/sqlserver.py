@@ -21,7 +21,7 @@ class Db_SqlServer(BaseDb):
     preparer = MSIdentifierPreparer(MSDialect())
 
     @classmethod
-    def create_engine(cls, msurl):
+    def create_engine(cls, msurl, **kwargs):
         url = urlsplit(msurl)
         if url.scheme != cls.CANONICAL_SCHEME:
             raise ValueError("Expecting mssql://")
@@ -36,7 +36,9 @@ class Db_SqlServer(BaseDb):
 
         msurl = urlunsplit([cls.INTERNAL_SCHEME, url_netloc, url.path, url_query, ""])
 
-        engine = sqlalchemy.create_engine(msurl, poolclass=cls._pool_class())
+        engine = sqlalchemy.create_engine(
+            msurl, poolclass=cls._pool_class(), **kwargs
+        )
         return engine
 
     @classmethod
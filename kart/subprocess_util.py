@@ -1,4 +1,5 @@
 import asyncio
+import contextlib
 import functools
 import os
 from pathlib import Path
@@ -8,6 +9,8 @@ import sys
 from asyncio import IncompleteReadError, LimitOverrunError
 from functools import partial
 
+from kart import tracing
+
 # Package kart.subprocess_util is a drop-in replacement for subprocess which handles some things
 # that kart will generally want to do when calling a subprocess, as well as having some extra
 # functionality that the subprocess module does not. Here are the things it can do:
@@ -69,25 +72,67 @@ PIPE = subprocess.PIPE
 
 
 def run(cmd, **kwargs):
-    return subprocess.run(cmd, **add_default_kwargs(kwargs))
+    with _trace_span(cmd):
+        return subprocess.run(cmd, **add_default_kwargs(kwargs))
 
 
 def call(cmd, **kwargs):
-    return subprocess.call(cmd, **add_default_kwargs(kwargs))
+    with _trace_span(cmd):
+        return subprocess.call(cmd, **add_default_kwargs(kwargs))
 
 
 def check_call(cmd, **kwargs):
-    return subprocess.check_call(cmd, **add_default_kwargs(kwargs))
+    with _trace_span(cmd):
+        return subprocess.check_call(cmd, **add_default_kwargs(kwargs))
 
 
 def check_output(cmd, **kwargs):
-    return subprocess.check_output(cmd, **add_default_kwargs(kwargs, check_output=True))
+    with _trace_span(cmd):
+        return subprocess.check_output(
+            cmd, **add_default_kwargs(kwargs, check_output=True)
+        )
 
 
 def Popen(cmd, **kwargs):
+    if tracing.is_enabled():
+        return TracedPopen(cmd, **add_default_kwargs(kwargs))
     return subprocess.Popen(cmd, **add_default_kwargs(kwargs))
 
 
+def _trace_span(cmd):
+    if not tracing.is_enabled():
+        return contextlib.nullcontext()
+    return tracing.span(
+        tracing.command_name(cmd), cat="subprocess", argv=_trace_argv(cmd)
+    )
+
+
+def _trace_argv(cmd):
+    return cmd if isinstance(cmd, str) else [str(c) for c in cmd]
+
+
+class TracedPopen(subprocess.Popen):
+    """A Popen that records a KART_TRACE span lasting from when the process is started until it is waited for."""
+
+    def __init__(self, cmd, **kwargs):
+        self._trace_start = tracing.now()
+        self._trace_cmd = cmd
+        super().__init__(cmd, **kwargs)
+
+    def wait(self, timeout=None):
+        returncode = super().wait(timeout=timeout)
+        if self._trace_start is not None:
+            tracing.add_span(
+                tracing.command_name(self._trace_cmd),
+                self._trace_start,
+                cat="subprocess",
+                argv=_trace_argv(self._trace_cmd),
+                returncode=returncode,
+            )
+            self._trace_start = None
+        return returncode
+
+
 def add_default_kwargs(kwargs_dict, check_output=False):
     # We could allow the caller to supply the env, but env_overrides is generally more useful.
     # You can disable this assert if you are sure you need this (and not env_overrides).
@@ -250,14 +295,15 @@ def run_and_tee_output(cmd, tee_stdout=False, tee_stderr=False, **kwargs):
     if "_KART_RUN_WITH_CAPTURE" in os.environ:
         tee_stdout = True
         tee_stderr = True
-    proc = asyncio.run(
-        read_and_display(
-            cmd,
-            tee_stdout=tee_stdout,
-            tee_stderr=tee_stderr,
-            **add_default_kwargs(kwargs),
+    with _trace_span(cmd):
+        proc = asyncio.run(
+            read_and_display(
+                cmd,
+                tee_stdout=tee_stdout,
+                tee_stderr=tee_stderr,
+                **add_default_kwargs(kwargs),
+            )
         )
-    )
     return proc
 
 
@@ -275,14 +321,15 @@ def run_then_exit(cmd):
     if "_KART_RUN_WITH_CAPTURE" in os.environ:
         _run_with_capture_then_exit(cmd)
     else:
-        p = subprocess.run(
-            cmd,
-            encoding="utf-8",
-            env=tool_environment(),
-            stdin=sys.stdin,
-            stdout=sys.stdout,
-            stderr=sys.stderr,
-        )
+        with _trace_span(cmd):
+            p = subprocess.run(
+                cmd,
+                encoding="utf-8",
+                env=tool_environment(),
+                stdin=sys.stdin,
+                stdout=sys.stdout,
+                stderr=sys.stderr,
+            )
         sys.exit(p.returncode)
 
 
@@ -295,12 +342,13 @@ def _run_with_capture_then_exit(cmd):
     # io wrapper.
     # This io wrapper is not compatible with the stdin= kwarg to .run - in that case
     # it gets treated as a file like object and fails.
-    p = subprocess.run(
-        cmd,
-        capture_output=True,
-        encoding="utf-8",
-        env=tool_environment(),
-    )
+    with _trace_span(cmd):
+        p = subprocess.run(
+            cmd,
+            capture_output=True,
+            encoding="utf-8",
+            env=tool_environment(),
+        )
     sys.stdout.write(p.stdout)
     sys.stdout.flush()
     sys.stderr.write(p.stderr)
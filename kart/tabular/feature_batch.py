@@ -0,0 +1,21 @@
+class FeatureBatch:
+    """
+    A batch of features from a single dataset, all with the same schema, stored as a row of values per feature
+    rather than as a dict per feature. The values in each row are in schema order - so a feature dict is just
+    dict(zip(batch.column_names, row)). This lets callers that process every feature in a dataset avoid creating
+    intermediate dicts.
+    """
+
+    def __init__(self, schema, rows):
+        self.schema = schema
+        self.column_names = tuple(c.name for c in schema.columns)
+        self.rows = rows
+
+    def __len__(self):
+        return len(self.rows)
+
+    def features(self):
+        """Yields a feature dict for each feature - the same dicts as would be returned by dataset.get_feature."""
+        column_names = self.column_names
+        for row in self.rows:
+            yield dict(zip(column_names, row))
@@ -2,7 +2,6 @@ import json
 
 from kart.exceptions import InvalidOperation
 from kart.geometry import Geometry, ogr_to_hex_wkb
-from kart.utils import ungenerator
 
 
 def feature_as_text(row, prefix=""):
@@ -30,15 +29,19 @@ def feature_field_as_text(row, key, prefix):
     return f"{prefix}{key:>40} = {val}"
 
 
-@ungenerator(dict)
 def feature_as_json(row, pk_value, geometry_transform=None):
     """
     Turns a row into a dict for serialization as JSON.
     The geometry is serialized as hexWKB.
     """
+    # This is called once per feature for every feature in a diff, so it is a plain loop rather than a generator.
+    result = {}
     for k, v in row.items():
-        if isinstance(v, Geometry):
-            if geometry_transform is None:
+        if isinstance(v, bytes):
+            # Geometry is a subclass of bytes.
+            if not isinstance(v, Geometry):
+                v = v.hex()
+            elif geometry_transform is None:
                 v = v.to_hex_wkb()
             else:
                 # reproject
@@ -50,9 +53,8 @@ def feature_as_json(row, pk_value, geometry_transform=None):
                         f"Can't reproject geometry with ID '{pk_value}' into target CRS"
                     ) from e
                 v = ogr_to_hex_wkb(ogr_geom)
-        elif isinstance(v, bytes):
-            v = bytes.hex(v)
-        yield k, v
+        result[k] = v
+    return result
 
 
 def feature_as_geojson(
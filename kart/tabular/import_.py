@@ -164,7 +164,14 @@ def any_at_all(iterable):
     "--num-workers",
     "--num-processes",
     type=click.INT,
-    help="How many import workers to run in parallel. This is not currently supported for tabular import, so this option is ignored.",
+    help="How many worker processes to use for encoding features while importing tables.",
+    default=None,
+    hidden=True,
+)
+@click.option(
+    "--num-shards",
+    type=click.INT,
+    help="How many git-fast-import processes to split the imported features between, each writing its own pack.",
     default=None,
     hidden=True,
 )
@@ -196,6 +203,7 @@ def table_import(
     max_delta_depth,
     do_checkout,
     num_workers,
+    num_shards,
     ds_path,
     args,
 ):
@@ -339,7 +347,11 @@ def table_import(
     fast_import_tables(
         repo,
         import_sources,
-        settings=FastImportSettings(max_delta_depth=max_delta_depth),
+        settings=FastImportSettings(
+            max_delta_depth=max_delta_depth,
+            num_workers=num_workers,
+            num_shards=num_shards,
+        ),
         verbosity=ctx.obj.verbosity + 1,
         message=message,
         replace_existing=replace_existing_enum,
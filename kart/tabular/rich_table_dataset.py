@@ -170,7 +170,10 @@ class RichTableDataset(TableDataset):
 
     def get_feature_promise_from_path(self, feature_path):
         feature_blob = self.get_blob_at(feature_path)
-        return functools.partial(self.get_feature_from_blob, feature_blob)
+        promise = functools.partial(self.get_feature_from_blob, feature_blob)
+        # Lets a spatial filter find this feature's envelope in feature_envelopes.db without loading it.
+        promise.blob_id = feature_blob.id
+        return promise
 
     def apply_diff(
         self, dataset_diff, object_builder, *, resolve_missing_values_from_ds=None
@@ -1,9 +1,11 @@
 import functools
+from contextlib import nullcontext
 
 from kart.base_dataset import BaseDataset
-from kart.spatial_filter import SpatialFilter
+from kart.spatial_filter import MatchResult, SpatialFilter
 from kart.working_copy import PartType
 from kart.progress_util import progress_bar
+from kart.utils import chunk
 
 from .import_source import TableImportSource
 
@@ -39,6 +41,9 @@ class TableDataset(BaseDataset, TableImportSource):
 
     NUM_FEATURES_PER_PROGRESS_LOG = 10_000
 
+    # The number of features that features() decodes at once - see decode_features.
+    FEATURE_BATCH_SIZE = 1000
+
     def __init__(self, tree, path, repo, dirname=None):
         super().__init__(tree, path, repo, dirname=dirname)
 
@@ -143,22 +148,41 @@ class TableDataset(BaseDataset, TableImportSource):
             show_progress=show_progress, total=n_total, unit="F", desc=self.path
         )
 
-        with progress as p:
-            for blob in self.feature_blobs():
-                n_read += 1
-                try:
-                    feature = self.get_feature_from_blob(blob)
-                except KeyError as e:
-                    if spatial_filter.feature_is_prefiltered(e):
-                        feature = None
-                    else:
-                        raise
-
-                if feature is not None and spatial_filter.matches(feature):
-                    n_matched += 1
-                    yield feature
-
-                p.update(1)
+        if spatial_filter.match_all:
+            envelope_index_ctx = nullcontext()
+        else:
+            from kart.spatial_filter.index import FeatureEnvelopeIndex
+
+            envelope_index_ctx = FeatureEnvelopeIndex.open(self.repo)
+
+        with progress as p, envelope_index_ctx as envelope_index:
+            for blobs in chunk(self.feature_blobs(), self.FEATURE_BATCH_SIZE):
+                n_read += len(blobs)
+                # Features with indexed envelopes that are outside the spatial filter don't need to be loaded at all.
+                envelope_matches = spatial_filter.match_indexed_envelopes(
+                    envelope_index, [blob.id for blob in blobs]
+                )
+                paths_and_data = []
+                match_results = []
+                for blob in blobs:
+                    match_result = envelope_matches.get(blob.id)
+                    if match_result is MatchResult.NON_MATCHING:
+                        continue
+                    try:
+                        paths_and_data.append((blob.name, memoryview(blob)))
+                        match_results.append(match_result)
+                    except KeyError as e:
+                        if not spatial_filter.feature_is_prefiltered(e):
+                            raise
+
+                for feature, match_result in zip(
+                    self.decode_features(paths_and_data), match_results
+                ):
+                    if match_result or spatial_filter.matches(feature):
+                        n_matched += 1
+                        yield feature
+
+                p.update(len(blobs))
 
         if show_progress and not spatial_filter.match_all:
             p.write(
@@ -202,6 +226,15 @@ class TableDataset(BaseDataset, TableImportSource):
         """
         raise NotImplementedError()
 
+    def decode_features(self, paths_and_data):
+        """
+        Given a list of (path, data) tuples containing the full path and the data of each feature, yields the same
+        features as get_feature would return for each one. Subclasses can decode the features all at once if that
+        is more efficient.
+        """
+        for path, data in paths_and_data:
+            yield self.get_feature(path=path, data=data)
+
     def get_feature_from_blob(self, feature_blob):
         return self.get_feature(path=feature_blob.name, data=memoryview(feature_blob))
 
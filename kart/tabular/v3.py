@@ -1,4 +1,5 @@
 import functools
+import operator
 import os
 import re
 
@@ -20,6 +21,8 @@ from kart.serialise_util import (
     msg_pack,
     msg_unpack,
 )
+from kart.utils import chunk
+from .feature_batch import FeatureBatch
 from .v3_paths import PathEncoder
 from .rich_table_dataset import RichTableDataset
 
@@ -175,6 +178,45 @@ class TableV3(RichTableDataset):
         raw_dict = self.get_raw_feature_dict(pk_values=pk_values, path=path, data=data)
         return self.schema.feature_from_raw_dict(raw_dict)
 
+    def get_feature_batch(self, paths_and_data):
+        """
+        Decodes a batch of features at once, given a list of (path, data) tuples containing the full path and the
+        data of each feature. Returns a FeatureBatch containing the same features as get_feature would return,
+        but without creating a raw dict and then a feature dict for every feature - each feature's stored values
+        are rearranged into schema order directly, using a mapping that is worked out once per legend.
+        """
+        rows = []
+        for path, data in paths_and_data:
+            pk_values = self.decode_path_to_pks(path)
+            legend_hash, non_pk_values = msg_unpack(data)
+            legend_to_row, num_values = self._legend_to_row(legend_hash)
+            # The extra None at the end is the value for any schema columns that aren't in the legend.
+            values = (*pk_values, *non_pk_values, None)
+            assert len(values) == num_values
+            rows.append(legend_to_row(values))
+        return FeatureBatch(self.schema, rows)
+
+    def decode_features(self, paths_and_data):
+        return self.get_feature_batch(paths_and_data).features()
+
+    @functools.lru_cache()
+    def _legend_to_row(self, legend_hash):
+        """
+        Returns (legend_to_row, num_values) for the legend with the given hash. legend_to_row is a function that
+        takes the num_values values stored for a feature with this legend - pk values, then non-pk values,
+        then None - and returns them rearranged to match this dataset's schema.
+        """
+        legend = self.get_legend(legend_hash)
+        legend_columns = legend.pk_columns + legend.non_pk_columns
+        num_values = len(legend_columns) + 1
+        index_of = {column_id: i for i, column_id in enumerate(legend_columns)}
+        indexes = [index_of.get(c.id, num_values - 1) for c in self.schema.columns]
+        if len(indexes) == 1:
+            # itemgetter doesn't return a tuple if it only gets one item.
+            index = indexes[0]
+            return (lambda values: (values[index],)), num_values
+        return operator.itemgetter(*indexes), num_values
+
     def feature_blobs(self):
         """
         Returns a generator that yields every feature blob in turn.
@@ -250,6 +292,58 @@ class TableV3(RichTableDataset):
             raw_dict, schema.legend, relative=relative, schema=schema
         )
 
+    # Features are encoded this many at a time by encode_features_in_batches.
+    ENCODE_FEATURES_BATCH_SIZE = 1000
+
+    # When re-importing, up to this many features with hash-based paths are grouped by tree before being compared.
+    REIMPORT_MAX_BUFFERED_FEATURES = 100_000
+
+    def encode_features(self, features, schema=None, relative=False):
+        """
+        Given a list of features, returns a list of the (path, data) tuples which *should be written* to write them -
+        the same as calling encode_feature for each one, but with the paths encoded in a single batch.
+        """
+        if schema is None:
+            schema = self.schema
+        legend = schema.legend
+        legend_hash = legend.hexhash()
+        value_tuples = [
+            legend.raw_dict_to_value_tuples(schema.feature_to_raw_dict(feature))
+            for feature in features
+        ]
+        paths = self.encode_pks_to_paths(
+            [pk_values for pk_values, non_pk_values in value_tuples],
+            relative=relative,
+            schema=schema,
+        )
+        return [
+            (path, msg_pack([legend_hash, non_pk_values]))
+            for path, (pk_values, non_pk_values) in zip(paths, value_tuples)
+        ]
+
+    def encode_features_in_batches(self, features, schema=None, relative=False):
+        """
+        Generates a (path, data, feature) tuple for each of the given features - see encode_features.
+        The features are read and encoded ENCODE_FEATURES_BATCH_SIZE at a time.
+        """
+        for batch in chunk(features, self.ENCODE_FEATURES_BATCH_SIZE):
+            encoded = self.encode_features(batch, schema, relative=relative)
+            for (path, data), feature in zip(encoded, batch):
+                yield path, data, feature
+
+    def encode_pks_to_paths(self, pk_values_list, relative=False, *, schema=None):
+        """
+        Given a list containing the pk values of several features, returns a list of the paths the features should
+        be written to - the same as calling encode_pks_to_path for each one. See PathEncoder.encode_pks_to_paths.
+        """
+        encoder = self.feature_path_encoder_for_schema(schema)
+        prefix = self.FEATURE_PATH
+        if not relative:
+            prefix = self.ensure_full_path(prefix)
+        return [
+            f"{prefix}{path}" for path in encoder.encode_pks_to_paths(pk_values_list)
+        ]
+
     def encode_pks_to_path(self, pk_values, relative=False, *, schema=None):
         """
         Given some pk values, returns the path the feature should be written to.
@@ -311,6 +405,12 @@ class TableV3(RichTableDataset):
     def import_iter_feature_blobs(
         self, repo, resultset, source, replacing_dataset=None
     ):
+        """
+        Generates (full_path, blob_data) tuples for each feature in the resultset.
+        If a replacing_dataset is given, features that are unchanged from that dataset are not rewritten - instead,
+        (full_path, pygit2.Blob) is generated for individual features that already exist in the replacing_dataset,
+        and (full_path, pygit2.Tree) is generated for whole trees of features that can be reused as they are.
+        """
         schema = source.schema
         if replacing_dataset:
             # Optimisation: Try to avoid rewriting features for compatible schema changes.
@@ -326,37 +426,103 @@ class TableV3(RichTableDataset):
             # This optimisation is useful in the following situations:
             #  * a column was added but some values remain NULL (example above)
             #  * a column was dropped, and some rows have no other values changed
-            for feature in resultset:
-                try:
-                    pk_values = (feature[replacing_dataset.primary_key],)
-                    rel_path = self.encode_pks_to_path(
-                        pk_values, relative=True, schema=schema
-                    )
-                    existing_data = replacing_dataset.get_data_at(
-                        rel_path, as_memoryview=True
+            #
+            # The features are compared a tree at a time - see _compare_features_to_existing_tree.
+            # Sources generally return features in primary key order, and with integer primary keys, neighbouring
+            # features share trees - so each tree's features are compared as soon as the next tree is reached.
+            # With hash-based paths, neighbouring features are spread across every tree, so features are grouped
+            # by tree until REIMPORT_MAX_BUFFERED_FEATURES are buffered, and then every group is compared.
+            encoder = self.feature_path_encoder_for_schema(schema)
+            max_buffered = (
+                self.REIMPORT_MAX_BUFFERED_FEATURES
+                if encoder.DISTRIBUTED_FEATURES
+                else 0
+            )
+            groups = {}
+            num_buffered = 0
+            seen_tree_paths = set()
+            for path, data, feature in self.encode_features_in_batches(
+                resultset, schema
+            ):
+                tree_path, name = path.rsplit("/", 1)
+                if tree_path not in groups and num_buffered >= max_buffered:
+                    yield from self._compare_feature_groups_to_existing_trees(
+                        schema, replacing_dataset, groups, seen_tree_paths
                     )
-                except KeyError:
-                    # this feature isn't in the dataset we're replacing
-                    yield self.encode_feature(feature, schema)
-                    continue
+                    groups = {}
+                    num_buffered = 0
+                groups.setdefault(tree_path, []).append((name, data, feature))
+                num_buffered += 1
+            yield from self._compare_feature_groups_to_existing_trees(
+                schema, replacing_dataset, groups, seen_tree_paths
+            )
+        else:
+            for path, data, feature in self.encode_features_in_batches(
+                resultset, schema
+            ):
+                yield path, data
 
+    def _compare_feature_groups_to_existing_trees(
+        self, schema, replacing_dataset, groups, seen_tree_paths
+    ):
+        """Calls _compare_features_to_existing_tree for each {tree_path: features} in groups, in path order."""
+        for tree_path in sorted(groups):
+            yield from self._compare_features_to_existing_tree(
+                schema, replacing_dataset, tree_path, groups[tree_path], seen_tree_paths
+            )
+
+    def _compare_features_to_existing_tree(
+        self, schema, replacing_dataset, tree_path, features, seen_tree_paths
+    ):
+        """
+        Given the full path of a tree, and a list of (name, data, feature) tuples for newly encoded features in that
+        tree, compares them to the features in the same tree in replacing_dataset - see import_iter_feature_blobs.
+        A feature whose encoding is byte-for-byte the same as the existing blob is unchanged, which is checked by
+        comparing blob IDs without reading the existing blob at all. Only features with a different encoding need
+        the existing blob to be decoded, since it could be the same feature stored with an older legend.
+        """
+        if not features:
+            return
+        # If this tree has already had features written to it, it can't be replaced wholesale.
+        tree_already_written = tree_path in seen_tree_paths
+        seen_tree_paths.add(tree_path)
+
+        existing_tree = replacing_dataset.get_subtree(self.ensure_rel_path(tree_path))
+        result = []
+        reused_names = set()
+        for name, data, feature in features:
+            path = f"{tree_path}/{name}"
+            try:
+                existing_blob = existing_tree / name
+            except KeyError:
+                # this feature isn't in the dataset we're replacing
+                result.append((path, data))
+                continue
+
+            if existing_blob.id != pygit2.hash(data):
+                pk_values = (feature[replacing_dataset.primary_key],)
                 existing_feature_raw_dict = replacing_dataset.get_raw_feature_dict(
-                    pk_values, data=existing_data
+                    pk_values, data=memoryview(existing_blob)
                 )
                 # This adapts the existing feature to the new schema
                 existing_feature = schema.feature_from_raw_dict(
                     existing_feature_raw_dict
                 )
-                if existing_feature == feature:
-                    # Nothing changed? No need to rewrite the feature blob
-                    yield self.encode_pks_to_path(
-                        pk_values, schema=schema
-                    ), existing_data
-                else:
-                    yield self.encode_feature(feature, schema)
+                if existing_feature != feature:
+                    result.append((path, data))
+                    continue
+
+            # Nothing changed? No need to rewrite the feature blob
+            result.append((path, existing_blob))
+            reused_names.add(name)
+
+        if not tree_already_written and (
+            len(reused_names) == len(features) == len(existing_tree)
+        ):
+            # Every feature in the existing tree is reused, and nothing else is added - reuse the whole tree.
+            yield tree_path, existing_tree
         else:
-            for feature in resultset:
-                yield self.encode_feature(feature, schema)
+            yield from result
 
     def apply_meta_diff(
         self, meta_diff, object_builder, *, resolve_missing_values_from_ds=None
@@ -6,6 +6,7 @@ from collections import defaultdict
 
 import pygit2
 
+from kart import native
 from kart.exceptions import NotYetImplemented
 from kart.serialise_util import b64encode_str, b64hash, hexhash, msg_pack
 from kart.utils import chunk
@@ -24,6 +25,19 @@ _BASE64_URLSAFE_ALPHABET = (
 SAMPLE_ALL_TREES = "."
 
 
+def nonrecursive_diff(tree_a, tree_b):
+    """
+    Returns a dict mapping names to OIDs which differ between the trees.
+    (either the key is present in both, and the OID is different,
+    or the key is only present in one of the trees)
+    """
+    a = {obj.name: obj for obj in tree_a} if tree_a else {}
+    b = {obj.name: obj for obj in tree_b} if tree_b else {}
+    all_names = sorted(list(set(a.keys() | b.keys())))
+
+    return {k: (a.get(k), b.get(k)) for k in all_names if a.get(k) != b.get(k)}
+
+
 @functools.lru_cache()
 def _make_decode_map(alphabet):
     return {char: i for i, char in enumerate(iter(alphabet))}
@@ -159,6 +173,29 @@ class PathEncoder:
     def encode_filename(self, pk_values):
         return self._encode_file_name_from_packed_pk(msg_pack(pk_values))
 
+    def encode_pks_to_paths(self, pk_values_list):
+        """
+        Given a list containing the pk values of several features, returns a list of the paths the features should
+        be written to - the same as calling encode_pks_to_path for each one. The encoding is done in one native call
+        if _kart_native is available, except where it doesn't support the PK values given - encode_pks_to_path is the
+        reference implementation, and raises the appropriate error for PK values that can't be encoded.
+        """
+        if not isinstance(pk_values_list, (list, tuple)):
+            pk_values_list = list(pk_values_list)
+        if native.lib is not None:
+            try:
+                return native.lib.encode_feature_paths(
+                    pk_values_list,
+                    self.scheme,
+                    self.encoding,
+                    self.levels,
+                    self.branches,
+                    self.group_length,
+                )
+            except ValueError:
+                pass
+        return [self.encode_pks_to_path(pk_values) for pk_values in pk_values_list]
+
     def to_dict(self):
         return {
             "scheme": self.scheme,
@@ -173,16 +210,7 @@ class PathEncoder:
             yield self._single_tree_int_encoder.encode_int(i)
 
     def _nonrecursive_diff(self, tree_a, tree_b):
-        """
-        Returns a dict mapping names to OIDs which differ between the trees.
-        (either the key is present in both, and the OID is different,
-        or the key is only present in one of the trees)
-        """
-        a = {obj.name: obj for obj in tree_a} if tree_a else {}
-        b = {obj.name: obj for obj in tree_b} if tree_b else {}
-        all_names = sorted(list(set(a.keys() | b.keys())))
-
-        return {k: (a.get(k), b.get(k)) for k in all_names if a.get(k) != b.get(k)}
+        return nonrecursive_diff(tree_a, tree_b)
 
 
 class MsgpackHashPathEncoder(PathEncoder):
@@ -219,7 +247,7 @@ class MsgpackHashPathEncoder(PathEncoder):
         )
 
     def _recursive_diff_estimate(
-        self, tree1, tree2, branch_count, total_samples_to_take
+        self, tree1, tree2, branch_count, total_samples_to_take, cancel_token=None
     ):
         """
         Samples some subtrees of the given two trees, and returns an estimate of the number
@@ -232,6 +260,8 @@ class MsgpackHashPathEncoder(PathEncoder):
         of subtrees, and multiply by the appropriate exponent of the branch factor
         to get a total number of blobs.
         """
+        if cancel_token is not None:
+            cancel_token.check()
         diff = self._nonrecursive_diff(tree1, tree2)
 
         diff_size = len(diff)
@@ -255,7 +285,7 @@ class MsgpackHashPathEncoder(PathEncoder):
                 samples_taken = 1
             else:
                 subsample_size, samples_taken = self._recursive_diff_estimate(
-                    tree1, tree2, branch_count, total_samples_to_take
+                    tree1, tree2, branch_count, total_samples_to_take, cancel_token
                 )
             total_subsample_size += subsample_size
             total_subsamples_taken += 1
@@ -268,9 +298,11 @@ class MsgpackHashPathEncoder(PathEncoder):
             total_samples_taken,
         )
 
-    def diff_estimate(self, tree1, tree2, branch_count, total_samples_to_take):
+    def diff_estimate(
+        self, tree1, tree2, branch_count, total_samples_to_take, cancel_token=None
+    ):
         diff_count, samples_taken = self._recursive_diff_estimate(
-            tree1, tree2, branch_count, total_samples_to_take
+            tree1, tree2, branch_count, total_samples_to_take, cancel_token
         )
         return int(round(diff_count))
 
@@ -298,7 +330,15 @@ class IntPathEncoder(PathEncoder):
         return f"{tree_path}/{filename}"
 
     def _recursive_depth_first_diff_estimate(
-        self, tree1, tree2, *, path, paths_fully_explored, diffs_by_path, rand
+        self,
+        tree1,
+        tree2,
+        *,
+        path,
+        paths_fully_explored,
+        diffs_by_path,
+        rand,
+        cancel_token=None,
     ):
         """
         Dives as deep as possible into the diff for the given trees, returning one
@@ -309,6 +349,8 @@ class IntPathEncoder(PathEncoder):
 
         Returns 0 if all branches at the current level have already been sampled.
         """
+        if cancel_token is not None:
+            cancel_token.check()
         try:
             diff = diffs_by_path[path]
         except KeyError:
@@ -335,6 +377,7 @@ class IntPathEncoder(PathEncoder):
                 paths_fully_explored=paths_fully_explored,
                 diffs_by_path=diffs_by_path,
                 rand=rand,
+                cancel_token=cancel_token,
             )
             if not num_features:
                 # no (new) features found in a subtree. try another subtree
@@ -355,6 +398,7 @@ class IntPathEncoder(PathEncoder):
         tree2,
         branch_count,
         total_samples_to_take,
+        cancel_token=None,
     ):
         """
         Samples some subtrees of the given two trees, and returns an estimate of the number
@@ -378,6 +422,7 @@ class IntPathEncoder(PathEncoder):
                 paths_fully_explored=paths_fully_explored,
                 diffs_by_path=diffs_by_path,
                 rand=rand,
+                cancel_token=cancel_token,
             )
             if num_features:
                 samples.append(num_features)
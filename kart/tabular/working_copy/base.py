@@ -14,7 +14,7 @@ from kart.exceptions import (
     NotYetImplemented,
 )
 from kart.key_filters import DatasetKeyFilter, FeatureKeyFilter, RepoKeyFilter
-from kart import meta_items
+from kart import meta_items, tracing
 from kart.promisor_utils import LibgitSubcode
 from kart.sqlalchemy.upsert import Upsert as upsert
 from kart.tabular.table_dataset import TableDataset
@@ -342,11 +342,13 @@ class TableWorkingCopy(WorkingCopyPart):
         )
 
     @contextlib.contextmanager
-    def session(self):
+    def session(self, bulk_load=False):
         """
         Context manager for database sessions, yields a connection object inside a transaction
 
         Calling again yields the _same_ session, the transaction/etc only happen in the outer one.
+        bulk_load=True hints that whole tables are going to be written during the session - subclasses can use it
+        to configure the connection for loading data faster, if that needs to happen before the transaction starts.
         """
         L = logging.getLogger(f"{self.__class__.__qualname__}.session")
 
@@ -358,11 +360,18 @@ class TableWorkingCopy(WorkingCopyPart):
             return
 
         L.debug("session: new...")
+        trace_span = tracing.span(
+            "working copy transaction",
+            cat="working-copy",
+            working_copy=self.__class__.__name__,
+            bulk_load=bulk_load,
+        )
         self._session = self.sessionmaker()
         try:
-            # TODO - use tidier syntax for opening transactions from sqlalchemy.
-            yield self._session
-            self._session.commit()
+            with trace_span:
+                # TODO - use tidier syntax for opening transactions from sqlalchemy.
+                yield self._session
+                self._session.commit()
         except Exception:
             self._session.rollback()
             raise
@@ -674,18 +683,12 @@ class TableWorkingCopy(WorkingCopyPart):
         find_renames = self.can_find_renames(meta_diff)
 
         with self.session() as sess:
-            r = self._execute_dirty_rows_query(sess, dataset, feature_filter, meta_diff)
-
             feature_diff = DeltaDiff()
             insert_count = delete_count = 0
 
-            for row in r:
-                track_pk = row[0]  # This is always a str
-                db_obj = {k: row[k] for k in row.keys() if k != ".__track_pk"}
-
-                if db_obj[pk_field] is None:
-                    db_obj = None
-
+            for track_pk, db_obj in self._dirty_features(
+                sess, dataset, feature_filter, meta_diff
+            ):
                 repo_obj = self._get_dataset_feature_and_fetch_if_needed(
                     dataset, track_pk
                 )
@@ -787,6 +790,94 @@ class TableWorkingCopy(WorkingCopyPart):
         else:
             return dataset.schema
 
+    # Number of tracked PKs to fetch per query when fetching dirty rows by PK.
+    DIRTY_ROWS_BATCH_SIZE = 1000
+
+    def _dirty_features(
+        self, sess, dataset, feature_filter=FeatureKeyFilter.MATCH_ALL, meta_diff=None
+    ):
+        """
+        Yields (track_pk, db_obj) for every row in the tracking table for the given dataset, where track_pk is the
+        PK as stored in the tracking table (always a str), and db_obj is the feature now in the working copy with
+        that PK - or None if there is no such feature, ie, it has been deleted.
+        """
+        schema = self._get_dataset_schema(dataset, meta_diff)
+        if (
+            self._tracking_table_requires_cast
+            and schema.pk_columns[0].data_type == "integer"
+        ):
+            # Joining the tracking table to the table on CAST(pk AS TEXT) stops the database from using the
+            # table's PK index, which makes for a full scan of a large table even if only a few rows are tracked.
+            # So instead, the tracked PKs are read first, and the rows are fetched in batches using the PK index.
+            yield from self._dirty_features_by_pk(sess, dataset, feature_filter, schema)
+            return
+
+        pk_field = dataset.schema.pk_columns[0].name
+        r = self._execute_dirty_rows_query(sess, dataset, feature_filter, meta_diff)
+        for row in r:
+            track_pk = row[0]  # This is always a str
+            db_obj = {k: row[k] for k in row.keys() if k != ".__track_pk"}
+
+            if db_obj[pk_field] is None:
+                db_obj = None
+            yield track_pk, db_obj
+
+    def _dirty_features_by_pk(self, sess, dataset, feature_filter, schema):
+        """
+        Implementation of _dirty_features for tables with integer PKs. The tracked PKs are read a page at a time,
+        in order, and each page is read in full before the matching rows are fetched - since not every driver
+        supports running one query while reading the results of another on the same connection.
+        """
+        kart_track = self.kart_tables.kart_track
+        track_pks_query = (
+            sa.select([kart_track.c.pk])
+            .where(kart_track.c.table_name == dataset.table_name)
+            .order_by(kart_track.c.pk)
+            .limit(self.DIRTY_ROWS_BATCH_SIZE)
+        )
+        if not feature_filter.match_all:
+            track_pks_query = track_pks_query.where(
+                kart_track.c.pk.in_(list(feature_filter))
+            )
+
+        table = self._table_def_for_schema(schema, dataset.table_name)
+        pk_name = schema.pk_columns[0].name
+        pk_column = table.columns[pk_name]
+
+        last_track_pk = None
+        while True:
+            query = track_pks_query
+            if last_track_pk is not None:
+                query = query.where(kart_track.c.pk > last_track_pk)
+            batch = [row[0] for row in sess.execute(query).fetchall()]
+            if not batch:
+                break
+            last_track_pk = batch[-1]
+
+            track_pks_by_pk = {}
+            for track_pk in batch:
+                try:
+                    pk = int(track_pk)
+                except ValueError:
+                    pk = None
+                # Only PKs that roundtrip exactly would have matched CAST(pk AS TEXT) in the tracking table.
+                if pk is None or str(pk) != track_pk:
+                    yield track_pk, None
+                    continue
+                track_pks_by_pk[pk] = track_pk
+            if not track_pks_by_pk:
+                continue
+
+            r = sess.execute(
+                sa.select(table.columns).where(pk_column.in_(list(track_pks_by_pk)))
+            )
+            for row in r:
+                db_obj = {k: row[k] for k in row.keys()}
+                yield track_pks_by_pk.pop(db_obj[pk_name]), db_obj
+            # Whatever is left over has been deleted from the table.
+            for track_pk in track_pks_by_pk.values():
+                yield track_pk, None
+
     def _execute_dirty_rows_query(
         self, sess, dataset, feature_filter=FeatureKeyFilter.MATCH_ALL, meta_diff=None
     ):
@@ -962,7 +1053,7 @@ class TableWorkingCopy(WorkingCopyPart):
         L = logging.getLogger(f"{self.__class__.__qualname__}.write_full")
 
         self.repo.odb.refresh()
-        with pause_refreshing(self.repo.odb), self.session() as sess:
+        with pause_refreshing(self.repo.odb), self.session(bulk_load=True) as sess:
             dataset_count = len(datasets)
             for i, dataset in enumerate(datasets):
                 click.echo(
@@ -986,17 +1077,18 @@ class TableWorkingCopy(WorkingCopyPart):
                     self._create_spatial_index_pre(sess, dataset)
 
                 L.info("Creating features...")
-                sql = self.insert_into_dataset_cmd(dataset)
                 t0 = time.monotonic()
 
-                CHUNK_SIZE = 2000
-                for row_dicts in chunk(
-                    dataset.features_with_crs_ids(
-                        self.repo.spatial_filter, show_progress=True
-                    ),
-                    CHUNK_SIZE,
+                with tracing.span(
+                    "working copy bulk load", cat="working-copy", dataset=dataset.path
                 ):
-                    sess.execute(sql, row_dicts)
+                    self._bulk_load_features(
+                        sess,
+                        dataset,
+                        dataset.features_with_crs_ids(
+                            self.repo.spatial_filter, show_progress=True
+                        ),
+                    )
 
                 if dataset.has_geometry:
                     self._create_spatial_index_post(sess, dataset)
@@ -1017,6 +1109,20 @@ class TableWorkingCopy(WorkingCopyPart):
                     dataset.path,
                 )
 
+    # The number of features written by each statement during _bulk_load_features.
+    BULK_LOAD_CHUNK_SIZE = 2000
+
+    def _bulk_load_features(self, sess, dataset, features):
+        """
+        Writes the given features into the newly created (and so, empty) table for the given dataset.
+        The tracking triggers don't exist yet, and the spatial index is only finished afterwards by
+        _create_spatial_index_post, so subclasses can override this to use whatever bulk-loading mechanism
+        the database has - the default is a multi-row INSERT for every BULK_LOAD_CHUNK_SIZE features.
+        """
+        sql = self.insert_into_dataset_cmd(dataset)
+        for row_dicts in chunk(features, self.BULK_LOAD_CHUNK_SIZE):
+            sess.execute(sql, row_dicts)
+
     def _write_meta(self, sess, dataset):
         """
         Write any non-feature data relating to dataset that is stored _outside_ the dataset table itself.
@@ -1195,7 +1301,10 @@ class TableWorkingCopy(WorkingCopyPart):
         track_changes_as_dirty=False,
         quiet=False,
     ):
-        with self.session() as sess:
+        # Every dataset is reset in the same transaction as the kart_state update (see WorkingCopyPart.reset), so that
+        # a reset that fails partway through is rolled back entirely. That's why datasets aren't reset concurrently
+        # here: separate connections would commit separately, and would contend for shared tables like kart_track.
+        with self.session(bulk_load=bool(ds_inserts)) as sess:
             # Check if the dataset is spatial, and if so, if the WC has any necessary spatial extension installed.
             self._check_for_unsupported_ds_types(sess, target_datasets)
 
@@ -1293,7 +1402,14 @@ class TableWorkingCopy(WorkingCopyPart):
         pks = list(feature_diff.keys())
         L.debug("Applying feature diff: about %s changes", len(pks))
 
-        with self._track_changes_as_dirty(sess, target_ds, track_changes_as_dirty):
+        with self._track_changes_as_dirty(
+            sess, target_ds, track_changes_as_dirty
+        ), tracing.span(
+            "working copy apply feature diff",
+            cat="working-copy",
+            dataset=target_ds.path,
+            num_changes=len(pks),
+        ):
             self._delete_features_from_dataset(sess, target_ds, pks)
             self._write_features_from_dataset(sess, target_ds, pks, ignore_missing=True)
 
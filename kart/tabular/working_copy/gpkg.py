@@ -107,14 +107,17 @@ class WorkingCopy_GPKG(TableWorkingCopy):
     def _tracking_table_requires_cast(self):
         return False
 
+    # Features are written in big batches so that each executemany reuses the same prepared statement for longer.
+    BULK_LOAD_CHUNK_SIZE = 20000
+
     @contextlib.contextmanager
-    def session(
-        self,
-    ):
+    def session(self, bulk_load=False):
         """
         Context manager for GeoPackage DB sessions, yields a connection object inside a transaction
 
         Calling again yields the _same_ connection, the transaction/etc only happen in the outer one.
+        If bulk_load is True, the outer session is run with fsync turned off and with the rollback journal
+        kept in memory, which SQLite only allows to be changed outside of a transaction.
         """
         L = logging.getLogger(f"{self.__class__.__qualname__}.session")
 
@@ -127,9 +130,15 @@ class WorkingCopy_GPKG(TableWorkingCopy):
 
         # Outer call - create new session:
         L.debug("session: new...")
-        self._session = self.sessionmaker()
+        # Pragmas only apply to the connection they are set on, so a bulk-load session is bound to a connection of its
+        # own - otherwise, the session would release its connection when committing, before the pragmas are restored.
+        bulk_load_conn = self.engine.connect() if bulk_load else None
+        self._session = self.sessionmaker(bind=bulk_load_conn or self.engine)
+        restore_pragmas = None
 
         try:
+            if bulk_load:
+                restore_pragmas = self._set_bulk_load_pragmas(bulk_load_conn)
             # TODO - use tidier syntax for opening transactions from sqlalchemy.
             self._session.execute("BEGIN TRANSACTION;")
             yield self._session
@@ -141,8 +150,39 @@ class WorkingCopy_GPKG(TableWorkingCopy):
         finally:
             self._session.close()
             del self._session
+            if bulk_load_conn is not None:
+                try:
+                    if restore_pragmas:
+                        self._restore_pragmas(bulk_load_conn, restore_pragmas)
+                finally:
+                    bulk_load_conn.close()
             L.debug("session: new/done")
 
+    def _set_bulk_load_pragmas(self, conn):
+        """
+        Configures the given connection for writing whole tables, and returns the previous pragma values.
+        The journal isn't turned off completely - the session still needs to be able to roll back if
+        writing fails or is interrupted - but keeping it in memory means the file is only written once.
+        A WAL journal is left as it is, since it already avoids writing everything twice.
+        Fewer fsyncs are done (synchronous is NORMAL, rather than OFF). However, since the journal isn't on disk,
+        if kart crashes or the power is lost partway through writing, the GPKG can't be rolled back and may be
+        left corrupt - if so, it can be recreated using `kart create-workingcopy --delete-existing`.
+        """
+        previous = {
+            "synchronous": conn.scalar("PRAGMA synchronous;"),
+            "journal_mode": conn.scalar("PRAGMA journal_mode;"),
+        }
+        conn.execute("PRAGMA synchronous = NORMAL;")
+        if previous["journal_mode"].lower() == "wal":
+            del previous["journal_mode"]
+        else:
+            conn.execute("PRAGMA journal_mode = MEMORY;")
+        return previous
+
+    def _restore_pragmas(self, conn, pragmas):
+        for name, value in pragmas.items():
+            conn.execute(f"PRAGMA {name} = {value};")
+
     def delete(self, keep_db_schema_if_possible=False):
         """Delete the working copy files."""
         self.full_path.unlink()
@@ -444,11 +484,12 @@ class WorkingCopy_GPKG(TableWorkingCopy):
         table = GpkgTables.gpkg_metadata
         sess.execute(sa.delete(table).where(table.c.id.in_(ids)))
 
-    def _create_spatial_index_pre(self, sess, dataset):
-        # Implementing only _create_spatial_index_pre:
-        # gpkgAddSpatialIndex has to be called before writing any features,
-        # since it only adds on-write triggers to update the index - it doesn't
-        # add any pre-existing features to the index.
+    def _create_spatial_index_post(self, sess, dataset):
+        # Implementing only _create_spatial_index_post:
+        # gpkgAddSpatialIndex only adds on-write triggers to update the index - it doesn't
+        # add any pre-existing features to the index - so once it has been called, the
+        # features that have already been written are indexed all at once. This is much
+        # faster than having the triggers update the index for every feature written.
 
         # Generally, there shouldn't be an existing spatial index at this stage.
         # But if there is, we should clean it up and start over.
@@ -465,6 +506,18 @@ class WorkingCopy_GPKG(TableWorkingCopy):
             "SELECT gpkgAddSpatialIndex(:table, :geom);",
             {"table": dataset.table_name, "geom": geom_col},
         )
+        # This is the same as what the insert trigger does for each feature.
+        rtree_table = f"rtree_{dataset.table_name}_{geom_col}"
+        quoted_geom_col = self.quote(geom_col)
+        sess.execute(
+            f"""
+            INSERT OR REPLACE INTO {self.quote(rtree_table)}
+            SELECT ROWID, ST_MinX({quoted_geom_col}), ST_MaxX({quoted_geom_col}),
+                ST_MinY({quoted_geom_col}), ST_MaxY({quoted_geom_col})
+            FROM {self.table_identifier(dataset)}
+            WHERE {quoted_geom_col} NOT NULL AND NOT ST_IsEmpty({quoted_geom_col});
+            """
+        )
 
         L.info("Created spatial index in %.1fs", time.monotonic() - t0)
 
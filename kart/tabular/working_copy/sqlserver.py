@@ -42,12 +42,19 @@ class WorkingCopy_SqlServer(DatabaseServer_WorkingCopy):
         self.connect_uri, self.db_schema = separate_last_path_part(self.uri)
 
         self.adapter = KartAdapter_SqlServer
-        self.engine = self.adapter.create_engine(self.connect_uri)
+        # fast_executemany sends all the rows of an executemany to the server as a single array of parameters,
+        # rather than doing a round-trip to the server for every row.
+        self.engine = self.adapter.create_engine(
+            self.connect_uri, fast_executemany=True
+        )
         self.sessionmaker = sessionmaker(bind=self.engine)
         self.preparer = MSIdentifierPreparer(self.engine.dialect)
 
         self.kart_tables = SqlServerKartTables(self.db_schema, repo.is_kart_branded)
 
+    # With fast_executemany, each chunk of features is sent to the server all at once.
+    BULK_LOAD_CHUNK_SIZE = 10000
+
     def _create_table_for_dataset(self, sess, dataset):
         table_spec = self.adapter.v2_schema_to_sql_spec(dataset.schema, dataset)
         sess.execute(
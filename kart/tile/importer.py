@@ -1,3 +1,4 @@
+import collections
 import concurrent.futures
 from functools import cached_property
 import glob
@@ -49,7 +50,7 @@ from kart.tabular.version import (
     SUPPORTED_VERSIONS,
     extra_blobs_for_version,
 )
-from kart.utils import get_num_available_cores
+from kart.utils import get_available_memory, get_num_available_cores
 from kart.working_copy import PartType
 
 
@@ -678,6 +679,7 @@ class TileImporter:
         Calls copy_or_convert on each TileSource in tile_sources, which causes each tile to be simply copied
         from its source into the LFS cache, or converted (if self.convert_to_cloud_optimized is True) with
         the converted result placed in the LFS cache.
+        Yields (source, imported_metadata) for each tile, in the same order as tile_sources.
         """
         # Single-threaded variant - uses the calling thread.
         if self.num_workers == 1:
@@ -686,15 +688,64 @@ class TileImporter:
             return
 
         # Multi-worker variant - uses a thread-pool, calling thread just receives the results.
+        # The work is done in PDAL / GDAL, outside of the GIL, so threads do run in parallel. However, converting
+        # a tile can need a lot of memory, so tiles are only started while the total memory they are estimated to
+        # need fits within the memory budget - except that one tile is always allowed to run, however large it is.
+        memory_budget = self.get_memory_budget()
+        not_started = collections.deque(tile_sources)
+        running = {}  # {future: estimated memory use}
+        started_in_order = collections.deque()
         with concurrent.futures.ThreadPoolExecutor(
             max_workers=self.num_workers
         ) as executor:
-            future_to_source = {
-                executor.submit(source.copy_or_convert, self): source
-                for source in tile_sources
-            }
-            for future in concurrent.futures.as_completed(future_to_source):
-                yield future_to_source[future], future.result()
+            while not_started or started_in_order:
+                while not_started and len(running) < self.num_workers:
+                    memory = self.estimate_copy_or_convert_memory(not_started[0])
+                    if (
+                        running
+                        and memory_budget is not None
+                        and sum(running.values()) + memory > memory_budget
+                    ):
+                        break
+                    source = not_started.popleft()
+                    future = executor.submit(source.copy_or_convert, self)
+                    running[future] = memory
+                    started_in_order.append((source, future))
+
+                while started_in_order and started_in_order[0][1].done():
+                    source, future = started_in_order.popleft()
+                    yield source, future.result()
+
+                if running:
+                    done, _ = concurrent.futures.wait(
+                        running, return_when=concurrent.futures.FIRST_COMPLETED
+                    )
+                    for future in done:
+                        del running[future]
+
+    # The proportion of the available memory that imports will try to stay within - see get_memory_budget.
+    MEMORY_BUDGET_FRACTION = 0.5
+
+    def get_memory_budget(self):
+        """
+        Returns the amount of memory in bytes that the concurrent tile conversions should try to stay within,
+        or None for no limit. Can be set in MiB using KART_IMPORT_MEMORY_BUDGET.
+        """
+        try:
+            return int(os.environ["KART_IMPORT_MEMORY_BUDGET"]) * 1024 * 1024
+        except (KeyError, ValueError):
+            pass
+        available_memory = get_available_memory()
+        if available_memory is None:
+            return None
+        return int(available_memory * self.MEMORY_BUDGET_FRACTION)
+
+    def estimate_copy_or_convert_memory(self, tile_source):
+        """
+        Returns an estimate of how much memory in bytes will be needed to copy or convert the given tile -
+        see copy_or_convert_multiple_tiles. Copying a tile needs very little memory, so the default is zero.
+        """
+        return 0
 
     def write_meta_blobs_to_stream(self, stream, merged_metadata):
         """Writes the format.json, schema.json and crs.wkt meta items to the dataset."""
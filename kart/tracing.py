@@ -0,0 +1,146 @@
+import contextlib
+import json
+import logging
+import os
+import sys
+import threading
+import time
+
+try:
+    import fcntl
+except ImportError:
+    # Windows - there's no helper mode, so processes don't often write to the same trace at the same time.
+    fcntl = None
+
+L = logging.getLogger(__name__)
+
+# Setting KART_TRACE to a filename turns on tracing: every span - a named, timed stage of a Kart command, such as a git
+# subprocess or a working copy transaction - is appended to that file as a Chrome trace event, so the file can be
+# opened in https://ui.perfetto.dev or chrome://tracing to see a timeline of where a command spent its time.
+# The helper launcher (cli_helper/kart.c) appends its own spans to the same file - keep the file format in sync.
+#
+# The file is a JSON array that is never closed - each event is followed by ",\n" - which the trace viewers accept,
+# and which lets any number of processes append to the same file. Timestamps are microseconds since the epoch,
+# so that spans from different processes line up. Events are appended to any existing trace in the file, so that a
+# whole script's worth of Kart commands can be traced at once - delete the file to start a new trace.
+TRACE_ENV_VAR = "KART_TRACE"
+
+_lock = threading.Lock()
+# (pid, path) -> open trace file, or None if it couldn't be written to. Keyed by pid so that a forked child, which
+# could be tracing to a different file, opens the file for itself.
+_trace_files = {}
+
+
+def is_enabled():
+    return bool(os.environ.get(TRACE_ENV_VAR))
+
+
+def now():
+    """The current time in microseconds since the epoch - the same clock that traces use."""
+    return time.time_ns() // 1000
+
+
+def add_span(name, start, end=None, *, cat="kart", **args):
+    """
+    Records a span that has already finished, from start to end (which defaults to now) - both as returned by now().
+    Does nothing unless KART_TRACE is set. Any keyword args are shown alongside the span by trace viewers.
+    """
+    path = os.environ.get(TRACE_ENV_VAR)
+    if not path:
+        return
+    if end is None:
+        end = now()
+    event = {
+        "name": name,
+        "cat": cat,
+        "ph": "X",
+        "ts": start,
+        "dur": end - start,
+        "pid": os.getpid(),
+        "tid": threading.get_native_id(),
+    }
+    if args:
+        event["args"] = args
+    _write_event(path, event)
+
+
+@contextlib.contextmanager
+def span(name, *, cat="kart", **args):
+    """
+    Context manager that records a span for the duration of the with block, if KART_TRACE is set.
+    Yields the dict of args, so that the block can add to them - eg, the number of features it wrote.
+    """
+    if not is_enabled():
+        yield args
+        return
+    start = now()
+    try:
+        yield args
+    finally:
+        add_span(name, start, cat=cat, **args)
+
+
+def command_name(cmd):
+    """A short name for a span that runs the given subprocess - eg "git rev-list" for ["git", "-C", path, "rev-list"]"""
+    if isinstance(cmd, str):
+        cmd = cmd.split()
+    words = [os.path.basename(str(cmd[0]))]
+    skip = False
+    for arg in cmd[1:]:
+        arg = str(arg)
+        if skip:
+            skip = False
+        elif arg in ("-C", "-c"):
+            # git options that take a value - the subcommand comes after.
+            skip = True
+        elif not arg.startswith("-"):
+            words.append(arg)
+            break
+    return " ".join(words)
+
+
+def _write_event(path, event):
+    with _lock:
+        key = (os.getpid(), path)
+        if key not in _trace_files:
+            _trace_files[key] = _open_trace_file(path)
+        trace_file = _trace_files[key]
+        if trace_file is None:
+            return
+        try:
+            _append(trace_file, json.dumps(event, default=str) + ",\n")
+        except OSError as e:
+            L.warning("Can't write to %s=%s: %s", TRACE_ENV_VAR, path, e)
+            _trace_files[key] = None
+
+
+def _open_trace_file(path):
+    try:
+        trace_file = open(path, "a", encoding="utf-8")
+        # Name this process, so that the viewer can show which command each of the traced processes was running.
+        process_name = {
+            "name": "process_name",
+            "ph": "M",
+            "pid": os.getpid(),
+            "tid": threading.get_native_id(),
+            "args": {"name": " ".join(["kart", *sys.argv[1:2]])},
+        }
+        _append(trace_file, json.dumps(process_name) + ",\n")
+        return trace_file
+    except OSError as e:
+        L.warning("Can't write to %s=%s: %s", TRACE_ENV_VAR, path, e)
+        return None
+
+
+def _append(trace_file, data):
+    # Other processes may be appending to the same file - each event is written whole, while holding the lock.
+    if fcntl is not None:
+        fcntl.flock(trace_file, fcntl.LOCK_EX)
+    try:
+        if os.fstat(trace_file.fileno()).st_size == 0:
+            data = "[\n" + data
+        trace_file.write(data)
+        trace_file.flush()
+    finally:
+        if fcntl is not None:
+            fcntl.flock(trace_file, fcntl.LOCK_UN)
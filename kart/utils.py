@@ -68,3 +68,33 @@ def get_num_available_cores():
         # sched_getaffinity isn't available on some platforms (macOS mostly I think)
         # Fallback to total machine CPUs
         return float(os.cpu_count())
+
+
+def get_available_memory():
+    """
+    Returns the amount of memory available to this process in bytes (best effort)
+      * uses cgroup memory limits on Linux if available
+      * otherwise, uses total physical memory
+
+    Returns None if the amount of memory couldn't be determined.
+    """
+    result = None
+    try:
+        result = os.sysconf("SC_PAGE_SIZE") * os.sysconf("SC_PHYS_PAGES")
+    except (AttributeError, ValueError, OSError):
+        pass
+
+    if platform.system() == "Linux":
+        for limit_path in (
+            "/sys/fs/cgroup/memory.max",  # cgroup v2
+            "/sys/fs/cgroup/memory/memory.limit_in_bytes",  # cgroup v1
+        ):
+            try:
+                limit = Path(limit_path).read_text().strip()
+            except OSError:
+                continue
+            # "max" (or a number larger than physical memory) means no limit is set.
+            if limit.isdigit() and (result is None or int(limit) < result):
+                result = int(limit)
+            break
+    return result
@@ -6,6 +6,8 @@ from enum import Enum, auto
 import functools
 import shutil
 import sys
+import threading
+import time
 from kart.structure import RepoStructure
 
 import pygit2
@@ -22,13 +24,18 @@ from kart.exceptions import (
     NO_WORKING_COPY,
     translate_subprocess_exit_code,
 )
-from kart.lfs_util import get_local_path_from_lfs_oid, dict_to_pointer_file_bytes
+from kart.lfs_util import (
+    get_hash_from_pointer_file,
+    get_local_path_from_lfs_oid,
+    dict_to_pointer_file_bytes,
+)
 from kart.lfs_commands import fetch_lfs_blobs_for_pointer_files
 from kart.key_filters import RepoKeyFilter
 from kart.output_util import InputMode, get_input_mode
 from kart.reflink_util import try_reflink
 from kart.sqlalchemy import TableSet
 from kart.sqlalchemy.sqlite import sqlite_engine
+from kart.sqlalchemy.upsert import Upsert as upsert
 from kart import subprocess_util as subprocess
 from kart.tile import ALL_TILE_DATASET_TYPES
 from kart.tile.tile_dataset import TileDataset
@@ -63,11 +70,45 @@ class WorkdirKartTables(TableSet):
             sa.Column("value", sa.Text, nullable=False),
         )
 
+        # The stat info of files in the workdir that were found to be clean - see FileSystemWorkingCopy.dirty_paths
+        self.kart_stat_cache = sa.Table(
+            "kart_stat_cache",
+            self.sqlalchemy_metadata,
+            sa.Column("path", sa.Text, nullable=False, primary_key=True),
+            sa.Column("size", sa.Integer, nullable=False),
+            sa.Column("mtime_ns", sa.Integer, nullable=False),
+            sa.Column("inode", sa.Integer, nullable=False),
+            sa.Column("lfs_oid", sa.Text, nullable=True),
+        )
+
 
 # Makes it so WorkdirKartTables table definitions are also accessible at the WorkdirKartTables class itself:
 WorkdirKartTables.copy_tables_to_class()
 
 
+class SynchronizedIndex:
+    """
+    Wraps a pygit2.Index so that it can be updated by several threads at once - as happens when several datasets
+    are being written to the workdir at once. Every method call holds the same lock.
+    """
+
+    def __init__(self, index):
+        self._index = index
+        self._lock = threading.RLock()
+
+    def __getattr__(self, name):
+        attr = getattr(self._index, name)
+        if not callable(attr):
+            return attr
+
+        @functools.wraps(attr)
+        def synchronized(*args, **kwargs):
+            with self._lock:
+                return attr(*args, **kwargs)
+
+        return synchronized
+
+
 class FileSystemWorkingCopy(WorkingCopyPart):
     """
     A working copy on the filesystem - also referred to as the "workdir" for brevity.
@@ -93,6 +134,9 @@ class FileSystemWorkingCopy(WorkingCopyPart):
     def __str__(self):
         return "file-system working copy"
 
+    # Each dataset is written to its own directory, so several can be reset at once.
+    MAX_RESET_WORKERS = 4
+
     def __init__(self, repo):
         super().__init__()
 
@@ -190,6 +234,9 @@ class FileSystemWorkingCopy(WorkingCopyPart):
         sm = sessionmaker(bind=engine)
         with sm() as s:
             s.execute(CreateTable(self.kart_tables.kart_state, if_not_exists=True))
+            s.execute(
+                CreateTable(self.kart_tables.kart_stat_cache, if_not_exists=True)
+            )
 
     def delete(self):
         """Deletes the index file and state table, and attempts to clean up any datasets in the workdir itself."""
@@ -244,6 +291,7 @@ class FileSystemWorkingCopy(WorkingCopyPart):
         Automatically writes it on close, as long as no exception is thrown.
 
         Calling again yields the _same_ session, writing only happens when the outer one is closed.
+        The index is wrapped in a SynchronizedIndex, so the session can be shared by several threads.
         """
         L = logging.getLogger(f"{self.__class__.__qualname__}.workdir_index_session")
 
@@ -255,7 +303,7 @@ class FileSystemWorkingCopy(WorkingCopyPart):
             return
 
         L.debug("workdir_index_session: new...")
-        self._workdir_index = pygit2.Index(self.index_path)
+        self._workdir_index = SynchronizedIndex(pygit2.Index(self.index_path))
 
         try:
             yield self._workdir_index
@@ -359,9 +407,10 @@ class FileSystemWorkingCopy(WorkingCopyPart):
                 self.delete_datasets_from_workdir(
                     [base_datasets[d] for d in ds_deletes], workdir_index
                 )
+            # Each dataset that is written or updated is in a directory of its own, so they are done concurrently.
             if ds_inserts:
                 self.write_full_datasets_to_workdir(
-                    [target_datasets[d] for d in ds_inserts], workdir_index
+                    [target_datasets[d] for d in sorted(ds_inserts)], workdir_index
                 )
             # Update the working copy with files that have changed:
             kart_attachments = os.environ.get("X_KART_ATTACHMENTS")
@@ -371,14 +420,17 @@ class FileSystemWorkingCopy(WorkingCopyPart):
                         base_tree, target_tree, workdir_index, track_changes_as_dirty
                     )
 
-            for ds_path in ds_updates:
-                self._update_dataset_in_workdir(
+            self._run_dataset_tasks(
+                functools.partial(
+                    self._update_dataset_in_workdir,
                     target_datasets[ds_path],
                     update_diffs[ds_path],
                     workdir_index,
                     ds_filter=repo_key_filter[ds_path],
                     track_changes_as_dirty=track_changes_as_dirty,
                 )
+                for ds_path in sorted(ds_updates)
+            )
 
     def write_attached_files_to_workdir(
         self, base_tree, target_tree, workdir_index, track_changes_as_dirty=False
@@ -471,36 +523,63 @@ class FileSystemWorkingCopy(WorkingCopyPart):
     def write_full_datasets_to_workdir(
         self, datasets, workdir_index, track_changes_as_dirty=False
     ):
-        write_to_index = not track_changes_as_dirty
+        self._run_dataset_tasks(
+            self._write_full_dataset_tasks(
+                datasets, workdir_index, track_changes_as_dirty
+            )
+        )
 
+    def _write_full_dataset_tasks(
+        self, datasets, workdir_index, track_changes_as_dirty=False
+    ):
+        """Returns a list of tasks for _run_dataset_tasks, each of which writes one of the given datasets in full."""
         dataset_count = len(datasets)
-        for i, dataset in enumerate(datasets):
-            assert isinstance(dataset, TileDataset)
-
-            click.echo(
+        # Progress bars from several threads at once would be interleaved - only show them if there's just one.
+        show_progress = self.MAX_RESET_WORKERS <= 1 or dataset_count <= 1
+        return [
+            functools.partial(
+                self._write_full_dataset_to_workdir,
+                dataset,
+                workdir_index,
                 f"Writing tiles for dataset {i+1} of {dataset_count}: {dataset.path}",
-                err=True,
+                track_changes_as_dirty=track_changes_as_dirty,
+                show_progress=show_progress,
             )
+            for i, dataset in enumerate(datasets)
+        ]
 
-            if write_to_index:
-                workdir_index.remove_all([f"{dataset.path}/**"])
+    def _write_full_dataset_to_workdir(
+        self,
+        dataset,
+        workdir_index,
+        progress_message,
+        track_changes_as_dirty=False,
+        show_progress=True,
+    ):
+        assert isinstance(dataset, TileDataset)
+        write_to_index = not track_changes_as_dirty
 
-            wc_tiles_dir = self.path / dataset.path
-            (wc_tiles_dir).mkdir(parents=True, exist_ok=True)
+        click.echo(progress_message, err=True)
 
-            for pointer_blob, pointer_dict in dataset.tile_pointer_blobs_and_dicts(
-                self.repo.spatial_filter,
-                show_progress=True,
-            ):
-                pointer_dict["name"] = dataset.set_tile_extension(
-                    pointer_blob.name, tile_format=pointer_dict.get("format")
-                )
-                self._write_tile_or_pam_file_to_workdir(
-                    dataset,
-                    pointer_dict,
-                    workdir_index,
-                    write_to_index=write_to_index,
-                )
+        if write_to_index:
+            workdir_index.remove_all([f"{dataset.path}/**"])
+
+        wc_tiles_dir = self.path / dataset.path
+        (wc_tiles_dir).mkdir(parents=True, exist_ok=True)
+
+        for pointer_blob, pointer_dict in dataset.tile_pointer_blobs_and_dicts(
+            self.repo.spatial_filter,
+            show_progress=show_progress,
+        ):
+            pointer_dict["name"] = dataset.set_tile_extension(
+                pointer_blob.name, tile_format=pointer_dict.get("format")
+            )
+            self._write_tile_or_pam_file_to_workdir(
+                dataset,
+                pointer_dict,
+                workdir_index,
+                write_to_index=write_to_index,
+            )
 
         self.write_mosaic_for_dataset(dataset)
 
@@ -853,33 +932,174 @@ class FileSystemWorkingCopy(WorkingCopyPart):
         assert isinstance(dataset, TileDataset)
         dataset.write_mosaic_for_directory((self.path / dataset.path).resolve())
 
+    # If the paths of the files that need to be checked are longer than this in total, git diff checks the whole
+    # workdir, instead of being given a pathspec for each one (which could make the command line too long).
+    MAX_PATHSPEC_LENGTH_FOR_DIFF = 16 * 1024
+
+    # Files are only added to the stat cache if they were last modified at least this long before they were found to
+    # be clean - otherwise, they could be modified again within the same mtime tick without their stat changing.
+    STAT_CACHE_RACY_NS = 2_000_000_000
+
     def dirty_paths(self):
+        """
+        Returns the paths of all the files in the workdir that are not the same as in the workdir-index.
+        Only files that don't match the stat info in kart_stat_cache are checked by git diff - which can involve
+        re-hashing them if their stat info differs from that in the index. A file that is found to be clean is added
+        to kart_stat_cache, so if nothing changes, the next time dirty_paths is called no files are checked at all.
+        """
         env_overrides = {"GIT_INDEX_FILE": str(self.index_path)}
 
+        index_entries = {e.path: e for e in pygit2.Index(str(self.index_path))}
+        stat_cache = self._read_stat_cache(index_entries)
+        stats_to_check = {}
+        for path in index_entries:
+            stat = self._stat_for_stat_cache(path)
+            if stat is None or stat_cache.get(path, (None,))[:3] != stat:
+                stats_to_check[path] = stat
+
         try:
-            # This finds all files in the index that have been modified - and updates any mtimes in the index
-            # if the mtimes are stale but the files are actually unchanged (as in GIT_DIFF_UPDATE_INDEX).
-            cmd = ["git", "diff", "--name-only"]
-            output_lines = (
-                subprocess.check_output(
+            dirty_paths = []
+            if stats_to_check:
+                # This finds all files in the index that have been modified - and updates any mtimes in the index
+                # if the mtimes are stale but the files are actually unchanged (as in GIT_DIFF_UPDATE_INDEX).
+                cmd = ["git", "--literal-pathspecs", "diff", "--name-only", "-z"]
+                if sum(map(len, stats_to_check)) <= self.MAX_PATHSPEC_LENGTH_FOR_DIFF:
+                    cmd += ["--", *stats_to_check]
+                dirty_paths += subprocess.check_output(
                     cmd, env_overrides=env_overrides, encoding="utf-8", cwd=self.path
+                ).split("\0")
+            # This finds all untracked files that are not in the index.
+            cmd = ["git", "ls-files", "--others", "--exclude-standard", "-z"]
+            dirty_paths += subprocess.check_output(
+                cmd, env_overrides=env_overrides, encoding="utf-8", cwd=self.path
+            ).split("\0")
+        except subprocess.CalledProcessError as e:
+            sys.exit(translate_subprocess_exit_code(e.returncode))
+
+        dirty_paths = [p.replace("\\", "/") for p in dirty_paths if p]
+        self._update_stat_cache(index_entries, stat_cache, stats_to_check, dirty_paths)
+        return dirty_paths
+
+    def _stat_for_stat_cache(self, path):
+        """Returns (size, mtime_ns, inode) for the file at the given workdir path, or None if there is no file."""
+        try:
+            stat = os.lstat(self.path / path)
+        except OSError:
+            return None
+        # Inodes are unsigned 64-bit numbers, but sqlite integers are signed.
+        return stat.st_size, stat.st_mtime_ns, stat.st_ino & 0x7FFFFFFFFFFFFFFF
+
+    def _index_checksum(self):
+        # Every index file ends with a checksum of its contents.
+        with open(self.index_path, "rb") as f:
+            f.seek(-20, os.SEEK_END)
+            return f.read().hex()
+
+    def _read_stat_cache(self, index_entries):
+        """
+        Returns the contents of kart_stat_cache as a dict {path: (size, mtime_ns, inode, lfs_oid)}.
+        If the index has been rewritten since the stat cache was last updated, the stat cache may refer to files that
+        are now supposed to have different contents - so only the tiles that the index still points to the same LFS
+        object for are returned, since checking out a commit often leaves most tiles as they were.
+        """
+        stat_cache = self.kart_tables.kart_stat_cache
+        stat_cache_index = self.get_kart_state_value("*", "stat-cache-index")
+        if stat_cache_index is None:
+            return {}
+        with self.state_session() as sess:
+            r = sess.execute(
+                sa.select(
+                    [
+                        stat_cache.c.path,
+                        stat_cache.c.size,
+                        stat_cache.c.mtime_ns,
+                        stat_cache.c.inode,
+                        stat_cache.c.lfs_oid,
+                    ]
                 )
-                .strip()
-                .splitlines()
             )
-            # This finds all untracked files that are not in the index.
-            cmd = ["git", "ls-files", "--others", "--exclude-standard"]
-            output_lines += (
-                subprocess.check_output(
-                    cmd, env_overrides=env_overrides, encoding="utf-8", cwd=self.path
+            result = {row[0]: tuple(row[1:]) for row in r}
+
+        if stat_cache_index != self._index_checksum():
+            result = {
+                path: cached
+                for path, cached in result.items()
+                if cached[3] is not None
+                and path in index_entries
+                and self._lfs_oid_for_index_entry(index_entries[path]) == cached[3]
+            }
+        return result
+
+    def _update_stat_cache(
+        self, index_entries, stat_cache, stats_to_check, dirty_paths
+    ):
+        """Updates kart_stat_cache to contain every file in the index that has just been checked and is clean."""
+        dirty_paths = set(dirty_paths)
+        index_checksum = self._index_checksum()
+        index_changed = (
+            self.get_kart_state_value("*", "stat-cache-index") != index_checksum
+        )
+        if not stats_to_check and not dirty_paths.intersection(stat_cache):
+            if not index_changed:
+                # Nothing to update - this is the usual case when nothing has changed.
+                return
+
+        racy_ns = time.time_ns() - self.STAT_CACHE_RACY_NS
+        rows = []
+        for path, stat in stats_to_check.items():
+            if stat is None or path in dirty_paths or stat[1] >= racy_ns:
+                continue
+            rows.append(
+                {
+                    "path": path,
+                    "size": stat[0],
+                    "mtime_ns": stat[1],
+                    "inode": stat[2],
+                    "lfs_oid": self._lfs_oid_for_index_entry(index_entries[path]),
+                }
+            )
+        paths_to_delete = [
+            p for p in stat_cache if p not in index_entries or p in dirty_paths
+        ]
+        if index_changed:
+            # Only the rows from stat_cache are still valid - see _read_stat_cache - so the rest are cleared out.
+            paths_to_delete = []
+            rows += [
+                {
+                    "path": path,
+                    "size": size,
+                    "mtime_ns": mtime_ns,
+                    "inode": inode,
+                    "lfs_oid": lfs_oid,
+                }
+                for path, (size, mtime_ns, inode, lfs_oid) in stat_cache.items()
+                if path not in stats_to_check and path not in dirty_paths
+            ]
+
+        kart_state = self.kart_tables.kart_state
+        kart_stat_cache = self.kart_tables.kart_stat_cache
+        with self.state_session() as sess:
+            sess.execute(CreateTable(kart_stat_cache, if_not_exists=True))
+            if index_changed:
+                sess.execute(sa.delete(kart_stat_cache))
+            for path in paths_to_delete:
+                sess.execute(
+                    sa.delete(kart_stat_cache).where(kart_stat_cache.c.path == path)
                 )
-                .strip()
-                .splitlines()
+            if rows:
+                sess.execute(upsert(kart_stat_cache), rows)
+            sess.execute(
+                upsert(kart_state),
+                {
+                    "table_name": "*",
+                    "key": "stat-cache-index",
+                    "value": index_checksum,
+                },
             )
-        except subprocess.CalledProcessError as e:
-            sys.exit(translate_subprocess_exit_code(e.returncode))
 
-        return [p.replace("\\", "/") for p in output_lines]
+    def _lfs_oid_for_index_entry(self, index_entry):
+        blob = self.repo.get(index_entry.id)
+        return get_hash_from_pointer_file(blob) if blob is not None else None
 
     def dirty_paths_by_dataset_path(self, dirty_paths=None):
         """Returns all the deltas from self.raw_diff_from_index() but grouped by dataset path."""
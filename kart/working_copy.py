@@ -1,3 +1,4 @@
+import concurrent.futures
 import contextlib
 import logging
 from enum import Enum, auto
@@ -419,6 +420,36 @@ class WorkingCopyPart:
         """The dataset type or types that this working copy supports."""
         raise NotImplementedError()
 
+    # The maximum number of datasets that _run_dataset_tasks works on at once. Subclasses where each dataset is stored
+    # independently of the others - eg, in its own directory - and which needn't reset them all in one transaction,
+    # can increase this.
+    MAX_RESET_WORKERS = 1
+
+    def _run_dataset_tasks(self, tasks):
+        """
+        Runs the given tasks - callables that each work on a single dataset, independently of each other - using up to
+        MAX_RESET_WORKERS threads, or just using the calling thread if that is 1 or if there is only one task.
+        If a task raises an exception, the tasks that haven't started yet are cancelled, and the exception is re-raised
+        once the tasks that have started are finished.
+        """
+        tasks = list(tasks)
+        if self.MAX_RESET_WORKERS <= 1 or len(tasks) <= 1:
+            for task in tasks:
+                task()
+            return
+
+        with concurrent.futures.ThreadPoolExecutor(
+            max_workers=min(self.MAX_RESET_WORKERS, len(tasks))
+        ) as executor:
+            futures = [executor.submit(task) for task in tasks]
+            try:
+                for future in concurrent.futures.as_completed(futures):
+                    future.result()
+            except BaseException:
+                for future in futures:
+                    future.cancel()
+                raise
+
     def check_not_dirty(self, help_message=None):
         """Raises an InvalidOperation if this working-copy part is dirty."""
         if not self.is_dirty():
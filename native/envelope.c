@@ -0,0 +1,313 @@
+#include "kart_native.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Batch versions of kart.spatial_filter.index.EnvelopeEncoder.
+ *
+ * An envelope is (w, s, e, n) in degrees. Each value is scaled to an unsigned
+ * integer of BITS_PER_VALUE bits - w & s are rounded down, e & n are rounded up -
+ * and the four values are concatenated into BITS_PER_VALUE / 2 bytes, big-endian.
+ * The arithmetic here is the same as the Python code step for step, so that the
+ * results are identical.
+ */
+
+#define MAX_BITS_PER_VALUE 32
+
+// envelopes are unpacked into this many at a time before being tested for intersection
+#define INTERSECT_CHUNK_LEN 256
+
+struct envelope_format
+{
+    unsigned bits_per_value;
+    Py_ssize_t bytes_per_envelope;
+    uint32_t value_max;
+};
+
+static int init_format(struct envelope_format *fmt, int bits_per_value)
+{
+    if (bits_per_value <= 0 || bits_per_value > MAX_BITS_PER_VALUE || bits_per_value % 2 != 0)
+    {
+        PyErr_Format(PyExc_ValueError, "Unsupported bits_per_value: %d", bits_per_value);
+        return -1;
+    }
+    fmt->bits_per_value = (unsigned)bits_per_value;
+    fmt->bytes_per_envelope = bits_per_value / 2;
+    fmt->value_max = (uint32_t)((UINT64_C(1) << bits_per_value) - 1);
+    return 0;
+}
+
+static void pack_envelope(const struct envelope_format *fmt, const uint32_t values[4], unsigned char *out)
+{
+    uint64_t acc = 0;
+    unsigned nbits = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        acc = (acc << fmt->bits_per_value) | values[i];
+        nbits += fmt->bits_per_value;
+        while (nbits >= 8)
+        {
+            nbits -= 8;
+            *out++ = (unsigned char)(acc >> nbits);
+        }
+    }
+}
+
+static void unpack_envelope(const struct envelope_format *fmt, const unsigned char *in, uint32_t values[4])
+{
+    uint64_t acc = 0;
+    unsigned nbits = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        while (nbits < fmt->bits_per_value)
+        {
+            acc = (acc << 8) | *in++;
+            nbits += 8;
+        }
+        nbits -= fmt->bits_per_value;
+        values[i] = (uint32_t)(acc >> nbits) & fmt->value_max;
+    }
+}
+
+static int encode_value(const struct envelope_format *fmt, double value, double min_value, double max_value,
+                        int round_up, uint32_t *result)
+{
+    // written so that NaN fails the check too
+    if (!(value >= min_value && value <= max_value))
+    {
+        PyErr_Format(PyExc_ValueError, "Envelope value out of range [%d, %d]", (int)min_value, (int)max_value);
+        return -1;
+    }
+    double normalised = (value - min_value) / (max_value - min_value);
+    double scaled = normalised * (double)fmt->value_max;
+    *result = (uint32_t)(round_up ? ceil(scaled) : floor(scaled));
+    return 0;
+}
+
+static double decode_value(const struct envelope_format *fmt, uint32_t encoded, double min_value, double max_value)
+{
+    double normalised = (double)encoded / (double)fmt->value_max;
+    return normalised * (max_value - min_value) + min_value;
+}
+
+PyObject *kart_encode_envelopes(PyObject *self, PyObject *args)
+{
+    int bits_per_value;
+    PyObject *envelopes;
+    struct envelope_format fmt;
+
+    if (!PyArg_ParseTuple(args, "iO:encode_envelopes", &bits_per_value, &envelopes))
+        return NULL;
+    if (init_format(&fmt, bits_per_value) < 0)
+        return NULL;
+
+    PyObject *seq = PySequence_Fast(envelopes, "envelopes must be a sequence");
+    if (seq == NULL)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject *result = PyBytes_FromStringAndSize(NULL, count * fmt.bytes_per_envelope);
+    if (result == NULL)
+        goto error;
+
+    unsigned char *out = (unsigned char *)PyBytes_AS_STRING(result);
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        PyObject *envelope = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i), "envelope must be a sequence");
+        if (envelope == NULL)
+            goto error;
+        if (PySequence_Fast_GET_SIZE(envelope) != 4)
+        {
+            Py_DECREF(envelope);
+            PyErr_SetString(PyExc_ValueError, "envelope must be (w, s, e, n)");
+            goto error;
+        }
+
+        double w = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(envelope, 0));
+        double s = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(envelope, 1));
+        double e = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(envelope, 2));
+        double n = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(envelope, 3));
+        Py_DECREF(envelope);
+        if (PyErr_Occurred())
+            goto error;
+
+        uint32_t values[4];
+        if (encode_value(&fmt, w, -180, 180, 0, &values[0]) < 0 || encode_value(&fmt, s, -90, 90, 0, &values[1]) < 0 ||
+            encode_value(&fmt, e, -180, 180, 1, &values[2]) < 0 || encode_value(&fmt, n, -90, 90, 1, &values[3]) < 0)
+            goto error;
+
+        pack_envelope(&fmt, values, out);
+        out += fmt.bytes_per_envelope;
+    }
+
+    Py_DECREF(seq);
+    return result;
+
+error:
+    Py_XDECREF(result);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+static int get_envelope_buffer(const struct envelope_format *fmt, PyObject *obj, Py_buffer *view)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_SIMPLE) < 0)
+        return -1;
+    if (view->len % fmt->bytes_per_envelope != 0)
+    {
+        PyErr_Format(PyExc_ValueError, "Buffer length %zd is not a multiple of the envelope length %zd", view->len,
+                     fmt->bytes_per_envelope);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+PyObject *kart_decode_envelopes(PyObject *self, PyObject *args)
+{
+    int bits_per_value;
+    PyObject *buffer;
+    struct envelope_format fmt;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "iO:decode_envelopes", &bits_per_value, &buffer))
+        return NULL;
+    if (init_format(&fmt, bits_per_value) < 0)
+        return NULL;
+    if (get_envelope_buffer(&fmt, buffer, &view) < 0)
+        return NULL;
+
+    Py_ssize_t count = view.len / fmt.bytes_per_envelope;
+    PyObject *result = PyList_New(count);
+    if (result == NULL)
+        goto done;
+
+    const unsigned char *in = (const unsigned char *)view.buf;
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        uint32_t values[4];
+        unpack_envelope(&fmt, in, values);
+        in += fmt.bytes_per_envelope;
+
+        PyObject *envelope = Py_BuildValue(
+            "(dddd)", decode_value(&fmt, values[0], -180, 180), decode_value(&fmt, values[1], -90, 90),
+            decode_value(&fmt, values[2], -180, 180), decode_value(&fmt, values[3], -90, 90));
+        if (envelope == NULL)
+        {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, i, envelope);
+    }
+
+done:
+    PyBuffer_Release(&view);
+    return result;
+}
+
+/*
+ * Sets hits[i] to 1 if the i-th encoded envelope in buf intersects the (unpacked) query envelope.
+ * Envelopes where w > e cross the anti-meridian. The comparisons are inclusive, since encoded
+ * envelopes have been rounded outwards and so a zero-width envelope is still meaningful.
+ * The inner loop works on a chunk of unpacked values and is branch-free so that it can be vectorised.
+ */
+static void intersect_envelopes(const struct envelope_format *fmt, const uint32_t query[4], const unsigned char *buf,
+                                Py_ssize_t count, unsigned char *hits)
+{
+    uint32_t w[INTERSECT_CHUNK_LEN], s[INTERSECT_CHUNK_LEN], e[INTERSECT_CHUNK_LEN], n[INTERSECT_CHUNK_LEN];
+    const uint32_t qw = query[0], qs = query[1], qe = query[2], qn = query[3];
+    const unsigned char q_wraps = qw > qe;
+
+    for (Py_ssize_t start = 0; start < count; start += INTERSECT_CHUNK_LEN)
+    {
+        Py_ssize_t len = count - start < INTERSECT_CHUNK_LEN ? count - start : INTERSECT_CHUNK_LEN;
+
+        for (Py_ssize_t i = 0; i < len; i++)
+        {
+            uint32_t values[4];
+            unpack_envelope(fmt, buf, values);
+            buf += fmt->bytes_per_envelope;
+            w[i] = values[0];
+            s[i] = values[1];
+            e[i] = values[2];
+            n[i] = values[3];
+        }
+
+        unsigned char *chunk_hits = hits + start;
+        for (Py_ssize_t i = 0; i < len; i++)
+        {
+            unsigned char wraps = w[i] > e[i];
+            unsigned char west_of_qe = w[i] <= qe;
+            unsigned char east_of_qw = e[i] >= qw;
+            // If neither range wraps, both ends must overlap. If either wraps, either end overlapping will do -
+            // and if both wrap, they both contain the anti-meridian.
+            unsigned char lon = (west_of_qe & east_of_qw) | ((wraps | q_wraps) & (west_of_qe | east_of_qw | (wraps & q_wraps)));
+            unsigned char lat = (s[i] <= qn) & (n[i] >= qs);
+            chunk_hits[i] = lon & lat;
+        }
+    }
+}
+
+PyObject *kart_intersecting_envelopes(PyObject *self, PyObject *args)
+{
+    int bits_per_value;
+    PyObject *query_obj, *buffer;
+    struct envelope_format fmt;
+    Py_buffer query_view, view;
+    PyObject *result = NULL;
+
+    if (!PyArg_ParseTuple(args, "iOO:intersecting_envelopes", &bits_per_value, &query_obj, &buffer))
+        return NULL;
+    if (init_format(&fmt, bits_per_value) < 0)
+        return NULL;
+    if (get_envelope_buffer(&fmt, query_obj, &query_view) < 0)
+        return NULL;
+    if (query_view.len != fmt.bytes_per_envelope)
+    {
+        PyErr_SetString(PyExc_ValueError, "query must be a single encoded envelope");
+        PyBuffer_Release(&query_view);
+        return NULL;
+    }
+    uint32_t query[4];
+    unpack_envelope(&fmt, (const unsigned char *)query_view.buf, query);
+    PyBuffer_Release(&query_view);
+
+    if (get_envelope_buffer(&fmt, buffer, &view) < 0)
+        return NULL;
+
+    Py_ssize_t count = view.len / fmt.bytes_per_envelope;
+    unsigned char *hits = malloc(count ? count : 1);
+    if (hits == NULL)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    intersect_envelopes(&fmt, query, (const unsigned char *)view.buf, count, hits);
+    Py_END_ALLOW_THREADS;
+
+    result = PyList_New(0);
+    if (result == NULL)
+        goto done;
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        if (!hits[i])
+            continue;
+        PyObject *index = PyLong_FromSsize_t(i);
+        if (index == NULL || PyList_Append(result, index) < 0)
+        {
+            Py_XDECREF(index);
+            Py_CLEAR(result);
+            goto done;
+        }
+        Py_DECREF(index);
+    }
+
+done:
+    free(hits);
+    PyBuffer_Release(&view);
+    return result;
+}
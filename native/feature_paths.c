@@ -0,0 +1,546 @@
+#include "kart_native.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A batch version of PathEncoder.encode_pks_to_path - see kart.tabular.v3_paths.
+ *
+ * Each feature's PK values are msgpacked exactly as kart.serialise_util.msg_pack does it, then the feature path is
+ * built from the packed PK: either from its SHA-256 hash ("msgpack/hash" scheme) or from the single integer PK value
+ * ("int" scheme), followed by the packed PK itself, urlsafe-base64 encoded. Only the PK types that msg_pack handles
+ * without a default - None, bool, int, float, str and bytes, in a list or tuple - are supported. Anything else, or
+ * anything that encode_pks_to_path would raise an error for, raises ValueError, so that the caller can fall back to
+ * the Python code.
+ */
+
+static const char HEX_ALPHABET[] = "0123456789abcdef";
+static const char BASE64_URLSAFE_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// A path is never longer than this - the hash part is at most 40 characters, plus separators.
+#define MAX_PATH_PREFIX_LEN 256
+
+static int unsupported(const char *message)
+{
+    PyErr_SetString(PyExc_ValueError, message);
+    return -1;
+}
+
+/* SHA-256 - FIPS 180-4. */
+
+struct sha256
+{
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t block_len;
+};
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(struct sha256 *h, const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h->state[0], b = h->state[1], c = h->state[2], d = h->state[3];
+    uint32_t e = h->state[4], f = h->state[5], g = h->state[6], hh = h->state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = hh + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h->state[0] += a;
+    h->state[1] += b;
+    h->state[2] += c;
+    h->state[3] += d;
+    h->state[4] += e;
+    h->state[5] += f;
+    h->state[6] += g;
+    h->state[7] += hh;
+}
+
+static void sha256_digest(const unsigned char *data, size_t len, unsigned char digest[32])
+{
+    struct sha256 h = {{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+                        0x5be0cd19},
+                       0,
+                       {0},
+                       0};
+    h.length = (uint64_t)len * 8;
+    while (len >= 64)
+    {
+        sha256_compress(&h, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(h.block, data, len);
+    h.block_len = len;
+    h.block[h.block_len++] = 0x80;
+    if (h.block_len > 56)
+    {
+        memset(h.block + h.block_len, 0, 64 - h.block_len);
+        sha256_compress(&h, h.block);
+        h.block_len = 0;
+    }
+    memset(h.block + h.block_len, 0, 56 - h.block_len);
+    for (int i = 0; i < 8; i++)
+        h.block[56 + i] = (unsigned char)(h.length >> (56 - 8 * i));
+    sha256_compress(&h, h.block);
+    for (int i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (unsigned char)(h.state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(h.state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(h.state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)h.state[i];
+    }
+}
+
+/* Base64 - RFC 3548 section 4, with padding, like base64.urlsafe_b64encode. */
+
+static size_t base64_encoded_len(size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
+
+static void base64_encode(const unsigned char *data, size_t len, char *out)
+{
+    const char *alphabet = BASE64_URLSAFE_ALPHABET;
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3)
+    {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = alphabet[(v >> 6) & 63];
+        *out++ = alphabet[v & 63];
+    }
+    if (len - i == 1)
+    {
+        uint32_t v = (uint32_t)data[i] << 16;
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = '=';
+        *out++ = '=';
+    }
+    else if (len - i == 2)
+    {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8);
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = alphabet[(v >> 6) & 63];
+        *out++ = '=';
+    }
+}
+
+/* Msgpack - only the subset of the format that msg_pack produces for PK values. */
+
+struct buffer
+{
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static int buffer_reserve(struct buffer *buf, size_t extra)
+{
+    if (buf->len + extra <= buf->capacity)
+        return 0;
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->len + extra)
+        capacity *= 2;
+    unsigned char *data = PyMem_Realloc(buf->data, capacity);
+    if (data == NULL)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return 0;
+}
+
+// Appends the type byte followed by the low num_bytes bytes of value, big-endian.
+static int pack_header(struct buffer *buf, unsigned char type, uint64_t value, int num_bytes)
+{
+    if (buffer_reserve(buf, 1 + num_bytes) < 0)
+        return -1;
+    buf->data[buf->len++] = type;
+    for (int i = num_bytes - 1; i >= 0; i--)
+        buf->data[buf->len++] = (unsigned char)(value >> (8 * i));
+    return 0;
+}
+
+static int pack_raw(struct buffer *buf, const char *data, size_t len)
+{
+    if (buffer_reserve(buf, len) < 0)
+        return -1;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+// Packs a non-negative integer using the smallest unsigned format, as msgpack does.
+static int pack_uint(struct buffer *buf, uint64_t value)
+{
+    if (value < 0x80)
+        return pack_header(buf, (unsigned char)value, 0, 0);
+    if (value <= 0xff)
+        return pack_header(buf, 0xcc, value, 1);
+    if (value <= 0xffff)
+        return pack_header(buf, 0xcd, value, 2);
+    if (value <= 0xffffffff)
+        return pack_header(buf, 0xce, value, 4);
+    return pack_header(buf, 0xcf, value, 8);
+}
+
+// Packs a negative integer using the smallest signed format, as msgpack does.
+static int pack_negative_int(struct buffer *buf, int64_t value)
+{
+    if (value >= -32)
+        return pack_header(buf, (unsigned char)(int8_t)value, 0, 0);
+    if (value >= INT8_MIN)
+        return pack_header(buf, 0xd0, (uint64_t)value, 1);
+    if (value >= INT16_MIN)
+        return pack_header(buf, 0xd1, (uint64_t)value, 2);
+    if (value >= INT32_MIN)
+        return pack_header(buf, 0xd2, (uint64_t)value, 4);
+    return pack_header(buf, 0xd3, (uint64_t)value, 8);
+}
+
+/*
+ * Reads an int that msgpack can pack - in the range of int64 or uint64. Sets *is_negative, and either *value (for a
+ * non-negative int) or *negative_value.
+ */
+static int read_int(PyObject *obj, int *is_negative, uint64_t *value, int64_t *negative_value)
+{
+    int overflow;
+    long long v = PyLong_AsLongLongAndOverflow(obj, &overflow);
+    if (v == -1 && PyErr_Occurred())
+        return -1;
+    if (overflow < 0)
+        return unsupported("Integer PK value is out of range");
+    if (overflow > 0)
+    {
+        unsigned long long u = PyLong_AsUnsignedLongLong(obj);
+        if (u == (unsigned long long)-1 && PyErr_Occurred())
+        {
+            PyErr_Clear();
+            return unsupported("Integer PK value is out of range");
+        }
+        *is_negative = 0;
+        *value = u;
+        return 0;
+    }
+    *is_negative = v < 0;
+    if (v < 0)
+        *negative_value = v;
+    else
+        *value = (uint64_t)v;
+    return 0;
+}
+
+static int pack_pk_value(struct buffer *buf, PyObject *obj)
+{
+    if (obj == Py_None)
+        return pack_header(buf, 0xc0, 0, 0);
+    if (obj == Py_True)
+        return pack_header(buf, 0xc3, 0, 0);
+    if (obj == Py_False)
+        return pack_header(buf, 0xc2, 0, 0);
+    if (PyLong_CheckExact(obj))
+    {
+        int is_negative;
+        uint64_t value = 0;
+        int64_t negative_value = 0;
+        if (read_int(obj, &is_negative, &value, &negative_value) < 0)
+            return -1;
+        return is_negative ? pack_negative_int(buf, negative_value) : pack_uint(buf, value);
+    }
+    if (PyFloat_CheckExact(obj))
+    {
+        double d = PyFloat_AS_DOUBLE(obj);
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return pack_header(buf, 0xcb, bits, 8);
+    }
+    if (PyUnicode_CheckExact(obj))
+    {
+        Py_ssize_t len;
+        const char *data = PyUnicode_AsUTF8AndSize(obj, &len);
+        if (data == NULL)
+            return -1;
+        int status = len < 32        ? pack_header(buf, (unsigned char)(0xa0 | len), 0, 0)
+                     : len <= 0xff   ? pack_header(buf, 0xd9, (uint64_t)len, 1)
+                     : len <= 0xffff ? pack_header(buf, 0xda, (uint64_t)len, 2)
+                                     : pack_header(buf, 0xdb, (uint64_t)len, 4);
+        return status < 0 ? -1 : pack_raw(buf, data, (size_t)len);
+    }
+    if (PyBytes_CheckExact(obj))
+    {
+        Py_ssize_t len = PyBytes_GET_SIZE(obj);
+        int status = len <= 0xff     ? pack_header(buf, 0xc4, (uint64_t)len, 1)
+                     : len <= 0xffff ? pack_header(buf, 0xc5, (uint64_t)len, 2)
+                                     : pack_header(buf, 0xc6, (uint64_t)len, 4);
+        return status < 0 ? -1 : pack_raw(buf, PyBytes_AS_STRING(obj), (size_t)len);
+    }
+    return unsupported("Unsupported PK value type");
+}
+
+static int pack_pk_values(struct buffer *buf, PyObject *seq)
+{
+    Py_ssize_t num_values = PySequence_Fast_GET_SIZE(seq);
+    if (num_values > 0xffffffff)
+        return unsupported("Too many PK values");
+    int status = num_values < 16       ? pack_header(buf, (unsigned char)(0x90 | num_values), 0, 0)
+                 : num_values <= 0xffff ? pack_header(buf, 0xdc, (uint64_t)num_values, 2)
+                                        : pack_header(buf, 0xdd, (uint64_t)num_values, 4);
+    if (status < 0)
+        return -1;
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t i = 0; i < num_values; i++)
+    {
+        if (pack_pk_value(buf, items[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Paths */
+
+struct path_format
+{
+    int int_scheme;
+    int hex_encoding;
+    const char *alphabet;
+    unsigned base;
+    Py_ssize_t levels;
+    Py_ssize_t group_length;
+    uint64_t branches;
+    uint64_t max_trees;
+};
+
+// Writes the path prefix for the msgpack/hash scheme - see MsgpackHashPathEncoder.encode_pks_to_path.
+static Py_ssize_t hash_path_prefix(const struct path_format *fmt, const struct buffer *packed, char *out)
+{
+    unsigned char digest[32];
+    sha256_digest(packed->data, packed->len, digest);
+
+    // hexhash and b64hash both use only the first 160 bits of the hash.
+    char pk_hash[40];
+    Py_ssize_t hash_len;
+    if (fmt->hex_encoding)
+    {
+        for (int i = 0; i < 20; i++)
+        {
+            pk_hash[i * 2] = HEX_ALPHABET[digest[i] >> 4];
+            pk_hash[i * 2 + 1] = HEX_ALPHABET[digest[i] & 15];
+        }
+        hash_len = 40;
+    }
+    else
+    {
+        base64_encode(digest, 20, pk_hash);
+        hash_len = (Py_ssize_t)base64_encoded_len(20);
+    }
+
+    // The same as joining pk_hash[i * group_length : (i + 1) * group_length] for each level, with Python's slicing.
+    Py_ssize_t len = 0;
+    for (Py_ssize_t i = 0; i < fmt->levels; i++)
+    {
+        for (Py_ssize_t j = i * fmt->group_length; j < (i + 1) * fmt->group_length && j < hash_len; j++)
+            out[len++] = pk_hash[j];
+        out[len++] = '/';
+    }
+    return len;
+}
+
+// Writes the path prefix for the int scheme - see IntPathEncoder.encode_pks_to_path.
+static Py_ssize_t int_path_prefix(const struct path_format *fmt, PyObject *seq, char *out)
+{
+    if (PySequence_Fast_GET_SIZE(seq) != 1)
+        return unsupported("IntPathEncoder can only encode a single integer value");
+    PyObject *obj = PySequence_Fast_ITEMS(seq)[0];
+    if (!PyLong_CheckExact(obj))
+        return unsupported("IntPathEncoder can only encode a single integer value");
+
+    int is_negative;
+    uint64_t value = 0;
+    int64_t negative_value = 0;
+    if (read_int(obj, &is_negative, &value, &negative_value) < 0)
+        return -1;
+
+    // (pk // branches) % max_trees, with Python's floor division and modulo.
+    uint64_t tree_index;
+    if (is_negative)
+    {
+        uint64_t magnitude = (uint64_t)(-(negative_value + 1)) + 1;
+        uint64_t quotient = (magnitude + fmt->branches - 1) / fmt->branches; // -(pk // branches)
+        uint64_t remainder = quotient % fmt->max_trees;
+        tree_index = remainder ? fmt->max_trees - remainder : 0;
+    }
+    else
+        tree_index = (value / fmt->branches) % fmt->max_trees;
+
+    Py_ssize_t length = fmt->levels * fmt->group_length;
+    if (length == 0)
+    {
+        // The tree path is empty - just the separator before the file name.
+        out[0] = '/';
+        return 1;
+    }
+    Py_ssize_t len = length + fmt->levels;
+    for (Py_ssize_t i = 0; i < length; i++)
+    {
+        Py_ssize_t digit_pos = length - 1 - i;
+        out[digit_pos + digit_pos / fmt->group_length] = fmt->alphabet[tree_index % fmt->base];
+        tree_index /= fmt->base;
+    }
+    for (Py_ssize_t level = 1; level <= fmt->levels; level++)
+        out[level * (fmt->group_length + 1) - 1] = '/';
+    return len;
+}
+
+static PyObject *encode_path(const struct path_format *fmt, PyObject *pk_values, struct buffer *packed,
+                             struct buffer *path)
+{
+    if (!PyList_CheckExact(pk_values) && !PyTuple_CheckExact(pk_values))
+    {
+        unsupported("PK values should be a list or tuple");
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast(pk_values, "PK values should be a list or tuple");
+    if (seq == NULL)
+        return NULL;
+
+    PyObject *result = NULL;
+    packed->len = 0;
+    if (pack_pk_values(packed, seq) < 0)
+        goto done;
+
+    path->len = 0;
+    if (buffer_reserve(path, MAX_PATH_PREFIX_LEN + base64_encoded_len(packed->len)) < 0)
+        goto done;
+    Py_ssize_t prefix_len = fmt->int_scheme ? int_path_prefix(fmt, seq, (char *)path->data)
+                                            : hash_path_prefix(fmt, packed, (char *)path->data);
+    if (prefix_len < 0)
+        goto done;
+    base64_encode(packed->data, packed->len, (char *)path->data + prefix_len);
+    path->len = prefix_len + base64_encoded_len(packed->len);
+    result = PyUnicode_DecodeASCII((const char *)path->data, (Py_ssize_t)path->len, NULL);
+
+done:
+    Py_DECREF(seq);
+    return result;
+}
+
+static int init_path_format(struct path_format *fmt, const char *scheme, const char *encoding, Py_ssize_t levels,
+                            Py_ssize_t branches, Py_ssize_t group_length)
+{
+    if (strcmp(scheme, "int") == 0)
+        fmt->int_scheme = 1;
+    else if (strcmp(scheme, "msgpack/hash") == 0)
+        fmt->int_scheme = 0;
+    else
+        return unsupported("Unsupported path scheme");
+
+    if (strcmp(encoding, "hex") == 0)
+    {
+        fmt->hex_encoding = 1;
+        fmt->alphabet = HEX_ALPHABET;
+    }
+    else if (strcmp(encoding, "base64") == 0)
+    {
+        fmt->hex_encoding = 0;
+        fmt->alphabet = BASE64_URLSAFE_ALPHABET;
+    }
+    else
+        return unsupported("Unsupported path encoding");
+    fmt->base = (unsigned)strlen(fmt->alphabet);
+
+    if (levels < 0 || branches <= 0 || group_length < 0 || (levels + 1) * (group_length + 1) > MAX_PATH_PREFIX_LEN)
+        return unsupported("Unsupported path structure");
+    fmt->levels = levels;
+    fmt->group_length = group_length;
+    fmt->branches = (uint64_t)branches;
+
+    // max_trees = branches ** levels - it has to fit in 64 bits, to do the arithmetic for the int scheme.
+    fmt->max_trees = 1;
+    for (Py_ssize_t i = 0; i < levels; i++)
+    {
+        if (fmt->max_trees > UINT64_MAX / fmt->branches)
+            return unsupported("Unsupported path structure");
+        fmt->max_trees *= fmt->branches;
+    }
+    return 0;
+}
+
+PyObject *kart_encode_feature_paths(PyObject *self, PyObject *args)
+{
+    PyObject *pk_values_list;
+    const char *scheme, *encoding;
+    Py_ssize_t levels, branches, group_length;
+    if (!PyArg_ParseTuple(args, "Ossnnn:encode_feature_paths", &pk_values_list, &scheme, &encoding, &levels,
+                          &branches, &group_length))
+        return NULL;
+
+    struct path_format fmt;
+    if (init_path_format(&fmt, scheme, encoding, levels, branches, group_length) < 0)
+        return NULL;
+
+    PyObject *seq = PySequence_Fast(pk_values_list, "Expected a sequence of PK values");
+    if (seq == NULL)
+        return NULL;
+    Py_ssize_t num_features = PySequence_Fast_GET_SIZE(seq);
+    PyObject *result = PyList_New(num_features);
+    struct buffer packed = {NULL, 0, 0}, path = {NULL, 0, 0};
+    if (result == NULL)
+        goto error;
+
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t i = 0; i < num_features; i++)
+    {
+        PyObject *encoded = encode_path(&fmt, items[i], &packed, &path);
+        if (encoded == NULL)
+            goto error;
+        PyList_SET_ITEM(result, i, encoded);
+    }
+
+    PyMem_Free(packed.data);
+    PyMem_Free(path.data);
+    Py_DECREF(seq);
+    return result;
+
+error:
+    PyMem_Free(packed.data);
+    PyMem_Free(path.data);
+    Py_XDECREF(result);
+    Py_DECREF(seq);
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#include "kart_native.h"
+
+static PyMethodDef kart_native_methods[] = {
+    {"encode_envelopes", kart_encode_envelopes, METH_VARARGS,
+     "encode_envelopes(bits_per_value, envelopes) -> bytes\n\n"
+     "Encodes a sequence of (w, s, e, n) envelopes, concatenated into a single bytes object."},
+    {"decode_envelopes", kart_decode_envelopes, METH_VARARGS,
+     "decode_envelopes(bits_per_value, buffer) -> list\n\n"
+     "Decodes a buffer of concatenated encoded envelopes into a list of (w, s, e, n) tuples."},
+    {"intersecting_envelopes", kart_intersecting_envelopes, METH_VARARGS,
+     "intersecting_envelopes(bits_per_value, query, buffer) -> list\n\n"
+     "Returns the indexes of the encoded envelopes in buffer that intersect the encoded envelope query."},
+    {"wkb_envelope", kart_wkb_envelope, METH_VARARGS,
+     "wkb_envelope(wkb, offset=0) -> (envelope, end_offset)\n\n"
+     "Walks the ISO WKB geometry at offset, returning its envelope (or None if it is empty) and where it ends."},
+    {"wkb_to_little_endian", kart_wkb_to_little_endian, METH_VARARGS,
+     "wkb_to_little_endian(wkb, offset=0) -> bytes\n\n"
+     "Returns the ISO WKB geometry at offset converted to little-endian WKB."},
+    {"diff_raw_trees", kart_diff_raw_trees, METH_VARARGS,
+     "diff_raw_trees(tree_a, tree_b) -> (blob_count, subtree_pairs)\n\n"
+     "Compares two raw git tree objects, returning the number of non-tree entries that differ, and a list of\n"
+     "(oid_a, oid_b) pairs for the subtrees that differ - either oid is None if the subtree is missing."},
+    {"encode_feature_paths", kart_encode_feature_paths, METH_VARARGS,
+     "encode_feature_paths(pk_values_list, scheme, encoding, levels, branches, group_length) -> list\n\n"
+     "Returns the feature path for each of the given lists of PK values, the same as PathEncoder.encode_pks_to_path."},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef kart_native_module = {
+    PyModuleDef_HEAD_INIT,
+    "_kart_native",
+    "Compiled accelerators for Kart - see kart/native.py",
+    -1,
+    kart_native_methods};
+
+PyMODINIT_FUNC PyInit__kart_native(void)
+{
+    if (PyType_Ready(&OidSetType) < 0)
+        return NULL;
+
+    PyObject *module = PyModule_Create(&kart_native_module);
+    if (module == NULL)
+        return NULL;
+
+    Py_INCREF(&OidSetType);
+    if (PyModule_AddObject(module, "OidSet", (PyObject *)&OidSetType) < 0)
+    {
+        Py_DECREF(&OidSetType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
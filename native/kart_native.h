@@ -0,0 +1,31 @@
+#ifndef KART_NATIVE_H
+#define KART_NATIVE_H
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+/*
+ * Compiled versions of some of Kart's hot loops. Each of these has a pure-Python
+ * reference implementation which is used if this module isn't available - see
+ * kart/native.py - and the two must give identical results.
+ */
+
+// envelope.c - see kart.spatial_filter.index.EnvelopeEncoder
+PyObject *kart_encode_envelopes(PyObject *self, PyObject *args);
+PyObject *kart_decode_envelopes(PyObject *self, PyObject *args);
+PyObject *kart_intersecting_envelopes(PyObject *self, PyObject *args);
+
+// oid_set.c - see kart.rev_list_objects
+extern PyTypeObject OidSetType;
+
+// wkb.c - see kart.geometry._walk_wkb_envelope
+PyObject *kart_wkb_envelope(PyObject *self, PyObject *args);
+PyObject *kart_wkb_to_little_endian(PyObject *self, PyObject *args);
+
+// tree_diff.c - see kart.diff_estimation.diff_raw_trees
+PyObject *kart_diff_raw_trees(PyObject *self, PyObject *args);
+
+// feature_paths.c - see kart.tabular.v3_paths.PathEncoder.encode_pks_to_paths
+PyObject *kart_encode_feature_paths(PyObject *self, PyObject *args);
+
+#endif
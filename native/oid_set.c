@@ -0,0 +1,167 @@
+#include "kart_native.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * OidSet - a set of git object IDs (20 byte SHA-1s), for the same use as a set of bytes.
+ *
+ * The oids are stored inline in an open-addressing hash table with linear probing, so each
+ * one takes 20 bytes (or 40 at the maximum load factor) rather than the ~100 bytes needed by
+ * a bytes object in a Python set. SHA-1s are already uniformly distributed, so the hash is
+ * just the first 8 bytes of the oid. An all-zero slot is empty, so the all-zero oid - which
+ * git never actually uses - is tracked separately.
+ */
+
+#define OID_LEN 20
+#define OID_SET_MIN_CAPACITY 1024
+
+typedef struct
+{
+    PyObject_HEAD
+    unsigned char *slots;
+    size_t capacity; // always a power of two
+    size_t count;
+    int has_zero_oid;
+} OidSetObject;
+
+static const unsigned char ZERO_OID[OID_LEN] = {0};
+
+static size_t oid_hash(const unsigned char *oid)
+{
+    uint64_t h;
+    memcpy(&h, oid, sizeof(h));
+    return (size_t)h;
+}
+
+// Returns the slot for this oid - either the slot it is in, or the empty slot where it belongs.
+static unsigned char *find_slot(unsigned char *slots, size_t capacity, const unsigned char *oid)
+{
+    size_t mask = capacity - 1;
+    size_t i = oid_hash(oid) & mask;
+    while (1)
+    {
+        unsigned char *slot = slots + i * OID_LEN;
+        if (memcmp(slot, oid, OID_LEN) == 0 || memcmp(slot, ZERO_OID, OID_LEN) == 0)
+            return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+static int grow(OidSetObject *self)
+{
+    size_t new_capacity = self->capacity ? self->capacity * 2 : OID_SET_MIN_CAPACITY;
+    unsigned char *new_slots = calloc(new_capacity, OID_LEN);
+    if (new_slots == NULL)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t i = 0; i < self->capacity; i++)
+    {
+        const unsigned char *oid = self->slots + i * OID_LEN;
+        if (memcmp(oid, ZERO_OID, OID_LEN) != 0)
+            memcpy(find_slot(new_slots, new_capacity, oid), oid, OID_LEN);
+    }
+    free(self->slots);
+    self->slots = new_slots;
+    self->capacity = new_capacity;
+    return 0;
+}
+
+static int get_oid(PyObject *obj, Py_buffer *view)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_SIMPLE) < 0)
+        return -1;
+    if (view->len != OID_LEN)
+    {
+        PyErr_Format(PyExc_ValueError, "oid must be %d bytes, not %zd", OID_LEN, view->len);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+static int oid_set_contains(PyObject *obj, PyObject *key)
+{
+    OidSetObject *self = (OidSetObject *)obj;
+    Py_buffer view;
+    if (get_oid(key, &view) < 0)
+        return -1;
+
+    int result;
+    if (memcmp(view.buf, ZERO_OID, OID_LEN) == 0)
+        result = self->has_zero_oid;
+    else
+        result = self->capacity && memcmp(find_slot(self->slots, self->capacity, view.buf), ZERO_OID, OID_LEN) != 0;
+
+    PyBuffer_Release(&view);
+    return result;
+}
+
+static PyObject *oid_set_add(PyObject *obj, PyObject *key)
+{
+    OidSetObject *self = (OidSetObject *)obj;
+    Py_buffer view;
+    if (get_oid(key, &view) < 0)
+        return NULL;
+
+    if (memcmp(view.buf, ZERO_OID, OID_LEN) == 0)
+    {
+        self->has_zero_oid = 1;
+        PyBuffer_Release(&view);
+        Py_RETURN_NONE;
+    }
+
+    // keep the load factor at or below 1/2
+    if ((self->count + 1) * 2 > self->capacity && grow(self) < 0)
+    {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    unsigned char *slot = find_slot(self->slots, self->capacity, view.buf);
+    if (memcmp(slot, ZERO_OID, OID_LEN) == 0)
+    {
+        memcpy(slot, view.buf, OID_LEN);
+        self->count++;
+    }
+
+    PyBuffer_Release(&view);
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t oid_set_len(PyObject *obj)
+{
+    OidSetObject *self = (OidSetObject *)obj;
+    return (Py_ssize_t)(self->count + self->has_zero_oid);
+}
+
+static void oid_set_dealloc(PyObject *obj)
+{
+    OidSetObject *self = (OidSetObject *)obj;
+    free(self->slots);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyMethodDef oid_set_methods[] = {
+    {"add", oid_set_add, METH_O, "add(oid)\n\nAdds a 20 byte oid to the set."},
+    {NULL, NULL, 0, NULL}};
+
+static PySequenceMethods oid_set_as_sequence = {
+    .sq_length = oid_set_len,
+    .sq_contains = oid_set_contains,
+};
+
+PyTypeObject OidSetType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_kart_native.OidSet",
+    .tp_doc = "A compact set of git object IDs, each given as 20 bytes.",
+    .tp_basicsize = sizeof(OidSetObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_dealloc = oid_set_dealloc,
+    .tp_methods = oid_set_methods,
+    .tp_as_sequence = &oid_set_as_sequence,
+};
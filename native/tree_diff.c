@@ -0,0 +1,165 @@
+#include "kart_native.h"
+
+#include <string.h>
+
+/*
+ * Compares two raw git tree objects entry by entry - see kart.diff_estimation.diff_raw_trees.
+ *
+ * A raw tree is a sequence of "<octal mode> <name>\0<20 byte oid>" entries, sorted by name,
+ * where a subtree's name sorts as if it had a trailing "/". Both trees are walked in step and
+ * only the modes and oids of entries with matching names are compared, so subtrees that are
+ * unchanged are skipped without being read, and no Python objects are created for names.
+ */
+
+#define OID_LEN 20
+#define TREE_MODE 040000
+
+struct tree_entry
+{
+    unsigned mode;
+    const char *name;
+    size_t name_len;
+    const unsigned char *oid;
+};
+
+struct tree_reader
+{
+    const char *pos;
+    const char *end;
+};
+
+// Reads the next entry. Returns 1 if an entry was read, 0 at the end of the tree, and -1 on error.
+static int next_entry(struct tree_reader *reader, struct tree_entry *entry)
+{
+    if (reader->pos == reader->end)
+        return 0;
+
+    const char *p = reader->pos;
+    unsigned mode = 0;
+    while (p < reader->end && *p >= '0' && *p <= '7')
+        mode = (mode << 3) | (unsigned)(*p++ - '0');
+    if (p == reader->pos || p == reader->end || *p != ' ')
+        goto invalid;
+    const char *name = ++p;
+    const char *nul = memchr(name, '\0', reader->end - name);
+    if (nul == NULL || nul == name || reader->end - (nul + 1) < OID_LEN)
+        goto invalid;
+
+    entry->mode = mode;
+    entry->name = name;
+    entry->name_len = nul - name;
+    entry->oid = (const unsigned char *)(nul + 1);
+    reader->pos = nul + 1 + OID_LEN;
+    return 1;
+
+invalid:
+    PyErr_SetString(PyExc_ValueError, "Invalid tree object");
+    return -1;
+}
+
+static int is_tree(const struct tree_entry *entry)
+{
+    return entry->mode == TREE_MODE;
+}
+
+// Compares two entries in git's tree order.
+static int compare_entries(const struct tree_entry *a, const struct tree_entry *b)
+{
+    size_t len = a->name_len < b->name_len ? a->name_len : b->name_len;
+    int cmp = memcmp(a->name, b->name, len);
+    if (cmp)
+        return cmp;
+    unsigned char ca = len < a->name_len ? (unsigned char)a->name[len] : (is_tree(a) ? '/' : '\0');
+    unsigned char cb = len < b->name_len ? (unsigned char)b->name[len] : (is_tree(b) ? '/' : '\0');
+    return (int)ca - (int)cb;
+}
+
+// Adds (oid_a, oid_b) to the list of subtree pairs - either entry can be NULL if it is missing.
+static int append_subtree_pair(PyObject *subtree_pairs, const struct tree_entry *a, const struct tree_entry *b)
+{
+    PyObject *pair = Py_BuildValue("(y#y#)", a ? (const char *)a->oid : NULL, (Py_ssize_t)(a ? OID_LEN : 0),
+                                   b ? (const char *)b->oid : NULL, (Py_ssize_t)(b ? OID_LEN : 0));
+    if (pair == NULL)
+        return -1;
+    int result = PyList_Append(subtree_pairs, pair);
+    Py_DECREF(pair);
+    return result;
+}
+
+// Handles an entry that is only in one of the trees.
+static int one_sided_entry(PyObject *subtree_pairs, const struct tree_entry *entry, int is_a, Py_ssize_t *blob_count)
+{
+    if (!is_tree(entry))
+    {
+        (*blob_count)++;
+        return 0;
+    }
+    return is_a ? append_subtree_pair(subtree_pairs, entry, NULL) : append_subtree_pair(subtree_pairs, NULL, entry);
+}
+
+PyObject *kart_diff_raw_trees(PyObject *self, PyObject *args)
+{
+    Py_buffer view_a, view_b;
+    if (!PyArg_ParseTuple(args, "y*y*:diff_raw_trees", &view_a, &view_b))
+        return NULL;
+
+    Py_ssize_t blob_count = 0;
+    PyObject *subtree_pairs = PyList_New(0);
+    if (subtree_pairs == NULL)
+        goto error;
+
+    struct tree_reader reader_a = {view_a.buf, (const char *)view_a.buf + view_a.len};
+    struct tree_reader reader_b = {view_b.buf, (const char *)view_b.buf + view_b.len};
+    struct tree_entry a, b;
+    int has_a = next_entry(&reader_a, &a);
+    int has_b = next_entry(&reader_b, &b);
+
+    while (has_a > 0 || has_b > 0)
+    {
+        if (has_a < 0 || has_b < 0)
+            goto error;
+
+        int cmp = has_a <= 0 ? 1 : has_b <= 0 ? -1 : compare_entries(&a, &b);
+        if (cmp < 0)
+        {
+            if (one_sided_entry(subtree_pairs, &a, 1, &blob_count) < 0)
+                goto error;
+            has_a = next_entry(&reader_a, &a);
+        }
+        else if (cmp > 0)
+        {
+            if (one_sided_entry(subtree_pairs, &b, 0, &blob_count) < 0)
+                goto error;
+            has_b = next_entry(&reader_b, &b);
+        }
+        else
+        {
+            if (a.mode != b.mode || memcmp(a.oid, b.oid, OID_LEN) != 0)
+            {
+                // entries with the same name in git's tree order are either both trees, or both not trees
+                if (is_tree(&a))
+                {
+                    if (append_subtree_pair(subtree_pairs, &a, &b) < 0)
+                        goto error;
+                }
+                else
+                    blob_count++;
+            }
+            has_a = next_entry(&reader_a, &a);
+            has_b = next_entry(&reader_b, &b);
+        }
+    }
+    if (has_a < 0 || has_b < 0)
+        goto error;
+
+    PyBuffer_Release(&view_a);
+    PyBuffer_Release(&view_b);
+    PyObject *result = Py_BuildValue("(nN)", blob_count, subtree_pairs);
+    return result;
+
+error:
+    Py_XDECREF(subtree_pairs);
+    PyBuffer_Release(&view_a);
+    PyBuffer_Release(&view_b);
+    return NULL;
+}
@@ -0,0 +1,277 @@
+#include "kart_native.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A walker for ISO WKB geometries - see kart.geometry._walk_wkb_envelope.
+ *
+ * Only POINT, LINESTRING, POLYGON, their MULTI versions and GEOMETRYCOLLECTION are
+ * supported, in any of XY, XYZ, XYM and XYZM. Anything else - curves, surfaces, OGR's
+ * non-ISO type codes, mixed byte orders or dimensions, NaN coordinates - raises
+ * ValueError, so that the caller can fall back to OGR. The checks are the same as in
+ * the Python code, so that the results are identical.
+ */
+
+#define WKB_POINT 1
+#define WKB_LINESTRING 2
+#define WKB_POLYGON 3
+#define WKB_MULTIPOINT 4
+#define WKB_MULTILINESTRING 5
+#define WKB_MULTIPOLYGON 6
+#define WKB_GEOMETRYCOLLECTION 7
+
+// Deeper nesting than this isn't something that needs to be handled without OGR.
+#define MAX_DEPTH 32
+
+struct wkb_walker
+{
+    const unsigned char *buf;
+    Py_ssize_t len;
+    Py_ssize_t pos;
+    double envelope[6];
+    int has_envelope;
+    // if not NULL, a little-endian copy of the geometry is written here
+    unsigned char *out;
+};
+
+struct wkb_dims
+{
+    int byte_order;
+    int has_z;
+    int has_m;
+};
+
+static int invalid(const char *message)
+{
+    PyErr_SetString(PyExc_ValueError, message);
+    return -1;
+}
+
+static int read_uint32(struct wkb_walker *w, int byte_order, uint32_t *result)
+{
+    if (w->len - w->pos < 4)
+        return invalid("Invalid WKB");
+    const unsigned char *p = w->buf + w->pos;
+    if (byte_order)
+        *result = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    else
+        *result = (uint32_t)p[3] | ((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 24);
+    w->pos += 4;
+    if (w->out)
+    {
+        unsigned char *o = w->out + w->pos - 4;
+        for (int i = 0; i < 4; i++)
+            o[i] = (unsigned char)(*result >> (8 * i));
+    }
+    return 0;
+}
+
+static int read_double(struct wkb_walker *w, int byte_order, double *result)
+{
+    if (w->len - w->pos < 8)
+        return invalid("Invalid WKB");
+    const unsigned char *p = w->buf + w->pos;
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= (uint64_t)p[byte_order ? i : 7 - i] << (8 * i);
+    memcpy(result, &bits, sizeof(bits));
+    w->pos += 8;
+    if (w->out)
+    {
+        unsigned char *o = w->out + w->pos - 8;
+        for (int i = 0; i < 8; i++)
+            o[i] = (unsigned char)(bits >> (8 * i));
+    }
+    return 0;
+}
+
+static int walk_points(struct wkb_walker *w, const struct wkb_dims *dims, uint32_t num_points, int is_point)
+{
+    int num_values = 2 + dims->has_z + dims->has_m;
+    if ((uint64_t)num_points * num_values * 8 > (uint64_t)(w->len - w->pos))
+        return invalid("Invalid WKB");
+
+    for (uint32_t i = 0; i < num_points; i++)
+    {
+        double values[4];
+        for (int j = 0; j < num_values; j++)
+        {
+            if (read_double(w, dims->byte_order, &values[j]) < 0)
+                return -1;
+        }
+        double x = values[0], y = values[1], z = dims->has_z ? values[2] : 0.0;
+        if (is_point && isnan(x) && isnan(y))
+            continue; // POINT EMPTY - doesn't contribute to the envelope.
+        if (isnan(x) || isnan(y) || isnan(z))
+            return invalid("WKB has NaN coordinates");
+
+        double *env = w->envelope;
+        if (!w->has_envelope)
+        {
+            env[0] = env[1] = x;
+            env[2] = env[3] = y;
+            env[4] = env[5] = z;
+            w->has_envelope = 1;
+            continue;
+        }
+        if (x < env[0])
+            env[0] = x;
+        if (x > env[1])
+            env[1] = x;
+        if (y < env[2])
+            env[2] = y;
+        if (y > env[3])
+            env[3] = y;
+        if (z < env[4])
+            env[4] = z;
+        if (z > env[5])
+            env[5] = z;
+    }
+    return 0;
+}
+
+static int walk_geometry(struct wkb_walker *w, const struct wkb_dims *parent_dims, int want_type, int depth,
+                         struct wkb_dims *dims)
+{
+    if (depth > MAX_DEPTH)
+        return invalid("WKB is nested too deeply");
+    if (w->pos >= w->len)
+        return invalid("Invalid WKB");
+
+    int byte_order = w->buf[w->pos];
+    if (byte_order != 0 && byte_order != 1)
+        return invalid("Invalid WKB byte order");
+    if (w->out)
+        w->out[w->pos] = 1;
+    w->pos++;
+
+    uint32_t wkb_type;
+    if (read_uint32(w, byte_order, &wkb_type) < 0)
+        return -1;
+    uint32_t geom_type = wkb_type % 1000, iso_zm = wkb_type / 1000;
+    if (wkb_type >= 4000 || geom_type < WKB_POINT || geom_type > WKB_GEOMETRYCOLLECTION)
+    {
+        PyErr_Format(PyExc_ValueError, "Unsupported WKB geometry type %u", (unsigned)wkb_type);
+        return -1;
+    }
+    if (want_type && (int)geom_type != want_type)
+    {
+        PyErr_Format(PyExc_ValueError, "Unexpected WKB geometry type %u", (unsigned)wkb_type);
+        return -1;
+    }
+
+    dims->byte_order = byte_order;
+    dims->has_z = iso_zm == 1 || iso_zm == 3;
+    dims->has_m = iso_zm == 2 || iso_zm == 3;
+    if (parent_dims && (dims->byte_order != parent_dims->byte_order || dims->has_z != parent_dims->has_z ||
+                        dims->has_m != parent_dims->has_m))
+        return invalid("WKB has mixed byte orders or dimensions");
+
+    if (geom_type == WKB_POINT)
+        return walk_points(w, dims, 1, 1);
+
+    uint32_t count;
+    if (read_uint32(w, byte_order, &count) < 0)
+        return -1;
+
+    switch (geom_type)
+    {
+    case WKB_LINESTRING:
+        return walk_points(w, dims, count, 0);
+
+    case WKB_POLYGON:
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t num_points;
+            if (read_uint32(w, byte_order, &num_points) < 0 || walk_points(w, dims, num_points, 0) < 0)
+                return -1;
+        }
+        return 0;
+
+    default:
+    {
+        int child_type = geom_type == WKB_MULTIPOINT        ? WKB_POINT
+                         : geom_type == WKB_MULTILINESTRING ? WKB_LINESTRING
+                         : geom_type == WKB_MULTIPOLYGON    ? WKB_POLYGON
+                                                            : 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            struct wkb_dims child_dims;
+            if (walk_geometry(w, dims, child_type, depth + 1, &child_dims) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    }
+}
+
+static int start_walk(struct wkb_walker *w, Py_buffer *view, Py_ssize_t offset, struct wkb_dims *dims)
+{
+    if (offset < 0 || offset > view->len)
+        return invalid("Invalid WKB");
+    w->buf = view->buf;
+    w->len = view->len;
+    w->pos = offset;
+    w->has_envelope = 0;
+    return walk_geometry(w, NULL, 0, 0, dims);
+}
+
+PyObject *kart_wkb_envelope(PyObject *self, PyObject *args)
+{
+    Py_buffer view;
+    Py_ssize_t offset = 0;
+    if (!PyArg_ParseTuple(args, "y*|n:wkb_envelope", &view, &offset))
+        return NULL;
+
+    struct wkb_walker w = {.out = NULL};
+    struct wkb_dims dims;
+    int status = start_walk(&w, &view, offset, &dims);
+    PyBuffer_Release(&view);
+    if (status < 0)
+        return NULL;
+
+    if (!w.has_envelope)
+        return Py_BuildValue("(On)", Py_None, w.pos);
+    const double *env = w.envelope;
+    if (dims.has_z)
+        return Py_BuildValue("((dddddd)n)", env[0], env[1], env[2], env[3], env[4], env[5], w.pos);
+    return Py_BuildValue("((dddd)n)", env[0], env[1], env[2], env[3], w.pos);
+}
+
+PyObject *kart_wkb_to_little_endian(PyObject *self, PyObject *args)
+{
+    Py_buffer view;
+    Py_ssize_t offset = 0;
+    if (!PyArg_ParseTuple(args, "y*|n:wkb_to_little_endian", &view, &offset))
+        return NULL;
+
+    if (offset < 0 || offset > view.len)
+    {
+        PyBuffer_Release(&view);
+        invalid("Invalid WKB");
+        return NULL;
+    }
+
+    // The output is written at the same positions as the input, then the part before offset is dropped.
+    PyObject *out = PyBytes_FromStringAndSize(NULL, view.len);
+    if (out == NULL)
+    {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    struct wkb_walker w = {.out = (unsigned char *)PyBytes_AS_STRING(out)};
+    struct wkb_dims dims;
+    int status = start_walk(&w, &view, offset, &dims);
+    PyBuffer_Release(&view);
+    if (status < 0)
+    {
+        Py_DECREF(out);
+        return NULL;
+    }
+
+    PyObject *result = PyBytes_FromStringAndSize(PyBytes_AS_STRING(out) + offset, w.pos - offset);
+    Py_DECREF(out);
+    return result;
+}
@@ -3,6 +3,8 @@ import json
 import shutil
 import subprocess
 import textwrap
+import threading
+import time
 
 import pytest
 
@@ -14,6 +16,7 @@ from kart.exceptions import (
     NO_CHANGES,
 )
 from kart.repo import KartRepo
+from kart.tile.importer import TileImporter
 
 DUMMY_REPO = "git@example.com/example.git"
 
@@ -1177,3 +1180,39 @@ def test_point_cloud_import_from_s3__convert(
                 check_tile_is_reflinked(
                     repo_path / "auckland" / f"auckland_{x}_{y}.copc.laz", repo
                 )
+
+
+@pytest.mark.parametrize(
+    "tile_memory_mib,expected_max_concurrency", [(0, 4), (4, 2), (20, 1)]
+)
+def test_copy_or_convert_multiple_tiles_memory_budget(
+    tile_memory_mib, expected_max_concurrency, monkeypatch
+):
+    monkeypatch.setenv("KART_IMPORT_MEMORY_BUDGET", "10")
+    lock = threading.Lock()
+    concurrency = [0, 0]  # [current, max]
+
+    class FakeTileSource:
+        def __init__(self, i):
+            self.i = i
+
+        def copy_or_convert(self, importer):
+            with lock:
+                concurrency[0] += 1
+                concurrency[1] = max(concurrency)
+            # Later tiles finish first - the results should still be in order.
+            time.sleep(0.01 * (10 - self.i))
+            with lock:
+                concurrency[0] -= 1
+            return {"tile": self.i}
+
+    importer = TileImporter.__new__(TileImporter)
+    importer.num_workers = 4
+    importer.estimate_copy_or_convert_memory = (
+        lambda source: tile_memory_mib * 1024 * 1024
+    )
+
+    sources = [FakeTileSource(i) for i in range(10)]
+    results = list(importer.copy_or_convert_multiple_tiles(sources))
+    assert results == [(s, {"tile": s.i}) for s in sources]
+    assert concurrency[1] == expected_max_concurrency
@@ -1092,6 +1092,59 @@ def test_working_copy_mtime_updated(cli_runner, data_archive, requires_pdal):
             assert pygit2.hashfile(laz_file) not in repo.odb
 
 
+def test_working_copy_stat_cache(data_archive, monkeypatch):
+    with data_archive("point-cloud/auckland.tgz") as repo_path:
+        repo = KartRepo(repo_path)
+        workdir = repo.working_copy.workdir
+        # The tiles were only just extracted - don't treat them as too recently modified to be cached.
+        monkeypatch.setattr(FileSystemWorkingCopy, "STAT_CACHE_RACY_NS", 0)
+
+        orig_check_output = subprocess.check_output
+        git_diff_calls = []
+
+        def check_output(cmd, **kwargs):
+            if "diff" in cmd:
+                git_diff_calls.append(cmd)
+            return orig_check_output(cmd, **kwargs)
+
+        monkeypatch.setattr(subprocess, "check_output", check_output)
+
+        # The first time, every file has to be checked, since the stat cache is empty.
+        assert workdir.dirty_paths() == []
+        assert len(git_diff_calls) == 1
+
+        # Even if the workdir-index is stale, files are not checked again if they haven't changed.
+        for laz_file in repo_path.glob("auckland/*.laz"):
+            laz_file.touch()
+        assert workdir.dirty_paths() == []
+        assert len(git_diff_calls) == 2
+        assert workdir.dirty_paths() == []
+        assert len(git_diff_calls) == 2
+
+        # Only the modified file is checked.
+        tile_path = repo_path / "auckland" / "auckland_0_0.copc.laz"
+        with open(tile_path, "ab") as f:
+            f.write(b"x")
+        assert workdir.dirty_paths() == ["auckland/auckland_0_0.copc.laz"]
+        assert len(git_diff_calls) == 3
+        assert git_diff_calls[-1][-2:] == ["--", "auckland/auckland_0_0.copc.laz"]
+
+        # Dirty files are never cached.
+        assert workdir.dirty_paths() == ["auckland/auckland_0_0.copc.laz"]
+        assert len(git_diff_calls) == 4
+
+        # If the workdir-index is rewritten, tiles that it still points to the same LFS object for aren't checked again.
+        index = pygit2.Index(str(workdir.index_path))
+        index.remove("auckland/auckland_3_3.copc.laz")
+        index.write()
+        assert workdir.dirty_paths() == [
+            "auckland/auckland_0_0.copc.laz",
+            "auckland/auckland_3_3.copc.laz",
+        ]
+        assert len(git_diff_calls) == 5
+        assert git_diff_calls[-1][-2:] == ["--", "auckland/auckland_0_0.copc.laz"]
+
+
 def test_lfs_fetch(cli_runner, data_archive):
     with data_archive("point-cloud/auckland.tgz") as repo_path:
         # Delete everything in the local LFS cache.
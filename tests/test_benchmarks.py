@@ -0,0 +1,313 @@
+"""
+Benchmarks for Kart's performance-sensitive code paths, run against synthetic datasets so that they can be scaled up
+to whatever size is of interest.
+
+With benchmarks disabled (the default, see pytest.ini) each benchmark runs once against a small dataset, so these
+also run as ordinary tests. To actually benchmark, and to store the results for comparison against a later run:
+
+    $ pytest tests/test_benchmarks.py -p no:xdist --benchmark-enable --benchmark-autosave
+    $ pytest tests/test_benchmarks.py -p no:xdist --benchmark-enable --benchmark-compare
+
+The synthetic datasets contain $KART_BENCHMARK_FEATURES features (default 100,000) when benchmarking.
+"""
+
+import os
+import struct
+import subprocess
+import sys
+from pathlib import Path
+
+import pytest
+
+from kart import crs_util, native
+from kart.annotations import DiffAnnotations
+from kart.diff_estimation import ACCURACY_CHOICES, estimate_diff_feature_counts
+from kart.fast_import import ReplaceExisting, fast_import_tables
+from kart.geometry import Geometry
+from kart.repo import KartRepo
+from kart.spatial_filter.index import (
+    EnvelopeEncoder,
+    resolve_all_commit_refs,
+    update_spatial_filter_index,
+)
+from kart.tabular.import_source import TableImportSource
+
+is_windows = sys.platform.startswith("win")
+
+DEFAULT_BENCHMARK_FEATURES = 100_000
+# Used when benchmarks are disabled, so that the benchmarked code still runs, but quickly.
+TEST_FEATURES = 1000
+
+# Every nth feature is edited in the second commit of the synthetic repo.
+EDIT_EVERY = 10
+
+DATASET_PATH = "synthetic_points"
+
+
+class SyntheticPointsImportSource(TableImportSource):
+    """
+    A TableImportSource containing num_features points, which are a deterministic function of their fid and of
+    the given revision - rev=1 edits every EDIT_EVERY-th feature. The features are generated up front, so that
+    generating them isn't part of what is benchmarked.
+    """
+
+    SCHEMA = [
+        {
+            "id": "b3a2ec4c-b4c9-4ad2-9a67-0b2a2e0b1c01",
+            "name": "fid",
+            "dataType": "integer",
+            "primaryKeyIndex": 0,
+            "size": 64,
+        },
+        {
+            "id": "b3a2ec4c-b4c9-4ad2-9a67-0b2a2e0b1c02",
+            "name": "geom",
+            "dataType": "geometry",
+            "geometryType": "POINT",
+            "geometryCRS": "EPSG:4326",
+        },
+        {
+            "id": "b3a2ec4c-b4c9-4ad2-9a67-0b2a2e0b1c03",
+            "name": "name",
+            "dataType": "text",
+        },
+        {
+            "id": "b3a2ec4c-b4c9-4ad2-9a67-0b2a2e0b1c04",
+            "name": "value",
+            "dataType": "float",
+            "size": 64,
+        },
+    ]
+
+    def __init__(self, num_features, rev=0):
+        self.num_features = num_features
+        self.rev = rev
+        self._features = [self._make_feature(fid) for fid in range(num_features)]
+
+    def _make_feature(self, fid):
+        rev = self.rev if fid % EDIT_EVERY == 0 else 0
+        # Spread the points over the whole world, in a pattern that isn't ordered by fid.
+        x = (fid * 7919 % 36000) / 100 - 180
+        y = (fid * 104729 % 18000) / 100 - 90 + rev / 1000
+        return {
+            "fid": fid,
+            "geom": Geometry.from_wkb(struct.pack("<BIdd", 1, 1, x, y)),
+            "name": f"point {fid} rev {rev}",
+            "value": fid * 0.5 + rev,
+        }
+
+    def __str__(self):
+        return f"{self.__class__.__name__}(num_features={self.num_features}, rev={self.rev})"
+
+    def default_dest_path(self):
+        return DATASET_PATH
+
+    def meta_items(self):
+        return {
+            "title": "Synthetic points",
+            "schema.json": self.SCHEMA,
+            **{f"crs/{k}.wkt": v for k, v in self.crs_definitions().items()},
+        }
+
+    def crs_definitions(self):
+        crs = crs_util.make_crs("EPSG:4326")
+        return {"EPSG:4326": crs_util.normalise_wkt(crs.ExportToWkt())}
+
+    def align_schema_to_existing_schema(self, existing_schema):
+        # The column IDs are fixed, so the schema is already aligned with any previous import.
+        pass
+
+    def features(self):
+        return iter(self._features)
+
+    @property
+    def feature_count(self):
+        return self.num_features
+
+
+@pytest.fixture(scope="module")
+def num_features(request):
+    if request.config._benchmarksession.disabled:
+        return TEST_FEATURES
+    return int(
+        os.environ.get("KART_BENCHMARK_FEATURES", DEFAULT_BENCHMARK_FEATURES)
+    )
+
+
+@pytest.fixture(scope="module")
+def synthetic_repo(num_features, tmp_path_factory):
+    """A repo with two commits: the import of the synthetic dataset, then an edit of every EDIT_EVERY-th feature."""
+    repo_path = tmp_path_factory.mktemp("benchmarks") / "repo"
+    repo = KartRepo.init_repository(repo_path)
+    fast_import_tables(
+        repo, [SyntheticPointsImportSource(num_features)], verbosity=0
+    )
+    fast_import_tables(
+        repo,
+        [SyntheticPointsImportSource(num_features, rev=1)],
+        verbosity=0,
+        replace_existing=ReplaceExisting.GIVEN,
+    )
+    return repo
+
+
+def _setup_benchmark(benchmark, num_features, group):
+    benchmark.group = f"{group} (N={num_features})"
+    benchmark.extra_info["num_features"] = num_features
+
+
+def test_import(num_features, tmp_path, benchmark):
+    _setup_benchmark(benchmark, num_features, "import")
+    source = SyntheticPointsImportSource(num_features)
+    repo_paths = iter(tmp_path / f"repo{i}" for i in range(1000))
+
+    def _new_repo():
+        repo = KartRepo.init_repository(next(repo_paths), bare=True)
+        return (repo, [source]), {"verbosity": 0}
+
+    # Each round imports into a new repo, since an import into an existing repo is a different workload.
+    benchmark.pedantic(fast_import_tables, setup=_new_repo, rounds=3)
+
+    repo = KartRepo(tmp_path / "repo0")
+    assert repo.datasets()[DATASET_PATH].feature_count == num_features
+
+
+def test_spatial_filter_index(num_features, synthetic_repo, benchmark):
+    _setup_benchmark(benchmark, num_features, "spatial-filter index")
+    commits = resolve_all_commit_refs(synthetic_repo)
+
+    benchmark.pedantic(
+        update_spatial_filter_index,
+        args=(synthetic_repo, commits),
+        kwargs={"verbosity": 0, "clear_existing": True},
+        rounds=3,
+    )
+
+
+@pytest.mark.parametrize("accuracy", ACCURACY_CHOICES)
+def test_diff_estimation(
+    num_features, synthetic_repo, accuracy, benchmark, monkeypatch
+):
+    _setup_benchmark(benchmark, num_features, "diff estimation")
+    # The estimate is stored as an annotation - don't let later rounds just read it back.
+    monkeypatch.setattr(DiffAnnotations, "get", lambda self, **kwargs: None)
+    base = synthetic_repo.revparse_single("HEAD^")
+    target = synthetic_repo.revparse_single("HEAD")
+
+    result = benchmark(
+        estimate_diff_feature_counts,
+        synthetic_repo,
+        base,
+        target,
+        accuracy=accuracy,
+    )
+    if accuracy == "exact":
+        assert result == {DATASET_PATH: num_features // EDIT_EVERY}
+    else:
+        assert DATASET_PATH in result
+
+
+def test_checkout_gpkg(num_features, synthetic_repo, cli_runner, chdir, benchmark):
+    _setup_benchmark(benchmark, num_features, "checkout")
+
+    def _checkout():
+        r = cli_runner.invoke(
+            ["create-workingcopy", "--delete-existing", "wc.gpkg"]
+        )
+        assert r.exit_code == 0, r.stderr
+
+    with chdir(synthetic_repo.workdir_path):
+        benchmark.pedantic(_checkout, rounds=3)
+
+
+def test_checkout_postgis(
+    num_features, synthetic_repo, cli_runner, chdir, new_postgis_db_schema, benchmark
+):
+    _setup_benchmark(benchmark, num_features, "checkout")
+
+    with new_postgis_db_schema() as (postgres_url, postgres_schema):
+
+        def _checkout():
+            r = cli_runner.invoke(
+                ["create-workingcopy", "--delete-existing", postgres_url]
+            )
+            assert r.exit_code == 0, r.stderr
+
+        with chdir(synthetic_repo.workdir_path):
+            benchmark.pedantic(_checkout, rounds=3)
+            # Leave the repo with a working copy that isn't about to be deleted.
+            r = cli_runner.invoke(
+                ["create-workingcopy", "--delete-existing", "wc.gpkg"]
+            )
+            assert r.exit_code == 0, r.stderr
+
+
+def _synthetic_envelopes(count):
+    result = []
+    for i in range(count):
+        w = (i * 7919 % 35000) / 100 - 180
+        s = (i * 104729 % 17000) / 100 - 90
+        result.append((w, s, w + (i % 10) / 10, s + (i % 7) / 10))
+    return result
+
+
+@pytest.mark.parametrize("operation", ["encode", "decode", "intersecting"])
+@pytest.mark.parametrize("use_native", [True, False])
+def test_envelope_encoder(
+    num_features, operation, use_native, benchmark, monkeypatch
+):
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+    elif native.lib is None:
+        pytest.skip("_kart_native is not available")
+    _setup_benchmark(benchmark, num_features, f"EnvelopeEncoder.{operation}")
+    benchmark.extra_info["native"] = use_native
+
+    encoder = EnvelopeEncoder()
+    envelopes = _synthetic_envelopes(num_features)
+    encoded = encoder.encode_many(envelopes)
+
+    if operation == "encode":
+        assert benchmark(encoder.encode_many, envelopes) == encoded
+    elif operation == "decode":
+        assert len(benchmark(encoder.decode_many, encoded)) == num_features
+    else:
+        assert benchmark(encoder.intersecting, (-10, -10, 10, 10), encoded)
+
+
+@pytest.mark.skipif(is_windows, reason="No helper mode on windows")
+@pytest.mark.parametrize("helper_state", ["cold", "warm"])
+def test_cli_helper_latency(helper_state, tmp_path, benchmark):
+    kart_bin_dir = Path(sys.executable).parent
+    kart_exe = kart_bin_dir / "kart"
+    kart_cli_exe = kart_bin_dir / "kart_cli"
+    if not (kart_exe.is_file() and kart_cli_exe.is_file()):
+        raise pytest.skip(f"Couldn't find kart helper mode in {kart_bin_dir}")
+    benchmark.group = "cli helper latency"
+
+    # The helper socket is $HOME/.kart.<session-id>.socket - a fresh HOME keeps us from using any existing helper.
+    home = tmp_path / "home"
+    home.mkdir()
+    env = os.environ.copy()
+    env.pop("_KART_PGID_SET", None)
+    env["KART_USE_HELPER"] = "1"
+    env["HOME"] = str(home)
+
+    def _run_kart():
+        # A new session means a new socket, so a cold run has to start a new helper.
+        p = subprocess.run(
+            [str(kart_exe), "--version"],
+            env=env,
+            timeout=60,
+            capture_output=True,
+            start_new_session=(helper_state == "cold"),
+        )
+        assert p.returncode == 0, p.stderr
+
+    try:
+        if helper_state == "warm":
+            _run_kart()
+        benchmark.pedantic(_run_kart, rounds=5)
+    finally:
+        # Otherwise the helpers would linger until they time out.
+        subprocess.run(["pkill", "-f", str(home)])
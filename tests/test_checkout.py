@@ -1,9 +1,12 @@
+import threading
+
 import pytest
 
 
 from kart.exceptions import UNCOMMITTED_CHANGES, NO_BRANCH, NO_COMMIT
 from kart.repo import KartRepo
 from kart.structs import CommitWithReference
+from kart.working_copy import WorkingCopyPart
 
 
 H = pytest.helpers.helpers()
@@ -183,3 +186,32 @@ def test_non_checkout_datasets(data_working_copy, cli_runner):
         _check_workingcopy_contains_tables(
             repo, {"census2016_sdhca_ot_sos_short", "census2016_sdhca_ot_ra_short"}
         )
+
+
+@pytest.mark.parametrize("max_workers", [1, 4])
+def test_run_dataset_tasks(max_workers):
+    class ConcurrentPart(WorkingCopyPart):
+        MAX_RESET_WORKERS = max_workers
+
+    part = ConcurrentPart()
+    lock = threading.Lock()
+    done = []
+    thread_ids = set()
+
+    def task(i):
+        with lock:
+            done.append(i)
+            thread_ids.add(threading.get_ident())
+
+    part._run_dataset_tasks(lambda i=i: task(i) for i in range(20))
+    assert sorted(done) == list(range(20))
+    if max_workers == 1:
+        assert thread_ids == {threading.get_ident()}
+    else:
+        assert threading.get_ident() not in thread_ids
+
+    def failing_task():
+        raise ValueError("can't reset dataset")
+
+    with pytest.raises(ValueError, match="can't reset dataset"):
+        part._run_dataset_tasks([failing_task] + [lambda: None] * 5)
@@ -202,3 +202,29 @@ def test_sigint_handling_unix(use_helper, tmp_path):
     sleep(1)
     output_size_4 = subprocess_output_path.stat().st_size
     assert output_size_3 == output_size_4
+
+
+@pytest.mark.skipif(is_windows, reason="No helper mode on windows")
+@pytest.mark.parametrize("exit_code", [0, 1, 7])
+def test_helper_exit_code(exit_code, tmp_path):
+    import subprocess
+
+    kart_bin_dir = Path(sys.executable).parent
+    kart_exe = kart_bin_dir / "kart"
+    kart_cli_exe = kart_bin_dir / "kart_cli"
+    if not (kart_exe.is_file() and kart_cli_exe.is_file()):
+        raise pytest.skip(f"Couldn't find kart helper mode in {kart_bin_dir}")
+
+    test_exit_py_path = tmp_path / "test_exit.py"
+    with open(test_exit_py_path, "wt") as fs:
+        fs.write(f"import sys\ndef main(ctx, args):\n    sys.exit({exit_code})\n")
+
+    env = os.environ.copy()
+    env.pop("_KART_PGID_SET", None)
+    env["KART_USE_HELPER"] = "1"
+
+    # The exit code makes it back to the caller via an exit frame on the helper socket.
+    p = subprocess.run(
+        [str(kart_exe), "ext-run", str(test_exit_py_path)], env=env, timeout=60
+    )
+    assert p.returncode == exit_code
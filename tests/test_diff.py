@@ -11,6 +11,7 @@ import pytest
 
 import kart
 from kart.tabular.v3 import TableV3
+from kart.diff_cache import RawDiffCache
 from kart.diff_format import DiffFormat
 from kart.diff_structs import Delta, DeltaDiff
 from kart.html_diff_writer import HtmlDiffWriter
@@ -2158,3 +2159,49 @@ def test_xss_protection():
 """.lstrip()
 
     assert result == EXPECTED_RESULT
+
+
+def test_diff_cache(data_archive, cli_runner, monkeypatch):
+    monkeypatch.setattr(RawDiffCache, "MIN_DELTAS", 1)
+    monkeypatch.delenv("KART_DIFF_CACHE_SIZE", raising=False)
+
+    with data_archive("points") as repo_path:
+        cache_path = repo_path / ".kart" / "diff-cache"
+        r = cli_runner.invoke(["diff", "HEAD^...HEAD", "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        expected = json.loads(r.stdout)
+        assert len(list(cache_path.iterdir())) == 1
+
+        def _get_raw_diff_for_subtree(self, *args, **kwargs):
+            pytest.fail("The diff should be read from the diff-cache")
+
+        with monkeypatch.context() as m:
+            m.setattr(TableV3, "get_raw_diff_for_subtree", _get_raw_diff_for_subtree)
+            r = cli_runner.invoke(["diff", "HEAD^...HEAD", "-o", "json"])
+            assert r.exit_code == 0, r.stderr
+            assert json.loads(r.stdout) == expected
+
+            # Filtered diffs use the same entry.
+            r = cli_runner.invoke(
+                ["diff", "HEAD^...HEAD", "-o", "json", "nz_pa_points_topo_150k"]
+            )
+            assert r.exit_code == 0, r.stderr
+            assert json.loads(r.stdout) == expected
+
+        # The reverse diff is a different entry.
+        r = cli_runner.invoke(["diff", "HEAD...HEAD^", "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        assert len(list(cache_path.iterdir())) == 2
+
+        # Entries are evicted once the cache is too big.
+        monkeypatch.setattr(RawDiffCache, "DEFAULT_MAX_SIZE", 1)
+        r = cli_runner.invoke(["diff", "HEAD^^?...HEAD^", "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        assert list(cache_path.iterdir()) == []
+
+        # Setting KART_DIFF_CACHE_SIZE=0 turns off the cache.
+        monkeypatch.setenv("KART_DIFF_CACHE_SIZE", "0")
+        r = cli_runner.invoke(["diff", "HEAD^...HEAD", "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        assert json.loads(r.stdout) == expected
+        assert list(cache_path.iterdir()) == []
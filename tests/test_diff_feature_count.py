@@ -1,7 +1,16 @@
 import json
+import subprocess
 
+import pygit2
 import pytest
 
+from kart import native
+from kart.diff_estimation import (
+    CancellationToken,
+    ThreadTerminated,
+    estimate_diff_feature_counts,
+    get_exact_diff_blob_count,
+)
 from kart.repo import KartRepo
 
 H = pytest.helpers.helpers()
@@ -76,6 +85,70 @@ def test_feature_count_commits_fast(data_archive, cli_runner):
         ]
 
 
+@pytest.mark.parametrize("accuracy", ["exact", "fast"])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_feature_count_threads_and_cancellation(
+    accuracy, num_threads, data_archive, cli_runner
+):
+    with data_archive("points") as repo_path:
+        repo = KartRepo(repo_path)
+        base, target = repo.revparse_single("HEAD^"), repo.revparse_single("HEAD")
+
+        cancel_token = CancellationToken()
+        cancel_token.set()
+        with pytest.raises(ThreadTerminated):
+            estimate_diff_feature_counts(
+                repo,
+                base,
+                target,
+                accuracy=accuracy,
+                cancel_token=cancel_token,
+                num_threads=num_threads,
+            )
+
+        assert estimate_diff_feature_counts(
+            repo,
+            base,
+            target,
+            accuracy=accuracy,
+            cancel_token=CancellationToken(),
+            num_threads=num_threads,
+        ) == {"nz_pa_points_topo_150k": 5}
+
+
+@pytest.mark.parametrize("use_native", [True, False])
+def test_exact_diff_blob_count_matches_git(use_native, data_archive, monkeypatch):
+    if use_native and native.lib is None:
+        pytest.skip("_kart_native is not available")
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+
+    with data_archive("polygons") as repo_path:
+        repo = KartRepo(repo_path)
+        trees = [
+            repo.empty_tree,
+            repo.revparse_single("HEAD^").peel(pygit2.Tree),
+            repo.revparse_single("HEAD").peel(pygit2.Tree),
+        ]
+        for tree1 in trees:
+            for tree2 in trees:
+                git_diff = subprocess.check_output(
+                    [
+                        "git",
+                        "-C",
+                        repo.path,
+                        "diff",
+                        "--name-only",
+                        "--no-renames",
+                        f"{tree1.id}..{tree2.id}",
+                    ],
+                    encoding="utf-8",
+                )
+                assert get_exact_diff_blob_count(repo, tree1, tree2) == len(
+                    git_diff.splitlines()
+                )
+
+
 def test_feature_count_fast_for_string_pks(data_archive, cli_runner):
     with data_archive("string-pks"):
         r = cli_runner.invoke(["diff", "--only-feature-count=fast", "HEAD^?...HEAD"])
@@ -1,14 +1,20 @@
+import math
 import re
+import struct
 
 import pytest
 from osgeo import ogr, osr
 
+from kart import native
 from kart.geometry import (
     gpkg_geom_to_hex_wkb,
     gpkg_geom_to_ogr,
     hex_wkb_to_gpkg_geom,
     normalise_gpkg_geom,
     ogr_to_gpkg_geom,
+    ogr_to_hex_wkb,
+    wkb_envelope,
+    wkb_to_little_endian,
     GPKG_ENVELOPE_NONE,
     GPKG_ENVELOPE_XY,
 )
@@ -232,3 +238,77 @@ def test_gpkg_wkb_gpkg_roundtrip(
     gpkg_geom = hex_wkb_to_gpkg_geom(hex_wkb_2)
 
     assert gpkg_geom == input
+
+
+@pytest.mark.parametrize(
+    "wkt",
+    [
+        "POINT(1 2)",
+        "POINT Z(1 2 3)",
+        "POINT M(1 2 3)",
+        "POINT ZM(1 2 3 4)",
+        "POINT EMPTY",
+        "LINESTRING(1 2,-4 5,7 -8)",
+        "LINESTRING Z(1 2 3,4 5 -6)",
+        "LINESTRING M(1 2 3,4 5 -6)",
+        "LINESTRING ZM(1 2 3 4,4 5 -6 7)",
+        "POLYGON((0 0,0 5,5 0,0 0),(1 1,1 2,2 1,1 1))",
+        "MULTIPOINT(1 2,3 -4)",
+        "MULTIPOINT Z(1 2 3,3 -4 5)",
+        "MULTILINESTRING((1 2,3 4),(-5 6,7 8))",
+        "MULTIPOLYGON(((0 0,0 5,5 0,0 0)),((10 10,10 15,15 10,10 10)))",
+        "MULTIPOLYGON ZM(((0 0 1 2,0 5 3 4,5 0 5 6,0 0 1 2)))",
+        "GEOMETRYCOLLECTION(POINT(1 2),LINESTRING(-3 4,5 6),MULTIPOINT EMPTY)",
+        "GEOMETRYCOLLECTION EMPTY",
+        "MULTIPOINT EMPTY",
+        "LINESTRING EMPTY",
+        # These aren't supported by the WKB walker, so OGR is used instead:
+        "CIRCULARSTRING(0 0,1 1,2 0)",
+        "TRIANGLE((0 0 0,0 1 0,1 1 0,0 0 0))",
+    ],
+)
+@pytest.mark.parametrize("use_native", [True, False])
+@pytest.mark.parametrize("little_endian_wkb", [True, False])
+def test_wkb_envelope_matches_ogr(wkt, use_native, little_endian_wkb, monkeypatch):
+    if use_native and native.lib is None:
+        pytest.skip("_kart_native is not available")
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+
+    ogr_geom = ogr.CreateGeometryFromWkt(wkt)
+    wkb = ogr_geom.ExportToIsoWkb(ogr.wkbNDR if little_endian_wkb else ogr.wkbXDR)
+    try:
+        envelope = wkb_envelope(wkb)
+    except ValueError:
+        assert ogr_geom.HasCurveGeometry() or wkt.startswith("TRIANGLE")
+    else:
+        if ogr_geom.IsEmpty():
+            assert envelope is None
+        elif ogr_geom.Is3D():
+            assert envelope == ogr_geom.GetEnvelope3D()
+        else:
+            assert envelope == ogr_geom.GetEnvelope()
+        assert wkb_to_little_endian(wkb) == ogr_geom.ExportToIsoWkb(ogr.wkbNDR)
+
+    # Whether or not OGR is needed, normalising gives the same result as normalising via OGR.
+    for envelope_type in (GPKG_ENVELOPE_NONE, GPKG_ENVELOPE_XY):
+        gpkg_geom = ogr_to_gpkg_geom(
+            ogr_geom,
+            _little_endian_wkb=little_endian_wkb,
+            _add_envelope_type=envelope_type,
+            _add_srs_id=True,
+        )
+        assert normalise_gpkg_geom(gpkg_geom) == ogr_to_gpkg_geom(ogr_geom)
+        assert gpkg_geom_to_hex_wkb(gpkg_geom) == ogr_to_hex_wkb(ogr_geom)
+
+
+@pytest.mark.parametrize("use_native", [True, False])
+def test_wkb_envelope_infinite_coordinates(use_native, monkeypatch):
+    if use_native and native.lib is None:
+        pytest.skip("_kart_native is not available")
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+
+    # A geometry with points isn't empty, even if all of its x values are infinite.
+    wkb = struct.pack("<BIIdddd", 1, 2, 2, math.inf, 1.0, math.inf, 2.0)
+    assert wkb_envelope(wkb) == (math.inf, math.inf, 1.0, 2.0)
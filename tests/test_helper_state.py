@@ -0,0 +1,69 @@
+import os
+
+import pytest
+
+from kart import helper_state
+from kart.repo import KartRepo
+
+
+@pytest.fixture
+def warm_repos(monkeypatch):
+    monkeypatch.setattr(helper_state, "_warm_repos", helper_state.OrderedDict())
+    yield helper_state._warm_repos
+
+
+def test_report_repo_opened(tmp_path, monkeypatch):
+    KartRepo.init_repository(tmp_path / "a")
+    KartRepo.init_repository(tmp_path / "b")
+
+    read_fd, write_fd = os.pipe()
+    try:
+        monkeypatch.setattr(helper_state, "_reported_paths", set())
+        monkeypatch.setattr(helper_state, "_report_fd", write_fd)
+        helper_state.report_repo_opened(tmp_path / "a")
+        helper_state.report_repo_opened(tmp_path / "b")
+        # Only reported once per command.
+        helper_state.report_repo_opened(tmp_path / "a")
+
+        assert helper_state.read_reported_repos(read_fd) == [
+            str((tmp_path / "a").resolve()),
+            str((tmp_path / "b").resolve()),
+        ]
+    finally:
+        os.close(read_fd)
+        os.close(write_fd)
+
+
+def test_warm_repo(tmp_path, warm_repos):
+    repo_path = tmp_path / "test_repo"
+    KartRepo.init_repository(repo_path)
+
+    assert helper_state.warm_repo(repo_path, max_repos=4)
+    # Already warm
+    assert not helper_state.warm_repo(repo_path, max_repos=4)
+
+    repo = helper_state.get_warm_repo(repo_path)
+    assert isinstance(repo, KartRepo)
+    assert repo.workdir_path == repo_path.resolve()
+    # A command only takes the warm repo once
+    assert helper_state.get_warm_repo(repo_path) is None
+
+
+def test_warm_repo_invalidated(tmp_path, warm_repos):
+    repo_path = tmp_path / "test_repo"
+    repo = KartRepo.init_repository(repo_path)
+
+    helper_state.warm_repo(repo_path, max_repos=4)
+    repo.config["kart.test.setting"] = "changed"
+    assert helper_state.get_warm_repo(repo_path) is None
+
+
+def test_warm_repo_eviction(tmp_path, warm_repos):
+    for name in ("a", "b", "c"):
+        KartRepo.init_repository(tmp_path / name)
+        helper_state.warm_repo(tmp_path / name, max_repos=2)
+
+    assert list(warm_repos) == [
+        str((tmp_path / "b").resolve()),
+        str((tmp_path / "c").resolve()),
+    ]
@@ -7,6 +7,7 @@ import pytest
 from kart import dataset_util
 from kart.sqlalchemy.gpkg import Db_GPKG
 from kart.repo import KartRepo
+from kart.tabular.v3 import TableV3
 from kart.exceptions import (
     INVALID_OPERATION,
     NO_IMPORT_SOURCE,
@@ -350,6 +351,85 @@ def test_import_replace_existing_with_compatible_schema_changes(
             old_feature_tree = old_rs.tree / "mytable/.table-dataset/feature"
             assert new_feature_tree == old_feature_tree
 
+            # Replace it again with just a couple of changes - only those changes are imported.
+            with Db_GPKG.create_engine(
+                data / "nz-waca-adjustments.gpkg"
+            ).connect() as conn:
+                conn.execute(
+                    """UPDATE nz_waca_adjustments SET adjusted_nodes = 1234 WHERE id = 1424927;"""
+                )
+                conn.execute("""DELETE FROM nz_waca_adjustments WHERE id = 1443053;""")
+
+            r = cli_runner.invoke(
+                [
+                    "import",
+                    "--replace-existing",
+                    data / "nz-waca-adjustments.gpkg",
+                    "nz_waca_adjustments:mytable",
+                ]
+            )
+            assert r.exit_code == 0, r.stderr
+            r = cli_runner.invoke(["show", "-o", "json"])
+            assert r.exit_code == 0, r.stderr
+            diff = json.loads(r.stdout)["kart.diff/v1+hexwkb"]["mytable"]
+            assert not diff.get("meta")
+            feature_diff = {
+                (d.get("-") or d.get("+"))["id"]: d for d in diff["feature"]
+            }
+            assert feature_diff.keys() == {1424927, 1443053}
+            assert feature_diff[1424927]["+"]["adjusted_nodes"] == 1234
+            assert "+" not in feature_diff[1443053]
+
+
+@pytest.mark.parametrize("max_buffered", [100_000, 50])
+def test_import_replace_existing_with_string_pks(
+    max_buffered, data_working_copy, tmp_path, cli_runner, monkeypatch
+):
+    # Features with string primary keys have hash-based paths, so neighbouring rows are in different trees.
+    # They are grouped by tree before being compared - with max_buffered=50, this takes several rounds.
+    monkeypatch.setattr(TableV3, "REIMPORT_MAX_BUFFERED_FEATURES", max_buffered)
+    compared_tree_paths = []
+    orig_compare = TableV3._compare_features_to_existing_tree
+
+    def _compare(self, schema, replacing_dataset, tree_path, *args, **kwargs):
+        compared_tree_paths.append(tree_path)
+        return orig_compare(self, schema, replacing_dataset, tree_path, *args, **kwargs)
+
+    monkeypatch.setattr(TableV3, "_compare_features_to_existing_tree", _compare)
+
+    with data_working_copy("string-pks") as (repo_path, wc_path):
+        source_path = tmp_path / "source.gpkg"
+        shutil.copy(wc_path, source_path)
+        with Db_GPKG.create_engine(source_path).connect() as conn:
+            edited_pk, deleted_pk = [
+                row[0]
+                for row in conn.execute(
+                    "SELECT id FROM nz_waca_adjustments ORDER BY id LIMIT 2;"
+                )
+            ]
+            conn.execute(
+                "UPDATE nz_waca_adjustments SET adjusted_nodes = 1234 WHERE id = ?;",
+                (edited_pk,),
+            )
+            conn.execute("DELETE FROM nz_waca_adjustments WHERE id = ?;", (deleted_pk,))
+
+        r = cli_runner.invoke(
+            ["import", "--replace-existing", source_path, "nz_waca_adjustments"]
+        )
+        assert r.exit_code == 0, r.stderr
+        r = cli_runner.invoke(["show", "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        diff = json.loads(r.stdout)["kart.diff/v1+hexwkb"]["nz_waca_adjustments"]
+        assert not diff.get("meta")
+        feature_diff = {(d.get("-") or d.get("+"))["id"]: d for d in diff["feature"]}
+        assert feature_diff.keys() == {edited_pk, deleted_pk}
+        assert feature_diff[edited_pk]["+"]["adjusted_nodes"] == 1234
+        assert "+" not in feature_diff[deleted_pk]
+
+        if max_buffered > H.POLYGONS.ROWCOUNT:
+            # Every feature was buffered, so each tree was compared just once, with all of its features.
+            assert len(compared_tree_paths) == len(set(compared_tree_paths))
+
 
 def test_import_replace_existing_with_column_renames(
     data_archive,
@@ -1,7 +1,10 @@
 import json
 import pytest
 
+import pygit2
+
 from kart.exceptions import SUCCESS, INVALID_OPERATION, NO_CONFLICT
+from kart.object_builder import copy_and_modify_tree, merge_tree_changes
 from kart.merge_util import (
     MergedIndex,
     CommitWithReference,
@@ -226,6 +229,62 @@ def test_merge_shallow_clone(data_archive, tmp_path, cli_runner):
         assert r.exit_code == 0, r.stderr
 
 
+def test_merge_tree_changes(data_archive, cli_runner):
+    with data_archive("points") as repo_path:
+        repo = KartRepo(repo_path)
+
+        def commit_files(ref, *items):
+            r = cli_runner.invoke(
+                ["commit-files", "--ref", ref, "-m", ref, "--remove-empty-files"]
+                + list(items)
+            )
+            assert r.exit_code == 0, r.stderr
+
+        def tree(ref):
+            return repo.references[ref].peel(pygit2.Tree)
+
+        commit_files("HEAD", "x/a=1", "x/b=2", "x/c/d=3", "x/e/f=4", "y=5", "z/g=6")
+        repo.create_branch("ours", repo.head_commit)
+        repo.create_branch("theirs", repo.head_commit)
+        repo.create_branch("conflicting", repo.head_commit)
+
+        commit_files("refs/heads/ours", "x/a=10", "x/c/d=", "x/e/f=", "z/h=7")
+        commit_files("refs/heads/theirs", "x/b=20", "x/c/i=8", "y=", "z/g=")
+        commit_files("refs/heads/conflicting", "x/a=100", "y=")
+
+        ancestor = repo.head_commit.peel(pygit2.Tree)
+        ours, theirs = tree("refs/heads/ours"), tree("refs/heads/theirs")
+        changes, subtree_paths = merge_tree_changes(ancestor, ours, theirs)
+        assert subtree_paths == []
+        # Only the subtrees that changed on both sides are visited.
+        assert changes.keys() == {"x", "y", "z"}
+        assert changes["x"].keys() == {"b", "c"}
+        merged = copy_and_modify_tree(repo, ours, changes)
+
+        index = repo.merge_trees(ancestor, ours, theirs)
+        assert not index.conflicts
+        libgit2_merged = repo[index.write_tree(repo)]
+        assert len(merged.diff_to_tree(libgit2_merged)) == 0
+        assert (merged / "x/a").data == b"10"
+        assert (merged / "x/c/i").data == b"8"
+        assert "y" not in merged
+        assert "z/g" not in merged and "z/h" in merged
+
+        # Only the subtree where the same blob changed on both sides is left for libgit2 to merge.
+        conflicting = tree("refs/heads/conflicting")
+        changes, subtree_paths = merge_tree_changes(ancestor, ours, conflicting)
+        assert changes == {"y": None}
+        assert subtree_paths == ["x"]
+
+        subtree_index = repo.merge_trees(ancestor / "x", ours / "x", conflicting / "x")
+        assert subtree_index.conflicts
+        merged_index = MergedIndex.from_subtree_indexes(
+            copy_and_modify_tree(repo, ours, changes), {"x": subtree_index}
+        )
+        index = repo.merge_trees(ancestor, ours, conflicting)
+        assert merged_index == MergedIndex.from_pygit2_index(index)
+
+
 @pytest.mark.parametrize(
     "data",
     [
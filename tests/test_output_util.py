@@ -1,4 +1,14 @@
-from kart.output_util import format_wkt_for_output
+import io
+import json
+
+import pytest
+
+from kart import output_util
+from kart.output_util import (
+    JSON_PARAMS,
+    dump_json_list_output,
+    format_wkt_for_output,
+)
 
 NZGD_2000 = """
 PROJCS["NZGD2000 / New Zealand Transverse Mercator 2000",
@@ -56,3 +66,31 @@ def test_format_wkt_for_output():
         '    AXIS["Easting", EAST],',
         '    AXIS["Northing", NORTH]]',
     ]
+
+
+@pytest.mark.parametrize("json_style", ["pretty", "compact", "extracompact"])
+@pytest.mark.parametrize("num_items", [0, 1, 3])
+def test_dump_json_list_output(json_style, num_items, monkeypatch):
+    # Make sure the output is written in more than one chunk.
+    monkeypatch.setattr(output_util, "OUTPUT_BUFFER_SIZE", 10)
+    items = [
+        {
+            "type": "Feature",
+            "geometry": {"type": "Point", "coordinates": [i, 1.5]},
+            "properties": {"name": f"line\nbreak {i}", "empty": [], "blob": None},
+            "id": f"ds:feature:{i}:I",
+        }
+        for i in range(num_items)
+    ]
+    fp = io.StringIO()
+    dump_json_list_output(
+        {"type": "FeatureCollection"},
+        "features",
+        (item for item in items),
+        fp,
+        json_style=json_style,
+    )
+    expected = json.dumps(
+        {"type": "FeatureCollection", "features": items}, **JSON_PARAMS[json_style]
+    )
+    assert fp.getvalue() == expected + "\n"
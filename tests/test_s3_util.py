@@ -0,0 +1,163 @@
+import hashlib
+import itertools
+import threading
+from types import SimpleNamespace
+
+import pytest
+
+from kart import s3_util
+from kart.lfs_commands import _do_fetch_from_urls
+from kart.lfs_util import get_local_path_from_lfs_oid
+
+
+class _StubBucket:
+    """Stands in for a boto3 Bucket containing the given objects - {key: bytes}. Records which keys are fetched."""
+
+    def __init__(self, objects):
+        self.objects = objects
+        self.fetched_keys = []
+        self.lock = threading.Lock()
+        # If set, the sizes that the progress callback is called with - to simulate boto3 retrying parts.
+        self.callback_sizes = None
+
+    def download_file(self, key, filename, Callback=None, Config=None):
+        assert Config is s3_util._TRANSFER_CONFIG
+        with self.lock:
+            self.fetched_keys.append(key)
+        data = self.objects[key]
+        with open(filename, "wb") as f:
+            f.write(data)
+        if Callback:
+            for num_bytes in self.callback_sizes or [len(data)]:
+                Callback(num_bytes)
+
+
+@pytest.fixture
+def stub_bucket(monkeypatch):
+    """Replaces S3 with a single stub bucket - call it with the objects that the bucket should contain."""
+    bucket = _StubBucket({})
+
+    def _stub_bucket(objects):
+        bucket.objects = objects
+        return bucket
+
+    monkeypatch.setattr(s3_util, "get_s3_bucket", lambda bucket_name: bucket)
+    return _stub_bucket
+
+
+def _sha256(data):
+    return hashlib.sha256(data).hexdigest()
+
+
+@pytest.mark.parametrize(
+    "env_value,expected",
+    [
+        pytest.param(None, 8, id="unset"),
+        pytest.param("20", 20, id="valid"),
+        pytest.param("", 8, id="empty"),
+        pytest.param("lots", 8, id="invalid"),
+        pytest.param("0", 1, id="zero"),
+        pytest.param("-4", 1, id="negative"),
+    ],
+)
+def test_get_fetch_concurrency(env_value, expected, monkeypatch):
+    if env_value is None:
+        monkeypatch.delenv("KART_FETCH_CONCURRENCY", raising=False)
+    else:
+        monkeypatch.setenv("KART_FETCH_CONCURRENCY", env_value)
+    assert s3_util.get_fetch_concurrency() == expected
+
+
+def test_fetch_multiple_from_s3_largest_first(stub_bucket, tmp_path, monkeypatch):
+    # With only one worker, the objects are fetched in the order they are scheduled.
+    monkeypatch.setenv("KART_FETCH_CONCURRENCY", "1")
+    objects = {"small": b"x", "large": b"x" * 100, "medium": b"x" * 10}
+    bucket = stub_bucket(objects)
+
+    s3_util.fetch_multiple_from_s3(
+        [
+            (f"s3://bucket/{key}", tmp_path / key, _sha256(data), len(data))
+            for key, data in objects.items()
+        ],
+        quiet=True,
+    )
+    assert bucket.fetched_keys == ["large", "medium", "small"]
+    for key, data in objects.items():
+        assert (tmp_path / key).read_bytes() == data
+
+    # If any of the sizes aren't known, the objects are fetched in the order given.
+    bucket.fetched_keys = []
+    s3_util.fetch_multiple_from_s3(
+        [(f"s3://bucket/{key}", tmp_path / key) for key in objects], quiet=True
+    )
+    assert bucket.fetched_keys == list(objects)
+
+
+def test_fetch_multiple_from_s3_progress_survives_retries(
+    stub_bucket, tmp_path, monkeypatch
+):
+    updates = []
+
+    class _StubProgress:
+        def __enter__(self):
+            return self
+
+        def __exit__(self, *args):
+            pass
+
+        def update(self, num_bytes):
+            updates.append(num_bytes)
+
+    monkeypatch.setattr(s3_util, "progress_bar", lambda **kwargs: _StubProgress())
+    data = b"x" * 100
+    bucket = stub_bucket({"tile.laz": data})
+    # A part is reported, taken back and then reported again, and another part is reported twice.
+    bucket.callback_sizes = [60, -60, 60, 40, 40]
+
+    s3_util.fetch_multiple_from_s3(
+        [("s3://bucket/tile.laz", tmp_path / "tile.laz", _sha256(data), len(data))]
+    )
+    assert sum(updates) == len(data)
+    assert all(0 <= total <= len(data) for total in itertools.accumulate(updates))
+
+
+def test_fetch_from_urls_dedupes_lfs_oids(stub_bucket, tmp_path):
+    data = b"tile data"
+    lfs_oid = _sha256(data)
+    bucket = stub_bucket({"tile.laz": data, "copy-of-tile.laz": data})
+    repo = SimpleNamespace(gitdir_path=tmp_path)
+
+    # Two pointer files for the same tile - it is only fetched once.
+    _do_fetch_from_urls(
+        repo,
+        [
+            ("s3://bucket/tile.laz", lfs_oid),
+            ("s3://bucket/copy-of-tile.laz", lfs_oid),
+        ],
+        lfs_oid_sizes={lfs_oid: len(data)},
+        quiet=True,
+    )
+    assert len(bucket.fetched_keys) == 1
+    assert get_local_path_from_lfs_oid(repo, lfs_oid).read_bytes() == data
+
+
+def test_fetch_from_s3_verifies_before_replacing(stub_bucket, tmp_path):
+    stub_bucket({"tile.laz": b"corrupt tile data"})
+    output_path = tmp_path / "tile.laz"
+    output_path.write_bytes(b"old tile data")
+
+    with pytest.raises(ValueError, match="Checksum verification failed"):
+        s3_util.fetch_from_s3(
+            "s3://bucket/tile.laz", output_path, sha256_hash=_sha256(b"tile data")
+        )
+    # The file that was already there is untouched, and the bad download is cleaned up.
+    assert output_path.read_bytes() == b"old tile data"
+    assert list(tmp_path.iterdir()) == [output_path]
+
+    stub_bucket({"tile.laz": b"tile data"})
+    result = s3_util.fetch_from_s3(
+        "s3://bucket/tile.laz", output_path, sha256_hash=_sha256(b"tile data")
+    )
+    assert result == output_path.resolve()
+    assert output_path.read_bytes() == b"tile data"
+    assert list(tmp_path.iterdir()) == [output_path]
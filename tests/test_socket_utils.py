@@ -0,0 +1,73 @@
+import os
+import socket
+import struct
+import threading
+
+import pytest
+
+from kart.socket_utils import (
+    COMMAND_BUFFER_LEN,
+    COMMAND_ENTRY_LEN,
+    COMMAND_FRAME_HEADER,
+    FRAME_HEADER,
+    FRAME_TYPE_COMMAND,
+    FRAME_TYPE_EXIT,
+    recv_command_and_fds,
+    recv_frame,
+    send_exit_frame,
+)
+
+
+def _command_frame(pid, argv, environ):
+    # The same format that cli_helper/kart.c sends.
+    entries = [os.fsencode(a) for a in argv] + [
+        os.fsencode(f"{k}={v}") for k, v in environ.items()
+    ]
+    payload = COMMAND_FRAME_HEADER.pack(pid, len(argv), len(environ)) + b"".join(
+        COMMAND_ENTRY_LEN.pack(len(e)) + e for e in entries
+    )
+    return FRAME_HEADER.pack(FRAME_TYPE_COMMAND, len(payload)) + payload
+
+
+@pytest.mark.parametrize("value_len", [10, COMMAND_BUFFER_LEN * 2])
+def test_recv_command_frame(value_len):
+    environ = {
+        "HOME": "/home/kart",
+        "EMPTY": "",
+        "EQUALS": "a=b",
+        "BIG": "x" * value_len,
+    }
+    argv = ["kart", "status", "--output-format=json"]
+
+    a, b = socket.socketpair(socket.AF_UNIX)
+    with a, b:
+        # The frame can be bigger than the socket buffer, so send it from another thread.
+        sender = threading.Thread(
+            target=a.sendall, args=(_command_frame(1234, argv, environ),)
+        )
+        sender.start()
+        command, fds = recv_command_and_fds(b)
+        sender.join()
+
+    assert command == {"pid": 1234, "argv": argv, "environ": environ}
+    assert fds == []
+
+
+def test_recv_json_command():
+    a, b = socket.socketpair(socket.AF_UNIX)
+    with a, b:
+        a.sendall(b'{"pid": 1, "argv": ["kart"], "environ": {"A": "1"}}')
+        command, fds = recv_command_and_fds(b)
+    assert command == {"pid": 1, "argv": ["kart"], "environ": {"A": "1"}}
+
+
+def test_exit_frame():
+    a, b = socket.socketpair(socket.AF_UNIX)
+    with a, b:
+        send_exit_frame(a, -3)
+        frame_type, payload = recv_frame(b)
+        assert frame_type == FRAME_TYPE_EXIT
+        assert struct.unpack("!i", payload) == (-3,)
+
+        a.close()
+        assert recv_frame(b) == (None, None)
@@ -2,17 +2,22 @@ import json
 import os
 import tempfile
 
+import pygit2
 import pytest
+from osgeo import osr
 
+from kart.crs_util import make_crs
 from kart.exceptions import (
     INVALID_ARGUMENT,
     NO_SPATIAL_FILTER,
     UNCOMMITTED_CHANGES,
     SPATIAL_FILTER_CONFLICT,
 )
-from kart.geometry import ring_as_wkt, bbox_as_wkt_polygon
+from kart.geometry import Geometry, ring_as_wkt, bbox_as_wkt_polygon
 from kart.promisor_utils import FetchPromisedBlobsProcess, LibgitSubcode
 from kart.repo import KartRepo
+from kart.spatial_filter import MatchResult, OriginalSpatialFilter, SpatialFilter
+from kart.spatial_filter.index import transform_minmax_envelope
 from kart import subprocess_util as subprocess
 
 H = pytest.helpers.helpers()
@@ -759,6 +764,123 @@ def test_spatial_filtered_workingcopy(
             assert H.row_count(sess, table) == matching_features[archive]
 
 
+@pytest.mark.parametrize(
+    "archive,table,filter_key",
+    [
+        pytest.param("points", H.POINTS.LAYER, "points", id="points"),
+        pytest.param("polygons", H.POLYGONS.LAYER, "polygons", id="polygons"),
+        pytest.param(
+            "polygons",
+            H.POLYGONS.LAYER,
+            "polygons-with-reprojection",
+            id="polygons-with-reprojection",
+        ),
+    ],
+)
+def test_spatial_filtered_workingcopy_with_envelope_index(
+    archive, table, filter_key, data_archive, cli_runner, monkeypatch
+):
+    """Checkout a working copy, using the envelopes in feature_envelopes.db to avoid testing every geometry"""
+    num_matches_calls = 0
+    orig_matches = SpatialFilter.matches
+
+    def _matches(self, feature):
+        nonlocal num_matches_calls
+        num_matches_calls += 1
+        return orig_matches(self, feature)
+
+    monkeypatch.setattr(SpatialFilter, "matches", _matches)
+
+    with data_archive(archive) as repo_path:
+        repo = KartRepo(repo_path)
+        H.clear_working_copy()
+
+        matching_features = {"points": 302, "polygons": 44}
+        total_features = {"points": H.POINTS.ROWCOUNT, "polygons": H.POLYGONS.ROWCOUNT}
+        # The commit that imported all the features:
+        import_commit = {"points": "HEAD^", "polygons": "HEAD"}[archive]
+
+        repo.config["kart.spatialfilter.geometry"] = SPATIAL_FILTER_GEOMETRY[filter_key]
+        repo.config["kart.spatialfilter.crs"] = SPATIAL_FILTER_CRS[filter_key]
+
+        r = cli_runner.invoke(["show", import_commit, "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        expected_diff = json.loads(r.stdout)
+
+        r = cli_runner.invoke(["spatial-filter", "index"])
+        assert r.exit_code == 0, r.stderr
+
+        num_matches_calls = 0
+        r = cli_runner.invoke(["checkout"])
+        assert r.exit_code == 0, r.stderr
+
+        with repo.working_copy.tabular.session() as sess:
+            assert H.row_count(sess, table) == matching_features[archive]
+        # Only the features with envelopes that straddle the edge of the spatial filter are tested individually.
+        assert num_matches_calls < total_features[archive] // 2
+
+        num_matches_calls = 0
+        r = cli_runner.invoke(["show", import_commit, "-o", "json"])
+        assert r.exit_code == 0, r.stderr
+        assert json.loads(r.stdout) == expected_diff
+        assert num_matches_calls < total_features[archive] // 2
+
+
+class _StubEnvelopeIndex:
+    """Stands in for a FeatureEnvelopeIndex containing the given envelopes - {blob_id: (w, s, e, n)}."""
+
+    def __init__(self, envelopes):
+        self.envelopes = envelopes
+
+    def find_envelopes(self, blob_ids, envelope):
+        w, s, e, n = envelope
+        intersecting = {}
+        for blob_id in blob_ids:
+            env = self.envelopes[blob_id]
+            if env[0] <= e and env[2] >= w and env[1] <= n and env[3] >= s:
+                intersecting[blob_id] = env
+        return set(blob_ids) - intersecting.keys(), intersecting
+
+
+def test_match_indexed_envelopes_near_reprojected_edge():
+    # A large spatial filter in NZTM, with straight edges that are curved by a few kilometres in EPSG:4326.
+    # Features just inside and just outside its edges must be decided the same way with and without the index.
+    min_x, max_x, min_y, max_y = 1_100_000, 2_100_000, 5_000_000, 6_100_000
+    mid_x, mid_y = (min_x + max_x) / 2, (min_y + max_y) / 2
+    spatial_filter = OriginalSpatialFilter(
+        "EPSG:2193", bbox_as_wkt_polygon(min_x, max_x, min_y, max_y)
+    )
+
+    points = [(mid_x, mid_y), (mid_x, max_y + 100_000)]
+    for offset in (-1000, 1000):
+        points += [
+            (min_x + offset, mid_y),
+            (max_x + offset, mid_y),
+            (mid_x, min_y + offset),
+            (mid_x, max_y + offset),
+        ]
+    to_wgs84 = osr.CoordinateTransformation(
+        make_crs("EPSG:2193"), make_crs("EPSG:4326")
+    )
+    geometries = {}
+    envelopes = {}
+    for i, (x, y) in enumerate(points):
+        blob_id = pygit2.Oid(raw=i.to_bytes(20, "big"))
+        geometries[blob_id] = Geometry.from_wkt(f"POINT({x} {y})")
+        envelopes[blob_id.raw] = transform_minmax_envelope((x, y, x, y), to_wgs84)
+
+    result = spatial_filter.match_indexed_envelopes(
+        _StubEnvelopeIndex(envelopes), list(geometries)
+    )
+    for (blob_id, geometry), point in zip(geometries.items(), points):
+        if blob_id in result:
+            assert result[blob_id] == spatial_filter.matches(geometry), point
+    # Features that are well inside or well outside the filter are still decided using the index.
+    inside_id, outside_id = list(geometries)[:2]
+    assert result[inside_id] == MatchResult.MATCHING
+    assert result[outside_id] == MatchResult.NON_MATCHING
+
+
 def test_reset_wc_with_spatial_filter(data_archive, cli_runner):
     # This spatial filter matches 2 of the 5 possible changes between main^ and main.
 
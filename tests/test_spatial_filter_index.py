@@ -1,11 +1,23 @@
 import binascii
+import random
+from contextlib import closing
 from dataclasses import dataclass
 import pytest
 
 from osgeo import osr
+from pysqlite3 import dbapi2 as sqlite
 
+from kart import native
 from kart.crs_util import make_crs
+from kart.repo import KartRepo
+from kart.rev_list_objects import (
+    FEATURE_BLOBS_PATTERN,
+    get_dataset_pathspecs,
+    rev_list_feature_blobs,
+    rev_list_matching_blobs,
+)
 from kart.sqlalchemy.sqlite import sqlite_engine
+from kart.spatial_filter import cells
 from kart.spatial_filter.index import (
     CannotIndex,
     EnvelopeEncoder,
@@ -223,16 +235,242 @@ def test_roundtrip_envelope(envelope, expected_encoded_hex):
     _check_envelope(roundtripped, envelope)
 
 
-def test_index_points_all(data_archive, cli_runner):
+def _random_envelopes(count, seed=0):
+    rng = random.Random(seed)
+    result = [(-180, -90, 180, 90), (0, 0, 0, 0), (90, -20, -90, 20)]
+    while len(result) < count:
+        w = rng.uniform(-180, 180)
+        s = rng.uniform(-90, 90)
+        if rng.random() < 0.8:
+            # Mostly small envelopes - some of which will cross the anti-meridian.
+            e = w + rng.uniform(0, 5)
+            e = e - 360 if e > 180 else e
+            n = min(s + rng.uniform(0, 5), 90)
+        else:
+            e = rng.uniform(-180, 180)
+            n = rng.uniform(s, 90)
+        result.append((w, s, e, n))
+    return result
+
+
+@pytest.mark.parametrize("bits_per_value", [8, 20, 32])
+def test_native_envelope_encoder_matches_python(bits_per_value, monkeypatch):
+    if native.lib is None:
+        pytest.skip("_kart_native is not available")
+
+    encoder = EnvelopeEncoder(bits_per_value)
+    envelopes = _random_envelopes(1000)
+    queries = envelopes[:50]
+
+    native_encoded = encoder.encode_many(envelopes)
+    native_decoded = encoder.decode_many(native_encoded)
+    native_hits = [encoder.intersecting(q, native_encoded) for q in queries]
+
+    monkeypatch.setattr(native, "lib", None)
+    python_encoded = encoder.encode_many(envelopes)
+    assert python_encoded == native_encoded
+    assert encoder.decode_many(python_encoded) == native_decoded
+    assert [encoder.intersecting(q, python_encoded) for q in queries] == native_hits
+
+
+@pytest.mark.parametrize("use_native", [True, False])
+def test_envelope_encoder_batch(use_native, monkeypatch):
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+    elif native.lib is None:
+        pytest.skip("_kart_native is not available")
+
+    encoder = EnvelopeEncoder()
+    envelopes = _random_envelopes(100)
+    encoded = encoder.encode_many(envelopes)
+    assert len(encoded) == 100 * encoder.BYTES_PER_ENVELOPE
+    assert encoded[: encoder.BYTES_PER_ENVELOPE] == encoder.encode(envelopes[0])
+    for roundtripped, original in zip(encoder.decode_many(encoded), envelopes):
+        _check_envelope(roundtripped, original)
+
+    assert encoder.encode_many([]) == b""
+    assert encoder.decode_many(b"") == []
+    with pytest.raises(ValueError):
+        encoder.decode_many(encoded[:-1])
+
+    # Encoded envelopes are rounded outwards, so touching envelopes intersect.
+    encoded = encoder.encode_many(
+        [
+            (10, 10, 20, 20),
+            (20, 20, 30, 30),
+            (-170, 10, -160, 20),
+            (175, 10, -175, 20),
+            (5, 5, 5, 5),
+            (-180, -90, 180, 90),
+        ]
+    )
+    assert encoder.intersecting((15, 15, 25, 25), encoded) == [0, 1, 5]
+    assert encoder.intersecting((30, 30, 40, 40), encoded) == [1, 5]
+    # Queries and envelopes that cross the anti-meridian:
+    assert encoder.intersecting((170, 12, -165, 18), encoded) == [2, 3, 5]
+    assert encoder.intersecting((179, 12, 179.5, 18), encoded) == [3, 5]
+    assert encoder.intersecting((0, 0, 10, 10), encoded) == [0, 4, 5]
+    assert encoder.intersecting((0, 0, 1, 1), encoded) == [5]
+
+
+def test_cell_ids():
+    root = cells.cell_id(0, 0, 0)
+    assert cells.cell_position(root) == (0, 0, 0)
+    assert cells.cell_ancestors(root) == []
+    assert cells.cells_for_envelope((-180, -90, 180, 90), 1) == [root]
+    world_cells = cells.cells_for_envelope((-180, -90, 180, 90))
+    assert sorted(world_cells) == sorted(
+        cells.cell_id(1, x, y) for x, y in [(0, 0), (0, 1), (1, 0), (1, 1)]
+    )
+
+    rand = random.Random(789)
+    for _ in range(100):
+        level = rand.randint(1, cells.MAX_LEVEL)
+        x = rand.randrange(1 << level)
+        y = rand.randrange(1 << level)
+        cell = cells.cell_id(level, x, y)
+        assert cells.cell_position(cell) == (level, x, y)
+        assert 0 < cell < 2**63
+
+        parent = cells.cell_parent(cell)
+        assert cells.cell_position(parent) == (level - 1, x // 2, y // 2)
+        ancestors = cells.cell_ancestors(cell)
+        assert len(ancestors) == level
+        assert ancestors[0] == root and ancestors[-1] == parent
+        for ancestor in ancestors:
+            min_id, max_id = cells.cell_range(ancestor)
+            assert min_id <= cell <= max_id
+
+        # Cells at the same level don't overlap.
+        sibling = cells.cell_id(level, x ^ 1, y)
+        min_id, max_id = cells.cell_range(cell)
+        assert not (min_id <= sibling <= max_id)
+
+
+def test_cells_for_envelope():
+    # A point is in one cell at the deepest level.
+    point_cells = cells.cells_for_envelope((174.78, -41.29, 174.78, -41.29))
+    assert len(point_cells) == 1
+    assert cells.cell_level(point_cells[0]) == cells.MAX_LEVEL
+
+    for envelope in _random_envelopes(100):
+        envelope_cells = cells.cells_for_envelope(envelope)
+        # Anti-meridian envelopes are covered in two pieces.
+        assert 1 <= len(envelope_cells) <= 8
+        assert len(cells.cells_for_envelope(envelope, 4)) <= 2 * 16
+        if envelope[0] <= envelope[2]:
+            assert len(envelope_cells) <= 4
+            level = cells.cell_level(envelope_cells[0])
+            assert all(cells.cell_level(c) == level for c in envelope_cells)
+
+
+def test_find_intersecting_blob_ids(data_archive, cli_runner):
+    with data_archive("points.tgz") as repo_path:
+        r = cli_runner.invoke(["spatial-filter", "index", H.POINTS.HEAD1_SHA])
+        assert r.exit_code == 0, r.stderr
+
+        # The cells are only written if they are asked for.
+        db_path = repo_path / ".kart" / "feature_envelopes.db"
+        with sessionmaker(bind=sqlite_engine(db_path))() as sess:
+            assert not sess.scalar(
+                "SELECT count(*) FROM sqlite_master WHERE name = 'feature_cells';"
+            )
+
+        # Adding cells to an existing index adds them for the features that are already indexed, too.
+        r = cli_runner.invoke(
+            ["spatial-filter", "index", "--with-cells", H.POINTS.HEAD_SHA]
+        )
+        assert r.exit_code == 0, r.stderr
+
+        with closing(sqlite.connect(f"file:{db_path}", uri=True)) as db:
+            rows = db.execute(
+                "SELECT blob_id, envelope FROM feature_envelopes;"
+            ).fetchall()
+            assert len(rows) == 2148
+            assert db.execute(
+                "SELECT COUNT(DISTINCT blob_id) FROM feature_cells;"
+            ).fetchone() == (2148,)
+
+            encoder = EnvelopeEncoder()
+            buffer = b"".join(row[1] for row in rows)
+            for query in [
+                (-180, -90, 180, 90),
+                (174.5, -41.5, 175, -41),
+                (170, -45, 175, -40),
+                (174.78, -41.29, 174.78, -41.29),
+                (175, -50, -175, -30),
+                (0, 0, 10, 10),
+            ]:
+                expected = {rows[i][0] for i in encoder.intersecting(query, buffer)}
+                assert cells.find_intersecting_blob_ids(db, query) == expected
+
+
+@pytest.mark.parametrize("num_workers", [1, 3])
+def test_index_points_all(num_workers, data_archive, cli_runner):
     # Indexing --all should give the same results every time.
     # For points, every point should have only one long S2 cell token.
     with data_archive("points.tgz") as repo_path:
-        r = cli_runner.invoke(["spatial-filter", "index"])
+        r = cli_runner.invoke(
+            ["spatial-filter", "index", f"--num-workers={num_workers}"]
+        )
         assert r.exit_code == 0, r.stderr
         s = _get_index_summary(repo_path)
         assert s.features == 2148
         _check_index(s, EXPECTED_POINTS_INDEX)
 
+        # The index is built in WAL mode, but is left in the default journal mode.
+        db_path = repo_path / ".kart" / "feature_envelopes.db"
+        with sessionmaker(bind=sqlite_engine(db_path))() as sess:
+            assert sess.scalar("PRAGMA journal_mode;") == "delete"
+
+
+@pytest.mark.parametrize("use_native", [True, False])
+def test_walk_feature_blobs_matches_rev_list(use_native, data_archive, monkeypatch):
+    # The in-process walk should find the same feature blobs as git rev-list --objects.
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+    elif native.lib is None:
+        pytest.skip("_kart_native is not available")
+
+    def _rev_list_blobs(repo, start_commits, stop_commits):
+        pathspecs = get_dataset_pathspecs(
+            repo,
+            start_commits,
+            stop_commits,
+            dirname_filter=lambda d: d.startswith(".table-dataset"),
+        )
+        return {
+            blob.id.hex: m.group(1)
+            for _, m, blob in rev_list_matching_blobs(
+                repo, start_commits, stop_commits, pathspecs, FEATURE_BLOBS_PATTERN
+            )
+        }
+
+    def _walked_blobs(repo, start_commits, stop_commits, incremental=False):
+        result = {}
+        for _, path, blob in rev_list_feature_blobs(
+            repo, start_commits, stop_commits, incremental=incremental
+        ):
+            assert FEATURE_BLOBS_PATTERN.fullmatch(path.group(0))
+            result[blob.id.hex] = path.group(1)
+        return result
+
+    with data_archive("points.tgz") as repo_path:
+        repo = KartRepo(repo_path)
+        for start_commits, stop_commits in [
+            ({H.POINTS.HEAD_SHA}, set()),
+            ({H.POINTS.HEAD1_SHA}, set()),
+            ({H.POINTS.HEAD_SHA}, {H.POINTS.HEAD1_SHA}),
+            ({H.POINTS.HEAD_SHA}, {H.POINTS.HEAD_SHA}),
+        ]:
+            expected = _rev_list_blobs(repo, start_commits, stop_commits)
+            assert _walked_blobs(repo, start_commits, stop_commits) == expected
+            # The incremental walk finds the same blobs, since no blob in this repo was reverted or moved:
+            assert (
+                _walked_blobs(repo, start_commits, stop_commits, incremental=True)
+                == expected
+            )
+
 
 def test_index_points_commit_by_commit(data_archive, cli_runner):
     # Indexing one commit at a time should get the same results as indexing --all.
@@ -249,6 +487,24 @@ def test_index_points_commit_by_commit(data_archive, cli_runner):
         _check_index(s, EXPECTED_POINTS_INDEX)
 
 
+def test_index_points_incremental(data_archive, cli_runner):
+    # Indexing incrementally on top of an existing index should get the same results as indexing --all.
+    with data_archive("points.tgz") as repo_path:
+        r = cli_runner.invoke(["spatial-filter", "index", H.POINTS.HEAD1_SHA])
+        assert r.exit_code == 0, r.stderr
+        s = _get_index_summary(repo_path)
+        assert s.features == 2143
+
+        r = cli_runner.invoke(
+            ["spatial-filter", "index", "--incremental", H.POINTS.HEAD_SHA]
+        )
+        assert r.exit_code == 0, r.stderr
+        assert "Indexed 5 features" in r.stdout
+        s = _get_index_summary(repo_path)
+        assert s.features == 2148
+        _check_index(s, EXPECTED_POINTS_INDEX)
+
+
 def test_index_points_idempotent(data_archive, cli_runner):
     # Indexing the commits one at a time and then indexing all commits again will also give the same result.
     # (We force everything to be indexed twice by deleting the record of whats been indexed).
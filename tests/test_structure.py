@@ -12,9 +12,9 @@ import pytest
 
 from memory_repo import MemoryRepo
 
-from kart import init, fast_import
+from kart import init, fast_import, native
 from kart.tabular.v3 import TableV3
-from kart.tabular.v3_paths import IntPathEncoder, MsgpackHashPathEncoder
+from kart.tabular.v3_paths import IntPathEncoder, MsgpackHashPathEncoder, PathEncoder
 from kart.exceptions import (
     WORKING_COPY_OR_IMPORT_CONFLICT,
     NO_CHANGES,
@@ -870,6 +870,78 @@ def test_pk_encoder_int_pk():
     )
 
 
+_PATH_ENCODER_TEST_PKS = [
+    *([i] for i in range(-300, 300)),
+    *([i] for i in (2**7, 2**8, 2**16, 2**32, 2**63, 2**64 - 1, 64**5, 64**5 + 1)),
+    *([-i] for i in (2**5, 2**5 + 1, 2**7, 2**15, 2**31, 2**63, 64**5)),
+    [""],
+    ["Dave"],
+    ["x" * 31],
+    ["x" * 32],
+    ["é" * 200],
+    ["🗺️" * 20000],
+    [b""],
+    [b"\x00" * 300],
+    [None],
+    [True],
+    [False],
+    [0.1],
+    [-1e300],
+    ("tuple", 1),
+    ["Dave", 1181, None, 2.5, b"\xff"],
+    list(range(20)),
+    # These can't be encoded natively, and some of these can't be encoded at all.
+    [2**64],
+    [-(2**63) - 1],
+    ["\ud800"],
+    [[1, 2]],
+    [],
+]
+
+
+@pytest.mark.parametrize("use_native", [True, False])
+@pytest.mark.parametrize("scheme", ["msgpack/hash", "int"])
+@pytest.mark.parametrize(
+    "encoding,branches",
+    [("hex", 16), ("hex", 256), ("base64", 64), ("base64", 4096), ("base64", 1)],
+)
+@pytest.mark.parametrize("levels", [0, 1, 2, 4, 7])
+def test_encode_pks_to_paths(
+    use_native, scheme, encoding, branches, levels, monkeypatch
+):
+    if use_native and native.lib is None:
+        pytest.skip("_kart_native is not available")
+    if not use_native:
+        monkeypatch.setattr(native, "lib", None)
+
+    encoder = PathEncoder.get(
+        scheme=scheme, encoding=encoding, branches=branches, levels=levels
+    )
+
+    def encode(pk_values):
+        try:
+            return encoder.encode_pks_to_path(pk_values)
+        except (TypeError, ValueError, OverflowError) as e:
+            return type(e)
+
+    expected = [encode(pk_values) for pk_values in _PATH_ENCODER_TEST_PKS]
+    # The batch is made up of all the PK values that can be encoded, together with at most one that can't.
+    encodable = [
+        pk_values
+        for pk_values, expected_path in zip(_PATH_ENCODER_TEST_PKS, expected)
+        if isinstance(expected_path, str)
+    ]
+    assert encoder.encode_pks_to_paths(encodable) == [
+        expected_path for expected_path in expected if isinstance(expected_path, str)
+    ]
+    for pk_values, expected_path in zip(_PATH_ENCODER_TEST_PKS, expected):
+        if isinstance(expected_path, str):
+            assert encoder.encode_pks_to_paths([pk_values]) == [expected_path]
+        else:
+            with pytest.raises(expected_path):
+                encoder.encode_pks_to_paths(encodable + [pk_values])
+
+
 @pytest.mark.slow
 @pytest.mark.parametrize(*GPKG_IMPORTS)
 @pytest.mark.parametrize("profile", ["get_feature_by_pk", "get_feature_from_data"])
@@ -1084,6 +1156,47 @@ def test_fast_import(data_archive, tmp_path, cli_runner, chdir):
             assert feature_count == source.feature_count
 
 
+@pytest.mark.parametrize("limit", [None, 1500])
+def test_fast_import_num_workers(limit, data_archive, tmp_path, cli_runner, chdir):
+    # Encoding the features in worker processes, and splitting them between several git-fast-import processes,
+    # should give exactly the same trees as doing everything serially.
+    table = H.POINTS.LAYER
+    with data_archive("gpkg-points") as data:
+        feature_trees = []
+        for num_workers, num_shards in [(1, 1), (3, 1), (3, 4)]:
+            repo_path = tmp_path / f"repo-{num_workers}-{num_shards}"
+            repo_path.mkdir()
+
+            with chdir(repo_path):
+                r = cli_runner.invoke(["init"])
+                assert r.exit_code == 0, r
+
+                repo = KartRepo(repo_path)
+                source = TableImportSource.open(
+                    data / "nz-pa-points-topo-150k.gpkg", table=table
+                )
+                fast_import.fast_import_tables(
+                    repo,
+                    [source],
+                    settings=fast_import.FastImportSettings(
+                        num_workers=num_workers, num_shards=num_shards
+                    ),
+                    from_commit=None,
+                    limit=limit,
+                )
+
+                dataset = repo.datasets()[table]
+                feature_count = sum(1 for f in dataset.features())
+                assert feature_count == (limit or source.feature_count)
+                feature_trees.append(dataset.feature_tree.id)
+                # The temporary refs used for the import and its shards are all removed.
+                assert not [
+                    r for r in repo.references if r.startswith("refs/kart-import/")
+                ]
+
+        assert len(set(feature_trees)) == 1
+
+
 def test_postgis_import_with_sampled_geometry_dimension(
     postgis_db,
     data_archive,
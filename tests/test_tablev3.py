@@ -216,6 +216,11 @@ def test_feature_roundtrip(gen_uuid):
     # We guarantee that the dict iterates in row-order.
     assert tuple(roundtripped_feature.values()) == feature_tuple
 
+    batch = tableV3.get_feature_batch([(feature_path, feature_data)] * 3)
+    assert len(batch) == 3
+    assert list(batch.features()) == [feature_dict] * 3
+    assert batch.rows == [feature_tuple] * 3
+
 
 def test_schema_change_roundtrip(gen_uuid):
     old_schema = Schema(
@@ -288,3 +293,8 @@ def test_schema_change_roundtrip(gen_uuid):
     }
     # We guarantee that the dict iterates in row-order.
     assert tuple(roundtripped.values()) == (7, None, "Bloggs", "Joe", None)
+
+    # Decoding features in a batch gives the same result.
+    batch = tableV3.get_feature_batch([(feature_path, feature_data)])
+    assert list(batch.features()) == [roundtripped]
+    assert batch.rows == [(7, None, "Bloggs", "Joe", None)]
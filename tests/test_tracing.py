@@ -0,0 +1,73 @@
+import json
+
+import pytest
+
+from kart import tracing
+
+H = pytest.helpers.helpers()
+
+
+def _read_trace(trace_path):
+    # The trace is a JSON array that is never closed.
+    text = trace_path.read_text()
+    assert text.startswith("[\n")
+    return json.loads(text.rstrip().rstrip(",") + "]")
+
+
+def _span_names(events):
+    return {e["name"] for e in events if e["ph"] == "X"}
+
+
+def test_command_name():
+    assert tracing.command_name(["git", "rev-list", "--objects"]) == "git rev-list"
+    assert (
+        tracing.command_name(["git", "-C", "/repo", "-c", "a=b", "fetch", "origin"])
+        == "git fetch"
+    )
+    assert tracing.command_name(["/usr/bin/pdal", "--version"]) == "pdal"
+
+
+def test_span(tmp_path, monkeypatch):
+    trace_path = tmp_path / "trace.json"
+    monkeypatch.setenv("KART_TRACE", str(trace_path))
+
+    with tracing.span("outer", cat="test", x=1) as args:
+        with tracing.span("inner", cat="test"):
+            pass
+        args["y"] = 2
+    with pytest.raises(ValueError):
+        with tracing.span("failed", cat="test"):
+            raise ValueError()
+
+    events = _read_trace(trace_path)
+    assert events[0]["ph"] == "M"
+    inner, outer, failed = events[1:]
+    assert [e["name"] for e in (inner, outer, failed)] == ["inner", "outer", "failed"]
+    assert outer["args"] == {"x": 1, "y": 2}
+    assert outer["ts"] <= inner["ts"]
+    assert inner["ts"] + inner["dur"] <= outer["ts"] + outer["dur"]
+
+
+def test_trace_commands(data_working_copy, cli_runner, tmp_path, monkeypatch):
+    trace_path = tmp_path / "trace.json"
+    monkeypatch.setenv("KART_TRACE", str(trace_path))
+
+    with data_working_copy("points"):
+        r = cli_runner.invoke(["create-workingcopy", "--delete-existing"])
+        assert r.exit_code == 0, r.stderr
+        r = cli_runner.invoke(["diff", "HEAD^...HEAD"])
+        assert r.exit_code == 0, r.stderr
+        r = cli_runner.invoke(["spatial-filter", "index"])
+        assert r.exit_code == 0, r.stderr
+
+    span_names = _span_names(_read_trace(trace_path))
+    assert {
+        "working copy transaction",
+        "working copy bulk load",
+        "diff base<>target",
+        "diff write dataset",
+        "git show-ref",
+        "git rev-list",
+        "spatial-filter index",
+        "spatial-filter index write",
+    } <= span_names
@@ -650,6 +650,84 @@ def test_geopackage_locking_edit(data_working_copy, cli_runner, monkeypatch):
             assert H.last_change_time(sess) == "2019-06-11T11:03:58.000000Z"
 
 
+def test_bulk_load_session_restores_pragmas(data_working_copy, monkeypatch):
+    with data_working_copy("points") as (repo_path, wc_path):
+        table_wc = KartRepo(repo_path).working_copy.tabular
+        pragma_names = ("synchronous", "journal_mode")
+        with table_wc.session() as sess:
+            orig_pragmas = {n: sess.scalar(f"PRAGMA {n};") for n in pragma_names}
+
+        # Pragmas are per-connection - check them on the bulk-load connection, just after they are restored.
+        restored_pragmas = []
+        orig_restore_pragmas = type(table_wc)._restore_pragmas
+
+        def _restore_pragmas(self, conn, pragmas):
+            orig_restore_pragmas(self, conn, pragmas)
+            restored_pragmas.append(
+                {n: conn.scalar(f"PRAGMA {n};") for n in pragma_names}
+            )
+
+        monkeypatch.setattr(type(table_wc), "_restore_pragmas", _restore_pragmas)
+
+        with pytest.raises(ValueError, match="bulk load failed"):
+            with table_wc.session(bulk_load=True) as sess:
+                assert sess.scalar("PRAGMA synchronous;") == 1
+                assert sess.scalar("PRAGMA journal_mode;") == "memory"
+                sess.execute(f"DELETE FROM {H.POINTS.LAYER};")
+                raise ValueError("bulk load failed")
+
+        assert restored_pragmas == [orig_pragmas]
+        with table_wc.session() as sess:
+            assert H.row_count(sess, H.POINTS.LAYER) == H.POINTS.ROWCOUNT
+
+
+@pytest.mark.parametrize(
+    "archive,table",
+    [
+        pytest.param("points", H.POINTS.LAYER, id="points"),
+        pytest.param("polygons", H.POLYGONS.LAYER, id="polygons"),
+    ],
+)
+def test_spatial_index_after_bulk_load(archive, table, data_working_copy):
+    # The R-tree is filled all at once after the features are written - check that a spatial query using it
+    # finds the features that testing every geometry finds. (The R-tree rounds envelopes outwards, so it can
+    # find a few more.)
+    with data_working_copy(archive) as (repo_path, wc_path):
+        table_wc = KartRepo(repo_path).working_copy.tabular
+        with table_wc.session() as sess:
+            w, e, s, n = sess.execute(
+                f"""
+                SELECT MIN(ST_MinX(geom)), MAX(ST_MaxX(geom)), MIN(ST_MinY(geom)), MAX(ST_MaxY(geom))
+                FROM {table};
+                """
+            ).fetchone()
+            # The south-west quarter of the dataset's extent:
+            bbox = {"w": w, "e": (w + e) / 2, "s": s, "n": (s + n) / 2}
+            rtree_ids = {
+                row[0]
+                for row in sess.execute(
+                    f"""
+                    SELECT id FROM "rtree_{table}_geom"
+                    WHERE minx <= :e AND maxx >= :w AND miny <= :n AND maxy >= :s;
+                    """,
+                    bbox,
+                )
+            }
+            table_ids = {
+                row[0]
+                for row in sess.execute(
+                    f"""
+                    SELECT ROWID FROM {table}
+                    WHERE ST_MinX(geom) <= :e AND ST_MaxX(geom) >= :w
+                    AND ST_MinY(geom) <= :n AND ST_MaxY(geom) >= :s;
+                    """,
+                    bbox,
+                )
+            }
+        assert table_ids
+        assert table_ids <= rtree_ids
+
+
 def test_create_workingcopy(data_working_copy, cli_runner, tmp_path):
     with data_working_copy("points") as (repo_path, _):
         repo = KartRepo(repo_path)
@@ -1062,6 +1140,37 @@ def test_reset_transaction(data_working_copy, cli_runner, edit_points):
         }
 
 
+@pytest.mark.parametrize("batch_size", [1, 3, 1000])
+def test_diff_dirty_features_by_pk(
+    batch_size, data_working_copy, cli_runner, edit_points, monkeypatch
+):
+    with data_working_copy("points") as (repo_path, wc_path):
+        repo = KartRepo(repo_path)
+        table_wc = repo.working_copy.tabular
+        with table_wc.session() as sess:
+            edit_points(sess)
+
+        r = cli_runner.invoke(["diff", "--output-format=json"])
+        assert r.exit_code == 0, r.stderr
+        expected = json.loads(r.stdout)
+
+        # GPKG doesn't need to cast PKs for the tracking table, so it normally just joins the tracking table to
+        # the table. Make it fetch the dirty rows by PK, the way the other working copies do.
+        monkeypatch.setattr(type(table_wc), "_tracking_table_requires_cast", True)
+        monkeypatch.setattr(TableWorkingCopy, "DIRTY_ROWS_BATCH_SIZE", batch_size)
+
+        r = cli_runner.invoke(["diff", "--output-format=json"])
+        assert r.exit_code == 0, r.stderr
+        assert json.loads(r.stdout) == expected
+
+        r = cli_runner.invoke(["status", "--output-format=json"])
+        assert r.exit_code == 0, r.stderr
+        changes = json.loads(r.stdout)["kart.status/v2"]["workingCopy"]["changes"]
+        assert changes == {
+            H.POINTS.LAYER: {"feature": {"inserts": 1, "updates": 2, "deletes": 5}}
+        }
+
+
 def test_meta_updates(data_working_copy, cli_runner):
     with data_working_copy("meta-updates") as (repo_path, wc_path):
         # These commits have minor schema changes.
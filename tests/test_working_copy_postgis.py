@@ -6,7 +6,7 @@ import pygit2
 
 from kart.repo import KartRepo
 
-from kart.tabular.working_copy.base import TableWorkingCopyStatus
+from kart.tabular.working_copy.base import TableWorkingCopy, TableWorkingCopyStatus
 from kart.sqlalchemy import strip_password
 from kart.sqlalchemy.adapter.postgis import KartAdapter_Postgis
 from test_working_copy import compute_approximated_types
@@ -820,3 +820,74 @@ def test_init_without_postgis(
                 f"Dataset '{table}' requires the PostGIS extension to be installed in the working copy."
                 in result.stderr
             )
+
+
+def test_copy_text_value():
+    # Values as they are sent to PostGIS when a dataset is bulk-loaded using COPY.
+    from kart.tabular.working_copy.postgis import _copy_text_value
+
+    assert _copy_text_value(None) == "\\N"
+    assert _copy_text_value(True) == "t"
+    assert _copy_text_value(False) == "f"
+    assert _copy_text_value(-12) == "-12"
+    assert _copy_text_value(0.1) == "0.1"
+    assert _copy_text_value(float("nan")) == "NaN"
+    assert _copy_text_value(float("-inf")) == "-Infinity"
+    assert _copy_text_value(b"\x00\xff") == "\\\\x00ff"
+    assert _copy_text_value("P1DT12H36M") == "P1DT12H36M"
+    assert _copy_text_value("tab\tnew\nline\r\\") == "tab\\tnew\\nline\\r\\\\"
+
+
+def test_reset_failure_rolls_back_every_dataset(
+    data_archive, cli_runner, new_postgis_db_schema, monkeypatch
+):
+    # If one dataset fails to reset, the datasets that were reset before it are rolled back too.
+    tables = ["census2016_sdhca_ot_ra_short", "census2016_sdhca_ot_sos_short"]
+    with data_archive("au-census") as repo_path:
+        repo = KartRepo(repo_path)
+        H.clear_working_copy()
+        with new_postgis_db_schema() as (postgres_url, postgres_schema):
+            r = cli_runner.invoke(["create-workingcopy", postgres_url])
+            assert r.exit_code == 0, r.stderr
+
+            table_wc = repo.working_copy.tabular
+            with table_wc.session() as sess:
+                for table in tables:
+                    sess.execute(f"DELETE FROM {postgres_schema}.{table};")
+
+            r = cli_runner.invoke(["diff", "--output-format=json"])
+            assert r.exit_code == 0, r.stderr
+            edits = json.loads(r.stdout)
+            assert sorted(edits["kart.diff/v1+hexwkb"]) == tables
+
+            orig_update_table = TableWorkingCopy._update_table
+            reset_datasets = []
+
+            def _update_table(self, sess, base_ds, target_ds, *args, **kwargs):
+                if reset_datasets:
+                    raise RuntimeError(f"Can't reset {target_ds.path}")
+                orig_update_table(self, sess, base_ds, target_ds, *args, **kwargs)
+                reset_datasets.append(target_ds.path)
+
+            monkeypatch.setattr(TableWorkingCopy, "_update_table", _update_table)
+            with pytest.raises(RuntimeError, match="Can't reset"):
+                cli_runner.invoke(["reset", "--discard-changes"])
+            assert len(reset_datasets) == 1
+            monkeypatch.undo()
+
+            # Neither dataset was reset, and kart_state still names the tree that the tables are edits of.
+            assert table_wc.get_tree_id() == repo.head_tree.hex
+            with table_wc.session() as sess:
+                for table in tables:
+                    count = sess.scalar(
+                        f"SELECT COUNT(*) FROM {postgres_schema}.{table};"
+                    )
+                    assert count == 0
+            r = cli_runner.invoke(["diff", "--output-format=json"])
+            assert r.exit_code == 0, r.stderr
+            assert json.loads(r.stdout) == edits
+
+            r = cli_runner.invoke(["reset", "--discard-changes"])
+            assert r.exit_code == 0, r.stderr
+            r = cli_runner.invoke(["diff", "--exit-code"])
+            assert r.exit_code == 0, r.stderr